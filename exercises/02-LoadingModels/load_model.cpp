@@ -99,7 +99,7 @@ int main()
     glViewport(0, 0, width, height);
 
     // we enable Z test
-    glEnable(GL_DEPTH_TEST);
+    glState().enable(GL_DEPTH_TEST);
 
     // the "clear" color for the frame buffer
     glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
@@ -116,7 +116,7 @@ int main()
     Model bunny{"../../models/bunny_lp.obj"};
 
     // Uncommenting this call will result in wireframe polygons.
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    glState().setPolygonMode(GL_LINE);
 
     // Setup model-view-projection
     glm::mat4 model = glm::mat4(1.0f);
@@ -41,6 +41,7 @@ positive Z axis points "outside" the screen
 // classes developed during lab lectures to manage shaders and to load models
 #include <utils/shader.h>
 #include <utils/model.h>
+#include <utils/frame_uniforms.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -71,7 +72,7 @@ GLfloat frequency = 10.f;
 GLfloat power = 1.f;
 GLfloat harmonics = 4.f;
 
-void setup_model(Shader shader, const glm::mat4& view, glm::mat4& model, glm::mat3& norm)
+void setup_model(const Shader& shader, const glm::mat4& view, glm::mat4& model, glm::mat3& norm)
 {
     norm = glm::inverseTranspose(glm::mat3(view * model));
 
@@ -128,14 +129,14 @@ int main()
     glViewport(0, 0, width, height);
 
     // we enable Z test
-    glEnable(GL_DEPTH_TEST);
+    glState().enable(GL_DEPTH_TEST);
 
     // the "clear" color for the frame buffer
     glClearColor(0.26f, 0.46f, 0.98f, 1.0f); // sky
     //glClearColor(0.05f, 0.05f, 0.05f, 1.0f);   // black
 
     // we create and compile shaders (code of Shader class is in include/utils/shader.h)
-    Shader shader("../../shaders/deform.vert", "../../shaders/uvs.frag");
+    Shader shader("../../shaders/deform.vert", "../../shaders/uvs.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"});
 
     // we load the model(s) (code of Model class is in include/utils/model.h)
     Model cube  ("../../models/cube.obj"  );
@@ -154,6 +155,9 @@ int main()
     glm::mat4 proj = glm::perspective(45.f, 
         (float) screenWidth / (float)screenHeight, 0.1f, 100.f);
 
+    // per-frame uniform buffer with camera and time values
+    FrameUniforms frame;
+
     glm::mat4 cube_model_mat{1} , sphere_model_mat{1}, bunny_model_mat{1};
     glm::mat3 cube_normal_mat{1}, sphere_normal_mat{1}, bunny_normal_mat{1};
     
@@ -177,16 +181,15 @@ int main()
         // we "clear" the frame and z  buffer
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // setting up uniforms
-        shader.setMat4("u_proj", proj);
-        shader.setMat4("u_view", view);
+        // setting up uniforms: view and projection are shared by every program through the FrameUniforms block
+        frame.update(view, proj, glm::vec3(0, 0, 7), currentFrame, deltaTime);
         //glUniformMatrix4fv(glGetUniformLocation(shader.program, "u_proj"), 1, GL_FALSE, glm::value_ptr(proj));
         //glUniformMatrix4fv(glGetUniformLocation(shader.program, "u_view"), 1, GL_FALSE, glm::value_ptr(view));
 
         if(wire)
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            glState().setPolygonMode(GL_LINE);
         else
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+            glState().setPolygonMode(GL_FILL);
 
         if(spin)
             orientation_y = deltaTime * glm::radians(spin_speed);
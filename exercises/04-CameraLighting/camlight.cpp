@@ -42,10 +42,19 @@ positive Z axis points "outside" the screen
 
 // classes developed during lab lectures to manage shaders and to load models
 #include <utils/shader.h>
+#include <utils/shader_library.h>
+#include <utils/shader_reloader.h>
 #include <utils/model.h>
 #include <utils/camera.h>
 #include <utils/object.h>
+#include <utils/ecs.h>
 #include <utils/light.h>
+#include <utils/frame_uniforms.h>
+#include <utils/asset_loader.h>
+#include <utils/deferred_renderer.h>
+#include <utils/light_clusters.h>
+#include <utils/profiler.h>
+#include <utils/metrics.h>
 
 // we load the GLM classes used in the application
 #include <glm/glm.hpp>
@@ -96,6 +105,23 @@ GLboolean spinning = GL_TRUE;
 // boolean to activate/deactivate wireframe rendering
 GLboolean wireframe = GL_FALSE;
 
+// set with SPACE: the object at the center of the screen is picked in the next frame
+bool pickRequested = false;
+
+// shading path of the objects, switched with G
+enum ShadingPath { FORWARD_SHADING, DEFERRED_SHADING, CLUSTERED_SHADING, SHADING_PATH_COUNT };
+ShadingPath shading = FORWARD_SHADING;
+const char* shadingNames[SHADING_PATH_COUNT] = { "Forward", "Deferred", "Clustered forward" };
+
+// the programs of a shading path, with the indices of their subroutines (in the order of the shaders vector)
+struct ScenePrograms
+{
+    Shader* lit;
+    Shader* instanced;
+    GLuint lambertSubroutine;
+    std::vector<GLuint> litSubroutines, instancedSubroutines;
+};
+
 // Uniforms to pass to shaders
 glm::vec3 lightPos0{5.f, 10.f, 10.f}; // Point light
 GLfloat mov_light_speed = 3.f;
@@ -122,6 +148,11 @@ GLfloat planeColor[] = {0.0,0.5,0.0};
 /////////////////// MAIN function ///////////////////////
 int main()
 {
+  // the main thread in the trace written at exit (camlight.trace.json, open it in chrome://tracing or Perfetto)
+  profiler().setThreadName("Main");
+  // frame times and counts of the last frames, appended to camlight.metrics.csv every 5 seconds (at 60 fps)
+  metrics().dumpCSV("camlight.metrics.csv", 300);
+
   // Initialization of OpenGL context using GLFW
   glfwInit();
   // We set OpenGL specifications required for this application
@@ -166,50 +197,164 @@ int main()
     glViewport(0, 0, width, height);
 
     // we enable Z test
-    glEnable(GL_DEPTH_TEST);
+    glState().enable(GL_DEPTH_TEST);
 
     //the "clear" color for the frame buffer
     glClearColor(0.26f, 0.46f, 0.98f, 1.0f);
 
-    // we create the Shader Program used for the plane
-    Shader base_shader("../../shaders/basic.vert", "../../shaders/fullcolor.frag", {"../../shaders/types.utils", "../../shaders/constants.utils"}, 4, 1);
-
-    // we create the Shader Program used for objects (which presents different subroutines we can switch)
-    Shader light_shader = Shader("../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils"}, 4, 1);
+    // we start building all the Shader Programs: the driver compiles and links them while we start loading
+    // the models, and each program is checked only when we first need it
+    ShaderLibrary shaderLibrary;
+    // the Shader Program used for objects (which presents different subroutines we can switch)
+    shaderLibrary.add("light", "../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, 4, 1);
+    // the Shader Program used for instanced objects (same lighting, but model and normal matrices are per-instance attributes)
+    shaderLibrary.add("instanced", "../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, 4, 1);
+    // the Shader Programs of deferred shading: the same vertex shaders write the surfaces in the G-buffer,
+    // then a fullscreen pass lights each pixel once with the same illumination models
+    shaderLibrary.add("gbuffer", "../../shaders/procedural_base.vert", "../../shaders/gbuffer.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"}, 4, 1);
+    shaderLibrary.add("gbuffer_instanced", "../../shaders/procedural_instanced.vert", "../../shaders/gbuffer.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"}, 4, 1);
+    shaderLibrary.add("deferred_lighting", "../../shaders/fullscreen.vert", "../../shaders/deferred_lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, 4, 1);
+    // the Shader Programs of clustered forward shading: lighting.frag with clusters.utils reads only the lights of the cluster of each fragment
+    shaderLibrary.add("clustered", "../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils", "../../shaders/clusters.utils"}, 4, 1);
+    shaderLibrary.add("clustered_instanced", "../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils", "../../shaders/clusters.utils"}, 4, 1);
+
+    // we load the model(s) (code of Model class is in include/utils/model.h) in background:
+    // the rendering loop starts right away, and each model appears as soon as its meshes are uploaded.
+    // Our shaders read only positions, normals and UVs, so the compact vertex format loses nothing
+    AssetLoader loader;
+    std::shared_ptr<Model> cubeModel   = loader.load("../../models/cube.obj",     VERTEX_COMPACT);
+    std::shared_ptr<Model> sphereModel = loader.load("../../models/sphere.obj",   VERTEX_COMPACT);
+    std::shared_ptr<Model> bunnyModel  = loader.load("../../models/bunny_lp.obj", VERTEX_COMPACT);
+    std::shared_ptr<Model> planeModel  = loader.load("../../models/plane.obj",    VERTEX_COMPACT);
+
+    Shader& light_shader = shaderLibrary.get("light");
+    Shader& instanced_shader = shaderLibrary.get("instanced");
+    Shader& gbuffer_shader = shaderLibrary.get("gbuffer");
+    Shader& gbuffer_instanced_shader = shaderLibrary.get("gbuffer_instanced");
+    Shader& deferred_lighting_shader = shaderLibrary.get("deferred_lighting");
+    Shader& clustered_shader = shaderLibrary.get("clustered");
+    Shader& clustered_instanced_shader = shaderLibrary.get("clustered_instanced");
     // we parse the Shader Program to search for the number and names of the subroutines.
     // the names are placed in the shaders vector
     SetupShader(light_shader.program);
     // we print on console the name of the first subroutine used
     PrintCurrentShader(current_subroutine);
 
-    // we load the model(s) (code of Model class is in include/utils/model.h)
-    Model cubeModel("../../models/cube.obj");
-    Model sphereModel("../../models/sphere.obj");
-    Model bunnyModel("../../models/bunny_lp.obj");
-    Model planeModel("../../models/plane.obj");
+    // we resolve once the indices of the subroutines: the same name can have a different index in each program
+    // (and in each build of a program, so they are resolved again after a reload)
+    // (the subroutines of gbuffer.frag have the same names of the ones of lighting.frag)
+    ScenePrograms forwardPrograms{&light_shader, &instanced_shader}, deferredPrograms{&gbuffer_shader, &gbuffer_instanced_shader},
+                  clusteredPrograms{&clustered_shader, &clustered_instanced_shader};
+    ScenePrograms* shadingPrograms[SHADING_PATH_COUNT] = { &forwardPrograms, &deferredPrograms, &clusteredPrograms };
+    // the lights of clustered shading, assigned to the clusters of the view frustum every frame
+    LightClusters lightClusters;
+    auto resolveSubroutines = [&]()
+    {
+        // the samplers of the cluster buffers are plain uniforms, set again on every build
+        lightClusters.setSamplers(clustered_shader);
+        lightClusters.setSamplers(clustered_instanced_shader);
+
+        for (ScenePrograms* programs : shadingPrograms)
+        {
+            programs->lambertSubroutine = programs->lit->subroutine(GL_FRAGMENT_SHADER, "Lambert");
+            programs->litSubroutines.clear();
+            programs->instancedSubroutines.clear();
+            for (const std::string& name : shaders)
+            {
+                programs->litSubroutines.push_back(programs->lit->subroutine(GL_FRAGMENT_SHADER, name));
+                programs->instancedSubroutines.push_back(programs->instanced->subroutine(GL_FRAGMENT_SHADER, name));
+            }
+        }
+    };
+    resolveSubroutines();
+
+    // the lit programs are rebuilt when their files (or the utils they include) are saved:
+    // edit lighting.frag while the application runs, a program that does not link is not swapped in
+    ShaderReloader shaderReloader;
+    shaderReloader.watch(light_shader);
+    shaderReloader.watch(instanced_shader);
+    shaderReloader.watch(gbuffer_shader);
+    shaderReloader.watch(gbuffer_instanced_shader);
+    shaderReloader.watch(deferred_lighting_shader);
+    shaderReloader.watch(clustered_shader);
+    shaderReloader.watch(clustered_instanced_shader);
+
+    // the G-buffer of deferred shading, of the size of the window framebuffer (press G to switch shading path)
+    DeferredRenderer deferredRenderer(width, height);
+
+    // the surface parameters of the objects, updated every frame from the values set with the keyboard
+    Material objectMaterial{shininess, alpha, F0};
 
     // Projection matrix: FOV angle, aspect ratio, near and far planes
-    glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth/(float)screenHeight, 0.1f, 10000.0f);
+    GLfloat nearPlane = 0.1f, farPlane = 10000.0f;
+    glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth/(float)screenHeight, nearPlane, farPlane);
     // View matrix (=camera): position, view direction, camera "up" vector
     glm::mat4 view = glm::mat4(1);
-
-    // Setup objects
-    Object plane{planeModel}, sphere{sphereModel}, cube{cubeModel}, bunny{bunnyModel};
+    // uniform buffer shared by all the programs, with camera matrices and time of the current frame
+    FrameUniforms frame;
+
+    // Setup objects: their transformations are kept by the scene graph, which recomputes
+    // the matrices of a node only when the node (or one of its ancestors) changes
+    SceneGraph scene;
+    SceneNode planeNode  = scene.create(NO_NODE, glm::vec3( 0.0f, -1.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(10.0f, 1.0f, 10.0f));
+    SceneNode sphereNode = scene.create(NO_NODE, glm::vec3(-3.0f,  0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.8f));
+    SceneNode cubeNode   = scene.create(NO_NODE, glm::vec3( 0.0f,  0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.8f)); // It's a bit too big for our scene, so scale it down
+    SceneNode bunnyNode  = scene.create(NO_NODE, glm::vec3( 3.0f,  0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.3f)); // It's a bit too big for our scene, so scale it down
+
+    Object plane{*planeModel, scene, planeNode};
+
+    // the lit objects are entities: their components are packed in arrays, and each step of the frame
+    // (matrices, bounds, LODs, culling, draw list) is a loop over one of them
+    World world;
+    world.createRenderable(*sphereModel, objectMaterial, light_shader, sphereNode);
+    world.createRenderable(*cubeModel,   objectMaterial, light_shader, cubeNode);
+    world.createRenderable(*bunnyModel,  objectMaterial, light_shader, bunnyNode);
+    std::vector<Entity> visibleEntities;
+    // every frame the draws are collected, sorted by render state and then issued with the fewest state changes
+    RenderQueue queue;
+
+    // a field of small cubes behind the objects, rendered with a single instanced draw call
+    InstancedObjectBatch cubeField{*cubeModel};
+    for (int x = -10; x < 10; x++)
+    {
+        for (int z = 0; z < 20; z++)
+        {
+            glm::mat4 transform = glm::translate(glm::mat4(1), glm::vec3(x * 1.5f, -0.75f, -5.0f - z * 1.5f));
+            cubeField.add(glm::scale(transform, glm::vec3(0.2f, 0.2f, 0.2f)));
+        }
+    }
 
     // Setup lights
-    glm::vec3 ambient {0.1f, 0.1f, 0.1f}, diffuse{1.0f, 0.0f, 0.0f}, specular{1.0f, 1.0f, 1.0f};
-    //GLfloat kA, kD, kS;
-    LightAttributes la {ambient, diffuse, specular, Ka, Kd, Ks};
-    PointLight pl1{glm::vec3{20.f, 10.f, 10.f}, la};
-    PointLight pl2{glm::vec3{-20.f, 10.f, 10.f}, la};
-
-    std::vector<PointLight> pls {};
-    pls.emplace_back(pl1);
-    pls.emplace_back(pl2);
+    // all the lights are packed in a single uniform buffer, shared by every program using lighting.frag
+    LightManager lights;
+    {
+        PROFILE_SCOPE("Light setup");
+        glm::vec3 ambient {0.1f, 0.1f, 0.1f}, diffuse{1.0f, 0.0f, 0.0f}, specular{1.0f, 1.0f, 1.0f};
+        //GLfloat kA, kD, kS;
+        LightAttributes la {ambient, diffuse, specular, Ka, Kd, Ks};
+        world.lights.add(world.create(), LightSource{POINT_LIGHT, la, glm::vec3{20.f, 10.f, 10.f}, glm::vec3(0.0f), 0.0f});
+        world.lights.add(world.create(), LightSource{POINT_LIGHT, la, glm::vec3{-20.f, 10.f, 10.f}, glm::vec3(0.0f), 0.0f});
+
+        // small colored lights over the plane, each one reaching only the nearby surfaces
+        const glm::vec3 colors[] = { {1.0f, 0.6f, 0.2f}, {0.2f, 1.0f, 0.4f}, {0.3f, 0.5f, 1.0f}, {1.0f, 0.3f, 0.8f} };
+        for (int x = 0; x < 8; x++)
+        {
+            for (int z = 0; z < 8; z++)
+            {
+                LightAttributes small {glm::vec3(0.0f), colors[(x + z) % 4], colors[(x + z) % 4], 0.0f, Kd, Ks};
+                world.lights.add(world.create(), LightSource{POINT_LIGHT, small, glm::vec3{-7.f + x * 2.f, -0.5f, -7.f + z * 2.f}, glm::vec3(0.0f), 0.0f, 1.5f});
+            }
+        }
+        // and a spot light on the bunny
+        LightAttributes spot {glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(1.0f), 0.0f, Kd, Ks};
+        world.lights.add(world.create(), LightSource{SPOT_LIGHT, spot, glm::vec3{3.f, 4.f, 0.f}, glm::vec3(0.0f, -1.0f, 0.0f), glm::radians(20.0f), 8.0f});
+    }
 
     // Rendering loop: this code is executed at each frame
     while(!glfwWindowShouldClose(window))
     {
+        PROFILE_SCOPE("Frame");
+
         // we determine the time passed from the beginning
         // and we calculate the time difference between current frame rendering and the previous one
         GLfloat currentFrame = glfwGetTime();
@@ -217,91 +362,165 @@ int main()
         lastFrame = currentFrame;
 
         // Check is an I/O event is happening
-        glfwPollEvents();
-        process_input();
-        view = camera.GetViewMatrix();
+        {
+            PROFILE_SCOPE("Input");
+            glfwPollEvents();
+            process_input();
+            view = camera.GetViewMatrix();
+        }
+
+        // we pass projection and view matrices to every Shader Program at once
+        frame.update(view, projection, camera.position(), currentFrame, deltaTime);
+
+        // objects outside of the view volume are not even submitted
+        Frustum frustum(projection * view);
+
+        // we upload the meshes loaded in background since the last frame, within a small time budget
+        loader.uploadPending(16 << 20, 2.0);
+
+        // we swap in the programs rebuilt from the shader files changed since the last frame
+        if(shaderReloader.update() > 0) resolveSubroutines();
 
         // we "clear" the frame and z buffer
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        // the programs of the current shading path
+        bool deferred = shading == DEFERRED_SHADING;
+        ScenePrograms& programs = *shadingPrograms[shading];
+
         // we set the rendering mode
+        // (the state cache issues the call only when the mode changes)
         if (wireframe)
             // Draw in wireframe
-            glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            glState().setPolygonMode(GL_LINE);
         else
-            glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-        // if animated rotation is activated, than we increment the rotation angle using delta time and the rotation speed parameter
-        if (spinning)
-            orientationY+=(deltaTime*spin_speed);
+            glState().setPolygonMode(GL_FILL);
 
-        /////////////////// PLANE ////////////////////////////////////////////////
-        // We render a plane under the objects. We apply the fullcolor shader to the plane, and we do not apply the rotation applied to the other objects.
-        light_shader.use();
-
-        light_shader.setUint("nPointLights", pls.size());
-        for(size_t i = 0; i < pls.size(); i++)
         {
-            pls[i].setup(light_shader, i);
+            PROFILE_SCOPE("Update");
+            // if animated rotation is activated, than we increment the rotation angle using delta time and the rotation speed parameter
+            if (spinning)
+            {
+                orientationY+=(deltaTime*spin_speed);
+
+                glm::quat spin = glm::angleAxis(glm::radians(orientationY), glm::vec3(0.0f, 1.0f, 0.0f));
+                scene.setRotation(sphereNode, spin);
+                scene.setRotation(cubeNode, spin);
+                scene.setRotation(bunnyNode, spin);
+            }
+            // only the nodes changed since the last frame are recomputed
+            scene.update();
+
+            world.syncTransforms(scene);
+            world.updateBounds();
+            // the detailed models switch to their simplified LODs as they get smaller on screen
+            world.selectLods(view, projection);
+            // only the visible entities end up in the draw list (the BVH skips the subtrees out of the view at once)
+            world.cullHierarchical(frustum, visibleEntities);
+
+            // the ray from the camera along its direction hits the nearest object at the center of the screen
+            if (pickRequested)
+            {
+                Entity picked;
+                float distance;
+                if (world.pick(camera.position(), camera.direction(), picked, distance))
+                    std::cout << "Picked entity " << picked << " at distance " << distance << std::endl;
+                else
+                    std::cout << "Nothing picked" << std::endl;
+                pickRequested = false;
+            }
+
+            // the objects use the programs of the current shading path, and the subroutine currently selected
+            // (this is where shaders swapping happens)
+            for (Renderable& renderable : world.renderables.span())
+            {
+                renderable.shader = programs.lit;
+                renderable.subroutine = programs.litSubroutines[current_subroutine];
+            }
+
+            objectMaterial.shininess = shininess;
+            objectMaterial.alpha     = alpha;
+            objectMaterial.F0        = F0;
+
+            // only the lights changed since the last frame are uploaded
+            world.gatherLights(lights);
+            lights.upload();
+            // with clustered shading the point and spot lights are read from the clusters instead
+            if (shading == CLUSTERED_SHADING)
+            {
+                world.gatherLights(lightClusters);
+                lightClusters.update(view, projection, nearPlane, farPlane, width, height);
+            }
         }
 
-        GLuint index = glGetSubroutineIndex(light_shader.program, GL_FRAGMENT_SHADER, "Lambert");
-        // we activate the subroutine using the index (this is where shaders swapping happens)
-        glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &index);
-
-        // we create the transformation matrix
-        plane.translate(glm::vec3(0.0f, -1.0f, 0.0f));
-        plane.scale(glm::vec3(10.0f, 1.0f, 10.0f));
-
-        // we render the plane
-        plane.draw(light_shader, view);
-
-        /////////////////// OBJECTS ////////////////////////////////////////////////
-        // We "install" the light_shader Shader Program as part of the current rendering process
-        light_shader.use();
-        // we search inside the Shader Program the name of the subroutine currently selected, and we get the numerical index
-        index = glGetSubroutineIndex(light_shader.program, GL_FRAGMENT_SHADER, shaders[current_subroutine].c_str());
-        // we activate the subroutine using the index (this is where shaders swapping happens)
-        glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &index);
-
-        light_shader.setFloat("shininess", shininess);
-        light_shader.setFloat("alpha", alpha);
-
-        // we pass projection and view matrices to the Shader Program
-        light_shader.setMat4("projectionMatrix", projection);
-        light_shader.setMat4("viewMatrix", view);
-
-        // SPHERE
-        sphere.translate(glm::vec3(-3.0f, 0.0f, 0.0f));
-        sphere.rotate_deg(orientationY, glm::vec3(0.0f, 1.0f, 0.0f));
-        sphere.scale(glm::vec3(0.8f, 0.8f, 0.8f));
-
-        sphere.draw(light_shader, view);
-
-        //CUBE
-        cube.translate(glm::vec3(0.0f, 0.0f, 0.0f));
-        cube.rotate(glm::radians(orientationY), glm::vec3(0.0f, 1.0f, 0.0f));
-        cube.scale(glm::vec3(0.8f, 0.8f, 0.8f));	// It's a bit too big for our scene, so scale it down
-
-        cube.draw(light_shader, view);
-
-        //BUNNY
-        bunny.translate(glm::vec3(3.0f, 0.0f, 0.0f));
-        bunny.rotate(glm::radians(orientationY), glm::vec3(0.0f, 1.0f, 0.0f));
-        bunny.scale(glm::vec3(0.3f, 0.3f, 0.3f));	// It's a bit too big for our scene, so scale it down
-
-        bunny.draw(light_shader, view);
+        {
+            PROFILE_SCOPE("Render");
+            // GPU time of the scene, read back a few frames later
+            PROFILE_GPU_SCOPE("Scene");
+            // with deferred shading the objects are drawn in the G-buffer, and lit afterwards
+            if (deferred)
+                deferredRenderer.beginGeometryPass();
+
+            queue.begin(view, farPlane);
+            /////////////////// PLANE ////////////////////////////////////////////////
+            // We render a plane under the objects, with the Lambert subroutine, and we do not apply the rotation applied to the other objects.
+            plane.submit(queue, *programs.lit, nullptr, programs.lambertSubroutine);
+
+            /////////////////// OBJECTS ////////////////////////////////////////////////
+            // SPHERE, CUBE and BUNNY
+            world.submit(visibleEntities, queue);
+
+            // the packets are sorted by program, subroutine, material, VAO and depth, and the state is set only when it changes
+            queue.sort();
+            queue.execute();
+
+            //CUBE FIELD
+            programs.instanced->use();
+            // the shader keeps the selected subroutine, and selects it again every time the program is installed
+            programs.instanced->setSubroutine(GL_FRAGMENT_SHADER, programs.instancedSubroutines[current_subroutine]);
+
+            objectMaterial.apply(*programs.instanced);
+
+            cubeField.draw(*programs.instanced, frustum);
+
+            // each pixel covered by the objects is lit once, by all the lights
+            if (deferred)
+                deferredRenderer.lightingPass(deferred_lighting_shader, projection);
+        }
 
         // light following camera
         //lightPos0 = camera.position();
 
-        glfwSwapBuffers(window);
+        {
+            PROFILE_SCOPE("Swap");
+            glfwSwapBuffers(window);
+        }
+        glState().endFrame();
+        // the GPU times of a few frames ago are read back here
+        profiler().endFrame();
+        metrics().endFrame();
     }
 
+    const GLStateStats& stateStats = glState().frameStats();
+    const RenderStats& queueStats = queue.lastStats();
+    std::cout << "Last frame: " << queueStats.packets << " draws, " << queueStats.programChanges << " program, "
+              << queueStats.subroutineChanges << " subroutine, " << queueStats.materialChanges << " material and "
+              << queueStats.vaoChanges << " VAO changes; GL state calls issued " << stateStats.issued
+              << ", elided " << stateStats.elided << std::endl;
+    shaderLibrary.printStats();
+    metrics().print();
+    profiler().writeChromeTrace("camlight.trace.json");
+
     // when I exit from the graphics loop, it is because the application is closing
-    // we delete the Shader Programs
-    base_shader.del();
-    light_shader.del();
+    // we delete the Shader Programs (which must not be watched anymore)
+    shaderReloader.forget(light_shader);
+    shaderReloader.forget(instanced_shader);
+    shaderReloader.forget(gbuffer_shader);
+    shaderReloader.forget(gbuffer_instanced_shader);
+    shaderReloader.forget(deferred_lighting_shader);
+    shaderReloader.forget(clustered_shader);
+    shaderReloader.forget(clustered_instanced_shader);
+    shaderLibrary.clear();
     // we close and delete the created context
     glfwTerminate();
     return 0;
@@ -380,6 +599,17 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if(key == GLFW_KEY_L && action == GLFW_PRESS)
         wireframe=!wireframe;
 
+    // if SPACE is pressed, we pick the object at the center of the screen
+    if(key == GLFW_KEY_SPACE && action == GLFW_PRESS)
+        pickRequested = true;
+
+    // if G is pressed, we switch to the next shading path (forward, deferred, clustered forward)
+    if(key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        shading = (ShadingPath)((shading + 1) % SHADING_PATH_COUNT);
+        std::cout << shadingNames[shading] << " shading" << std::endl;
+    }
+
     // pressing a key number, we change the shader applied to the models
     // if the key is between 1 and 9, we proceed and check if the pressed key corresponds to
     // a valid subroutine
@@ -0,0 +1,386 @@
+/*
+Headless benchmark of the scene of 04-CameraLighting
+
+No window and no input: the scene is rendered in an offscreen framebuffer of a surfaceless EGL (or OSMesa) context,
+for a fixed number of frames with a fixed time step (the camera orbits the objects, which spin as in camlight),
+so every run renders the very same frames, and the frame times can be compared between runs and machines.
+Without a GPU, Mesa renders with llvmpipe.
+
+usage: benchmark [--frames N] [--warmup N] [--width W] [--height H] [--backend egl|osmesa] [--out results.json]
+       [--trace trace.json] [--shading forward|deferred|clustered|compare] [--lights N]
+
+The results (mean/p50/p99 frame time, draw calls) are printed on the console, and written in JSON with --out.
+--trace writes the CPU and GPU scopes of the run as a Chrome trace.
+--shading deferred renders with the G-buffer and the fullscreen lighting pass instead of lighting.frag, --shading clustered
+with lighting.frag reading only the lights of the cluster of each fragment. --lights adds small point and spot lights
+over the scene (2 by default), to compare the paths as the lights grow: forward and deferred shading keep at most
+128 point and 32 spot lights, clustered shading up to 65535.
+--shading compare renders the same frames with the three paths, and compares the images of clustered and deferred
+shading with the forward one: the largest difference of a channel and the pixels differing by more than 1 are
+printed, and the exit code is not 0 if any channel differs by more than 1. It renders --frames frames (4 by default)
+5 seconds apart, with --lights up to 130 so that forward shading keeps all of them (all but the first 2 have a radius)
+*/
+
+// Std. Includes
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/glad.h>
+
+// offscreen GL context, and runner of the frames
+#include <utils/headless_context.h>
+#include <utils/benchmark.h>
+#include <utils/profiler.h>
+#include <utils/metrics.h>
+
+// classes developed during lab lectures to manage shaders and to load models
+#include <utils/shader.h>
+#include <utils/model.h>
+#include <utils/object.h>
+#include <utils/ecs.h>
+#include <utils/light.h>
+#include <utils/frame_uniforms.h>
+#include <utils/asset_loader.h>
+#include <utils/deferred_renderer.h>
+#include <utils/light_clusters.h>
+
+// we load the GLM classes used in the application
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// OpenGL version
+GLuint glMajor = 4, glMinor = 1;
+
+// dimensions of the offscreen framebuffer
+GLuint screenWidth = 1200, screenHeight = 900;
+
+// rotation speed of the objects on Y axis, and of the camera around them (degrees per second)
+GLfloat spin_speed = 30.0f;
+GLfloat orbit_speed = 10.0f;
+
+// lighting parameters, the same of camlight
+GLfloat Kd = 0.5f;
+GLfloat Ks = 0.4f;
+GLfloat Ka = 0.1f;
+
+GLfloat shininess = 25.f;
+GLfloat alpha = 0.2f;
+GLfloat F0 = 0.9f;
+
+// the shading paths, as in camlight
+enum ShadingPath { FORWARD_SHADING, DEFERRED_SHADING, CLUSTERED_SHADING, SHADING_PATH_COUNT };
+const char* shadingNames[SHADING_PATH_COUNT] = { "forward", "deferred", "clustered" };
+// the names of the runs in the JSON results
+const char* runNames[SHADING_PATH_COUNT] = { "camlight", "camlight_deferred", "camlight_clustered" };
+
+// the programs of a shading path, with the indices of the subroutines used
+struct ScenePrograms
+{
+    Shader* lit;
+    Shader* instanced;
+    GLuint lambertSubroutine, ggxSubroutine, instancedGGXSubroutine;
+};
+
+// The same name can have a different subroutine index in each program
+ScenePrograms scenePrograms(Shader& lit, Shader& instanced)
+{
+    return ScenePrograms{&lit, &instanced, lit.subroutine(GL_FRAGMENT_SHADER, "Lambert"), lit.subroutine(GL_FRAGMENT_SHADER, "GGX"),
+                         instanced.subroutine(GL_FRAGMENT_SHADER, "GGX")};
+}
+
+// Largest difference of a channel between two images of the same size, and pixels with a channel differing by more than 1
+void compareImages(const std::vector<uint8_t>& reference, const std::vector<uint8_t>& image, int& maxDifference, size_t& differentPixels)
+{
+    for (size_t pixel = 0; pixel < reference.size(); pixel += 4)
+    {
+        int pixelDifference = 0;
+        for (size_t channel = pixel; channel < pixel + 3; channel++)
+        {
+            pixelDifference = std::max(pixelDifference, std::abs((int)reference[channel] - (int)image[channel]));
+        }
+        maxDifference = std::max(maxDifference, pixelDifference);
+        if (pixelDifference > 1) differentPixels++;
+    }
+}
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    BenchmarkSettings settings;
+    HeadlessBackend backend = HEADLESS_EGL;
+    std::string outputPath, tracePath;
+    ShadingPath shading = FORWARD_SHADING;
+    bool compare = false, framesGiven = false;
+    size_t lightCount = 2;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if      (!strcmp(argv[i], "--frames"))
+        {
+            settings.frames = (size_t)atoi(argv[i + 1]);
+            framesGiven     = true;
+        }
+        else if (!strcmp(argv[i], "--warmup"))  settings.warmupFrames = (size_t)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--width"))   screenWidth           = (GLuint)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--height"))  screenHeight          = (GLuint)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--backend")) backend               = strcmp(argv[i + 1], "osmesa") ? HEADLESS_EGL : HEADLESS_OSMESA;
+        else if (!strcmp(argv[i], "--out"))     outputPath            = argv[i + 1];
+        else if (!strcmp(argv[i], "--trace"))   tracePath             = argv[i + 1];
+        else if (!strcmp(argv[i], "--shading"))
+        {
+            shading = !strcmp(argv[i + 1], "deferred") ? DEFERRED_SHADING : !strcmp(argv[i + 1], "clustered") ? CLUSTERED_SHADING : FORWARD_SHADING;
+            compare = !strcmp(argv[i + 1], "compare");
+        }
+        else if (!strcmp(argv[i], "--lights"))  lightCount            = (size_t)atoi(argv[i + 1]);
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+    // a few frames are enough to compare the images, unless more are asked for
+    if (compare && !framesGiven) settings.frames = 4;
+
+    // the context renders in an offscreen framebuffer of the size of the window of camlight
+    HeadlessContext context(screenWidth, screenHeight, glMajor, glMinor, backend);
+    if (!context.valid())
+    {
+        std::cout << "Failed to create the headless OpenGL context" << std::endl;
+        return -1;
+    }
+    std::cout << "Renderer: " << context.renderer() << std::endl;
+
+    // we enable Z test
+    glState().enable(GL_DEPTH_TEST);
+
+    //the "clear" color for the frame buffer
+    glClearColor(0.26f, 0.46f, 0.98f, 1.0f);
+
+    // the Shader Program used for objects and plane, and the one used for instanced objects
+    Shader light_shader("../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor);
+    Shader instanced_shader("../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor);
+    // the ones of deferred shading: the objects write the G-buffer, then the lighting pass lights each pixel once
+    Shader gbuffer_shader("../../shaders/procedural_base.vert", "../../shaders/gbuffer.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"}, glMajor, glMinor);
+    Shader gbuffer_instanced_shader("../../shaders/procedural_instanced.vert", "../../shaders/gbuffer.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"}, glMajor, glMinor);
+    Shader deferred_lighting_shader("../../shaders/fullscreen.vert", "../../shaders/deferred_lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor);
+
+    // the ones of clustered shading: lighting.frag reads only the lights of the cluster of each fragment
+    Shader clustered_shader("../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils", "../../shaders/clusters.utils"}, glMajor, glMinor);
+    Shader clustered_instanced_shader("../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils", "../../shaders/clusters.utils"}, glMajor, glMinor);
+
+    ScenePrograms programs[SHADING_PATH_COUNT] = { scenePrograms(light_shader, instanced_shader),
+                                                   scenePrograms(gbuffer_shader, gbuffer_instanced_shader),
+                                                   scenePrograms(clustered_shader, clustered_instanced_shader) };
+
+    // the G-buffer is allocated only when it is used
+    std::unique_ptr<DeferredRenderer> deferredRenderer;
+    if (compare || shading == DEFERRED_SHADING) deferredRenderer.reset(new DeferredRenderer(screenWidth, screenHeight));
+    LightClusters lightClusters;
+    lightClusters.setSamplers(clustered_shader);
+    lightClusters.setSamplers(clustered_instanced_shader);
+
+    Material objectMaterial{shininess, alpha, F0};
+
+    // the models are loaded in background as in camlight, but we wait for all of them before measuring anything
+    AssetLoader loader;
+    std::shared_ptr<Model> cubeModel   = loader.load("../../models/cube.obj",     VERTEX_COMPACT);
+    std::shared_ptr<Model> sphereModel = loader.load("../../models/sphere.obj",   VERTEX_COMPACT);
+    std::shared_ptr<Model> bunnyModel  = loader.load("../../models/bunny_lp.obj", VERTEX_COMPACT);
+    std::shared_ptr<Model> planeModel  = loader.load("../../models/plane.obj",    VERTEX_COMPACT);
+    while (loader.pending() > 0) { loader.uploadPending(64 << 20, 100.0); }
+
+    // Projection matrix: FOV angle, aspect ratio, near and far planes
+    GLfloat nearPlane = 0.1f, farPlane = 10000.0f;
+    glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth/(float)screenHeight, nearPlane, farPlane);
+    FrameUniforms frame;
+
+    // the same scene of camlight
+    SceneGraph scene;
+    SceneNode planeNode  = scene.create(NO_NODE, glm::vec3( 0.0f, -1.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(10.0f, 1.0f, 10.0f));
+    SceneNode sphereNode = scene.create(NO_NODE, glm::vec3(-3.0f,  0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.8f));
+    SceneNode cubeNode   = scene.create(NO_NODE, glm::vec3( 0.0f,  0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.8f));
+    SceneNode bunnyNode  = scene.create(NO_NODE, glm::vec3( 3.0f,  0.0f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.3f));
+
+    Object plane{*planeModel, scene, planeNode};
+
+    World world;
+    // the programs of the renderables are set by each frame, for its shading path
+    world.createRenderable(*sphereModel, objectMaterial, light_shader, sphereNode);
+    world.createRenderable(*cubeModel,   objectMaterial, light_shader, cubeNode);
+    world.createRenderable(*bunnyModel,  objectMaterial, light_shader, bunnyNode);
+    std::vector<Entity> visibleEntities;
+    RenderQueue queue;
+
+    InstancedObjectBatch cubeField{*cubeModel};
+    for (int x = -10; x < 10; x++)
+    {
+        for (int z = 0; z < 20; z++)
+        {
+            glm::mat4 transform = glm::translate(glm::mat4(1), glm::vec3(x * 1.5f, -0.75f, -5.0f - z * 1.5f));
+            cubeField.add(glm::scale(transform, glm::vec3(0.2f, 0.2f, 0.2f)));
+        }
+    }
+
+    glm::vec3 ambient {0.1f, 0.1f, 0.1f}, diffuse{1.0f, 0.0f, 0.0f}, specular{1.0f, 1.0f, 1.0f};
+    LightAttributes la {ambient, diffuse, specular, Ka, Kd, Ks};
+    world.lights.add(world.create(), LightSource{POINT_LIGHT, la, glm::vec3{20.f, 10.f, 10.f}, glm::vec3(0.0f), 0.0f});
+    world.lights.add(world.create(), LightSource{POINT_LIGHT, la, glm::vec3{-20.f, 10.f, 10.f}, glm::vec3(0.0f), 0.0f});
+    // the other lights are small, scattered over the plane and the cube field (every fourth one is a spot light
+    // pointing down): the positions come from a fixed seed, so every run has the same lights
+    uint32_t seed = 12345u;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / 16777216.0f; };
+    for (size_t i = 2; i < lightCount; i++)
+    {
+        glm::vec3 color(0.3f + 0.7f * random(), 0.3f + 0.7f * random(), 0.3f + 0.7f * random());
+        glm::vec3 position(-15.f + 30.f * random(), -0.5f + 2.f * random(), -35.f + 45.f * random());
+        LightAttributes small {glm::vec3(0.0f), color, color, 0.0f, Kd, Ks};
+        if (i % 4 == 0)
+            world.lights.add(world.create(), LightSource{SPOT_LIGHT, small, position, glm::vec3(0.0f, -1.0f, 0.0f), glm::radians(30.0f), 3.0f});
+        else
+            world.lights.add(world.create(), LightSource{POINT_LIGHT, small, position, glm::vec3(0.0f), 0.0f, 2.0f});
+    }
+    LightManager lights;
+
+    // the frame of camlight, driven by the simulated time instead of the clock and of the input,
+    // returns the draw calls issued
+    auto renderFrame = [&](ShadingPath path, float time, float deltaTime) -> size_t
+    {
+        bool deferred = path == DEFERRED_SHADING;
+        ScenePrograms& pathPrograms = programs[path];
+
+        // the camera orbits the objects
+        float orbit = glm::radians(orbit_speed * time);
+        glm::vec3 cameraPosition(7.0f * std::sin(orbit), 1.0f, 7.0f * std::cos(orbit));
+        glm::mat4 view = glm::lookAt(cameraPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        frame.update(view, projection, cameraPosition, time, deltaTime);
+        Frustum frustum(projection * view);
+
+        // the lighting pass of the previous frame may have left another framebuffer bound
+        glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glm::quat spin = glm::angleAxis(glm::radians(spin_speed * time), glm::vec3(0.0f, 1.0f, 0.0f));
+        scene.setRotation(sphereNode, spin);
+        scene.setRotation(cubeNode, spin);
+        scene.setRotation(bunnyNode, spin);
+        scene.update();
+
+        world.syncTransforms(scene);
+        world.updateBounds();
+        world.selectLods(view, projection);
+        world.cull(frustum, visibleEntities);
+        for (Renderable& renderable : world.renderables.span())
+        {
+            renderable.shader = pathPrograms.lit;
+            renderable.subroutine = pathPrograms.ggxSubroutine;
+        }
+
+        world.gatherLights(lights);
+        lights.upload();
+        if (path == CLUSTERED_SHADING)
+        {
+            world.gatherLights(lightClusters);
+            lightClusters.update(view, projection, nearPlane, farPlane, screenWidth, screenHeight);
+        }
+
+        {
+            PROFILE_GPU_SCOPE("Scene");
+            if (deferred) deferredRenderer->beginGeometryPass();
+
+            queue.begin(view, farPlane);
+            plane.submit(queue, *pathPrograms.lit, nullptr, pathPrograms.lambertSubroutine);
+            world.submit(visibleEntities, queue);
+            queue.sort();
+            queue.execute();
+
+            pathPrograms.instanced->use();
+            pathPrograms.instanced->setSubroutine(GL_FRAGMENT_SHADER, pathPrograms.instancedGGXSubroutine);
+            objectMaterial.apply(*pathPrograms.instanced);
+            cubeField.draw(*pathPrograms.instanced, frustum);
+
+            if (deferred) deferredRenderer->lightingPass(deferred_lighting_shader, projection, context.framebuffer());
+        }
+
+        glState().endFrame();
+        profiler().endFrame();
+        metrics().endFrame();
+        return queue.lastStats().packets + (cubeField.lastCull().visible > 0 ? 1 : 0) + (deferred ? 1 : 0);
+    };
+
+    int exitCode = 0;
+    if (compare)
+    {
+        // forward shading would drop the lights over its limits, and the images would differ for that
+        size_t pointCount = 0, spotCount = 0;
+        for (const LightSource& light : world.lights.span())
+        {
+            pointCount += light.type == POINT_LIGHT ? 1 : 0;
+            spotCount  += light.type == SPOT_LIGHT ? 1 : 0;
+        }
+        if (pointCount > MAX_POINT_LIGHTS || spotCount > MAX_SPOT_LIGHTS)
+        {
+            std::cout << "Too many lights for forward shading: " << pointCount << " point and " << spotCount << " spot lights" << std::endl;
+            return -1;
+        }
+
+        // the frames are 5 seconds apart, so the camera sees the scene from different sides
+        std::vector<uint8_t> reference, image;
+        for (size_t i = 0; i < settings.frames; i++)
+        {
+            float time = i * 5.0f;
+            renderFrame(FORWARD_SHADING, time, settings.timeStep);
+            context.readPixels(reference);
+
+            for (ShadingPath path : { CLUSTERED_SHADING, DEFERRED_SHADING })
+            {
+                renderFrame(path, time, settings.timeStep);
+                context.readPixels(image);
+
+                int maxDifference = 0;
+                size_t differentPixels = 0;
+                compareImages(reference, image, maxDifference, differentPixels);
+                std::cout << "frame " << i << ", " << shadingNames[path] << " vs forward: max difference " << maxDifference
+                          << ", " << differentPixels << " pixels differ by more than 1" << std::endl;
+                if (maxDifference > 1) exitCode = 1;
+            }
+        }
+        std::cout << (exitCode ? "FAILED" : "Passed") << ": " << world.lights.size() << " lights, " << screenWidth << "x"
+                  << screenHeight << std::endl;
+    }
+    else
+    {
+        FrameBenchmark benchmark(settings);
+        benchmark.run([&](float time, float deltaTime) { return renderFrame(shading, time, deltaTime); });
+
+        const BenchmarkResult& result = benchmark.result();
+        std::cout << result.frames << " frames: mean " << result.meanMs << " ms, p50 " << result.p50Ms << " ms, p99 "
+                  << result.p99Ms << " ms, " << result.meanDrawCalls << " draw calls per frame" << std::endl;
+
+        // the name of the run tells the shading path, the results of the paths can be compared
+        if (!outputPath.empty()) benchmark.writeJSON(outputPath, runNames[shading], context.renderer());
+        else                     benchmark.writeJSON(std::cout, runNames[shading], context.renderer());
+
+        // the counts per frame of the last frames (the frame times include the glFinish of the previous frame)
+        metrics().print();
+        if (!tracePath.empty()) profiler().writeChromeTrace(tracePath);
+    }
+
+    // we delete the Shader Programs, the context goes away with the end of main
+    light_shader.del();
+    instanced_shader.del();
+    gbuffer_shader.del();
+    gbuffer_instanced_shader.del();
+    deferred_lighting_shader.del();
+    clustered_shader.del();
+    clustered_instanced_shader.del();
+    return exitCode;
+}
@@ -0,0 +1,178 @@
+/*
+Micro-benchmark of the conversion of an imported mesh (aiMesh) to our Vertex and index arrays
+
+The same large synthetic mesh (positions, normals, UVs, tangents and bitangents, as Assimp gives them after
+aiProcess_CalcTangentSpace) is converted by the per-vertex conversion of the original Model::processMesh,
+which built a Vertex at a time and appended it with emplace_back, and by the current Model::processMesh,
+which sizes the arrays once and copies each attribute with its own loop (on more threads for big meshes).
+Only the conversion is timed: no file is read and no GL context is needed.
+
+usage: import_benchmark [--vertices N] [--runs N]
+
+The best and the mean time of the runs, and the vertices per second of each conversion, are printed on the console.
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+// the conversion under test
+#include <utils/model.h>
+
+// The conversion of the original Model::processMesh: one Vertex at a time, appended to arrays never reserved
+MeshData legacyProcessMesh(const aiMesh* mesh)
+{
+    MeshData data;
+    std::vector<Vertex>& vertices = data.vertices;
+    std::vector<GLuint>&  indices = data.indices;
+
+    for (size_t i = 0; i < mesh->mNumVertices; i++)
+    {
+        Vertex vertex;
+        glm::vec3 vec3;
+        vec3.x = mesh->mVertices[i].x;
+        vec3.y = mesh->mVertices[i].y;
+        vec3.z = mesh->mVertices[i].z;
+        vertex.position = vec3;
+
+        vec3.x = mesh->mNormals[i].x;
+        vec3.y = mesh->mNormals[i].y;
+        vec3.z = mesh->mNormals[i].z;
+        vertex.normal = vec3;
+
+        if(mesh->mTextureCoords[0])
+        {
+            glm::vec2 vec2;
+            vec2.x = mesh->mTextureCoords[0][i].x;
+            vec2.y = mesh->mTextureCoords[0][i].y;
+            vertex.texCoords = vec2;
+
+            vec3.x = mesh->mTangents[i].x;
+            vec3.y = mesh->mTangents[i].y;
+            vec3.z = mesh->mTangents[i].z;
+            vertex.tangent = vec3;
+
+            vec3.x = mesh->mBitangents[i].x;
+            vec3.y = mesh->mBitangents[i].y;
+            vec3.z = mesh->mBitangents[i].z;
+            vertex.bitangent = vec3;
+        }
+        else
+        {
+            vertex.texCoords = glm::vec2(0.f, 0.f);
+            std::cout << "Warning: UV not present" << std::endl;
+        }
+
+        vertices.emplace_back(vertex);
+    }
+
+    for (size_t i = 0; i < mesh->mNumFaces; i++)
+    {
+        aiFace face = mesh->mFaces[i];
+
+        for (size_t j = 0; j < face.mNumIndices; j++)
+        {
+            indices.emplace_back(face.mIndices[j]);
+        }
+    }
+
+    return data;
+}
+
+// A grid of vertices with every attribute, triangulated: the aiMesh owns (and deletes) the arrays
+void buildMesh(aiMesh& mesh, size_t vertexCount)
+{
+    size_t side = 1;
+    while ((side + 1) * (side + 1) <= vertexCount) side++;
+    vertexCount = side * side;
+
+    mesh.mNumVertices = (unsigned)vertexCount;
+    mesh.mVertices = new aiVector3D[vertexCount];
+    mesh.mNormals = new aiVector3D[vertexCount];
+    mesh.mTangents = new aiVector3D[vertexCount];
+    mesh.mBitangents = new aiVector3D[vertexCount];
+    mesh.mTextureCoords[0] = new aiVector3D[vertexCount];
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        float u = (float)(i % side) / side, v = (float)(i / side) / side;
+        mesh.mVertices[i]   = aiVector3D{u, 0.1f * u * v, v};
+        mesh.mNormals[i]    = aiVector3D{0.0f, 1.0f, 0.0f};
+        mesh.mTangents[i]   = aiVector3D{1.0f, 0.0f, 0.0f};
+        mesh.mBitangents[i] = aiVector3D{0.0f, 0.0f, 1.0f};
+        mesh.mTextureCoords[0][i] = aiVector3D{u, v, 0.0f};
+    }
+
+    size_t quads = (side - 1) * (side - 1);
+    mesh.mNumFaces = (unsigned)(quads * 2);
+    mesh.mFaces = new aiFace[quads * 2];
+    for (size_t q = 0; q < quads; q++)
+    {
+        unsigned corner = (unsigned)((q / (side - 1)) * side + q % (side - 1)), row = (unsigned)side;
+        unsigned triangles[2][3] = { {corner, corner + row, corner + 1}, {corner + 1, corner + row, corner + row + 1} };
+        for (size_t t = 0; t < 2; t++)
+        {
+            aiFace& face = mesh.mFaces[q * 2 + t];
+            face.mNumIndices = 3;
+            face.mIndices = new unsigned[3];
+            std::copy(triangles[t], triangles[t] + 3, face.mIndices);
+        }
+    }
+}
+
+// Best and mean milliseconds of a conversion over the runs
+template <typename F>
+void timeConversion(const char* name, F convert, const aiMesh& mesh, size_t runs, MeshData& result)
+{
+    double best = 1e30, total = 0.0;
+    for (size_t r = 0; r < runs; r++)
+    {
+        // the arrays of the previous run are freed out of the timing
+        result = MeshData();
+
+        auto start = std::chrono::steady_clock::now();
+        result = convert(&mesh);
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, elapsed);
+        total += elapsed;
+    }
+
+    std::cout << name << ": best " << best << " ms, mean " << total / runs << " ms, "
+              << mesh.mNumVertices / (best / 1000.0) / 1e6 << " M vertices/s" << std::endl;
+}
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    size_t vertexCount = 1000000, runs = 10;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if      (!strcmp(argv[i], "--vertices")) vertexCount = (size_t)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--runs"))     runs        = std::max(1, atoi(argv[i + 1]));
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+
+    aiMesh mesh;
+    buildMesh(mesh, vertexCount);
+    std::cout << mesh.mNumVertices << " vertices, " << mesh.mNumFaces << " triangles, " << runs << " runs" << std::endl;
+
+    MeshData legacy, current;
+    timeConversion("per-vertex emplace_back", legacyProcessMesh, mesh, runs, legacy);
+    timeConversion("pre-sized per-attribute", Model::processMesh, mesh, runs, current);
+
+    // both conversions must give the same arrays, or the timings mean nothing
+    bool same = legacy.vertices.size() == current.vertices.size() && legacy.indices == current.indices &&
+                std::memcmp(legacy.vertices.data(), current.vertices.data(), legacy.vertices.size() * sizeof(Vertex)) == 0;
+    std::cout << (same ? "The conversions match" : "The conversions DIFFER") << std::endl;
+    return same ? 0 : -1;
+}
@@ -0,0 +1,244 @@
+/*
+Test and benchmark of the BVH class (include/utils/bvh.h)
+
+Random boxes are scattered in a cube (bigger with the number of boxes, so their density stays the same), and the BVH
+over them goes through the whole life of the one kept by World: built, refit after every box moved, half of the
+boxes removed and inserted again, rebuilt. After each step the results of the frustum query and of the raycasts are
+compared with a brute force test of every box, and each step is timed.
+No GL context is needed.
+
+usage: bvh_benchmark [--objects N] [--rays N]
+
+Without --objects the BVH is tested with 10k, 100k and 1M boxes. The timings are printed on the console, and the
+exit code is not 0 if any result differs from the brute force one.
+*/
+
+// Std. Includes
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <algorithm>
+
+#include <glad/glad.h>
+
+// the class under test
+#include <utils/bvh.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// A ray from outside of the cube to a point inside of it
+struct Ray
+{
+    glm::vec3 origin, direction;
+};
+
+// Entry distance of the ray in the box, or -1 if it misses it (same slab test of the BVH)
+float hitDistance(const BoundingBox& box, const Ray& ray)
+{
+    float entry = 0.0f, exit = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float t0 = (box.minCorner[axis] - ray.origin[axis]) / ray.direction[axis];
+        float t1 = (box.maxCorner[axis] - ray.origin[axis]) / ray.direction[axis];
+        if(t0 > t1) std::swap(t0, t1);
+        entry = std::max(entry, t0);
+        exit  = std::min(exit, t1);
+        if(entry > exit) return -1.0f;
+    }
+    return entry;
+}
+
+// Nearest entry distance of the ray in any of the boxes, brute force
+float nearestHit(const std::vector<BoundingBox>& boxes, const Ray& ray)
+{
+    float nearest = -1.0f;
+    for (const BoundingBox& box : boxes)
+    {
+        float distance = hitDistance(box, ray);
+        if(distance >= 0.0f && (nearest < 0.0f || distance < nearest)) nearest = distance;
+    }
+    return nearest;
+}
+
+// The divisions above and the BVH multiplications by the inverse direction round differently
+bool sameDistance(float a, float b)
+{
+    return std::fabs(a - b) <= 1e-4f * (1.0f + std::fabs(b));
+}
+
+class BVHTest
+{
+    public:
+        BVHTest(size_t objectCount, size_t rayCount) : objectCount(objectCount), rayCount(rayCount), failures(0), random(5)
+        {
+            // about one box every 8 cubic units, of side between 0.2 and 2
+            halfSide = std::cbrt((float)objectCount * 8.0f) * 0.5f;
+            std::uniform_real_distribution<float> position(-halfSide, halfSide), size(0.1f, 1.0f);
+
+            boxes.resize(objectCount);
+            userData.resize(objectCount);
+            for (size_t i = 0; i < objectCount; i++)
+            {
+                glm::vec3 center(position(random), position(random), position(random));
+                float half = size(random);
+                boxes[i] = BoundingBox{center - glm::vec3(half), center + glm::vec3(half)};
+                userData[i] = (uint32_t)i;
+            }
+
+            // a camera in the center of the cube sees about a tenth of it
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, halfSide * 2.0f);
+            frustum = Frustum(projection * view);
+
+            std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+            rays.resize(rayCount);
+            for (size_t i = 0; i < rayCount; i++)
+            {
+                glm::vec3 origin = glm::normalize(glm::vec3(unit(random), unit(random), unit(random))) * halfSide * 2.0f;
+                glm::vec3 target(unit(random) * halfSide, unit(random) * halfSide, unit(random) * halfSide);
+                rays[i] = Ray{origin, glm::normalize(target - origin)};
+            }
+        }
+
+        // Returns the number of results differing from the brute force ones
+        size_t run()
+        {
+            std::cout << objectCount << " boxes" << std::endl;
+
+            Clock::time_point start = Clock::now();
+            handles = bvh.build(boxes, userData);
+            report("build", elapsedMs(start));
+            check();
+
+            // every box moves a little, as the objects of a scene from a frame to the next one
+            std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+            for (BoundingBox& box : boxes)
+            {
+                glm::vec3 offset(step(random), step(random), step(random));
+                box = BoundingBox{box.minCorner + offset, box.maxCorner + offset};
+            }
+            start = Clock::now();
+            for (size_t i = 0; i < objectCount; i++) { bvh.setBox(handles[i], boxes[i]); }
+            bvh.refit();
+            report("refit", elapsedMs(start));
+            check();
+
+            start = Clock::now();
+            for (size_t i = 0; i < objectCount; i += 2) { bvh.remove(handles[i]); }
+            report("remove half", elapsedMs(start));
+            start = Clock::now();
+            for (size_t i = 0; i < objectCount; i += 2) { handles[i] = bvh.insert(boxes[i], userData[i]); }
+            report("insert half", elapsedMs(start));
+            check();
+
+            start = Clock::now();
+            bvh.rebuild();
+            report("rebuild", elapsedMs(start));
+            check();
+
+            return failures;
+        }
+
+    private:
+        size_t objectCount, rayCount, failures;
+        std::mt19937 random;
+        float halfSide;
+
+        std::vector<BoundingBox> boxes;
+        std::vector<uint32_t> userData;
+        std::vector<int> handles;
+        Frustum frustum;
+        std::vector<Ray> rays;
+        BVH bvh;
+
+        void report(const char* step, double ms)
+        {
+            std::cout << "  " << step << ": " << ms << " ms (SAH cost " << bvh.sahCost() << ")" << std::endl;
+        }
+
+        // Times the queries, and compares them with the brute force results
+        void check()
+        {
+            std::vector<uint32_t> visible;
+            Clock::time_point start = Clock::now();
+            size_t visited = bvh.query(frustum, [&](uint32_t data) { visible.push_back(data); });
+            double queryMs = elapsedMs(start);
+
+            std::vector<uint32_t> expected;
+            start = Clock::now();
+            for (size_t i = 0; i < objectCount; i++)
+            {
+                if(frustum.intersects(boxes[i])) expected.push_back(userData[i]);
+            }
+            double bruteMs = elapsedMs(start);
+
+            // every visible leaf is visited, and no node twice (a tree of n leaves has 2n - 1 nodes)
+            std::sort(visible.begin(), visible.end());
+            bool queryMatches = visible == expected && visited >= visible.size() && visited <= 2 * objectCount - 1;
+
+            std::vector<RayHit> hits(rayCount);
+            std::vector<bool> found(rayCount);
+            start = Clock::now();
+            for (size_t i = 0; i < rayCount; i++) { found[i] = bvh.raycast(rays[i].origin, rays[i].direction, hits[i]); }
+            double raysMs = elapsedMs(start);
+
+            // brute force rays are slow with many boxes, a hundred of them are enough to check
+            size_t checkedRays = std::min<size_t>(rayCount, 100), rayMismatches = 0;
+            for (size_t i = 0; i < checkedRays; i++)
+            {
+                float nearest = nearestHit(boxes, rays[i]);
+                bool matches = found[i] ? nearest >= 0.0f && sameDistance(hits[i].distance, nearest) : nearest < 0.0f;
+                // the box hit must be one at that distance (ties are possible)
+                if(matches && found[i]) matches = sameDistance(hitDistance(boxes[hits[i].userData], rays[i]), nearest);
+                if(!matches) rayMismatches++;
+            }
+
+            std::cout << "    frustum query " << queryMs << " ms (brute force " << bruteMs << " ms), " << visible.size()
+                      << " visible, " << visited << " nodes visited" << (queryMatches ? "" : " - MISMATCH") << "; " << rayCount << " raycasts "
+                      << raysMs / rayCount * 1000.0 << " us each" << (rayMismatches ? " - MISMATCH" : "") << std::endl;
+
+            failures += (queryMatches ? 0 : 1) + rayMismatches;
+        }
+};
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    std::vector<size_t> objectCounts = { 10000, 100000, 1000000 };
+    size_t rayCount = 1000;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if      (!strcmp(argv[i], "--objects")) objectCounts = std::vector<size_t>(1, (size_t)atoi(argv[i + 1]));
+        else if (!strcmp(argv[i], "--rays"))    rayCount     = (size_t)atoi(argv[i + 1]);
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+
+    size_t failures = 0;
+    for (size_t count : objectCounts)
+    {
+        BVHTest test(count, rayCount);
+        failures += test.run();
+    }
+
+    std::cout << (failures ? "FAILED: " : "Passed: ") << failures << " results differ from brute force" << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,250 @@
+/*
+Check and benchmark of the GeometryArena class (include/utils/geometry_arena.h)
+
+The models of camlight are drawn many times in an offscreen framebuffer, first mesh by mesh (a VAO bind and a draw
+call per mesh, as Model::draw does), then from a GeometryArena with each of its draw paths: glMultiDrawElementsIndirect
+(GL 4.3), a draw per mesh with baseInstance (GL 4.2), and a draw per mesh moving the instance attributes (GL 4.1).
+The lower paths are forced by hiding the GL versions above them from the arena.
+Before drawing, the arena goes through the life of the one of a scene streaming its models: it starts too small, so
+the models make it grow (the buffers are copied on the GPU), then some models are removed and added again in another
+order, and at last all of them are removed and added again.
+
+Checked:
+- every arena path renders the same image of the per-mesh one (no channel differs by more than 1)
+- the draw calls are 1 with multi draw indirect and one per mesh otherwise, the triangles are the ones of the per-mesh path
+- the freed ranges merge back, so adding again the models removed does not grow the buffers
+
+usage: arena_benchmark [--objects N] [--frames N] [--width W] [--height H] [--backend egl|osmesa]
+
+The mean frame time of each path is printed on the console, and the exit code is not 0 if any check fails.
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/glad.h>
+
+// offscreen GL context
+#include <utils/headless_context.h>
+#include <utils/metrics.h>
+
+// the class under test, and the classes of the per-mesh path
+#include <utils/geometry_arena.h>
+#include <utils/shader.h>
+#include <utils/model.h>
+#include <utils/light.h>
+#include <utils/material.h>
+#include <utils/frame_uniforms.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+// OpenGL version (Mesa gives the highest core version it has anyway)
+GLuint glMajor = 4, glMinor = 1;
+
+// dimensions of the offscreen framebuffer
+GLuint screenWidth = 800, screenHeight = 600;
+
+enum DrawPath { PER_MESH, ARENA_MULTI_DRAW_INDIRECT, ARENA_BASE_INSTANCE, ARENA_GL41, DRAW_PATH_COUNT };
+const char* pathNames[DRAW_PATH_COUNT] = { "per mesh", "arena, multi draw indirect", "arena, base instance", "arena, GL 4.1" };
+
+// An object of the scene: which model, and where
+struct SceneObject
+{
+    size_t model;
+    glm::mat4 transform;
+};
+
+// Largest difference of a channel between two images of the same size
+int maxDifference(const std::vector<uint8_t>& reference, const std::vector<uint8_t>& image)
+{
+    int difference = 0;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        difference = std::max(difference, std::abs((int)reference[i] - (int)image[i]));
+    }
+    return difference;
+}
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    HeadlessBackend backend = HEADLESS_EGL;
+    size_t objectCount = 500, frameCount = 50;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if      (!strcmp(argv[i], "--objects")) objectCount  = (size_t)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--frames"))  frameCount   = (size_t)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--width"))   screenWidth  = (GLuint)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--height"))  screenHeight = (GLuint)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--backend")) backend      = strcmp(argv[i + 1], "osmesa") ? HEADLESS_EGL : HEADLESS_OSMESA;
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+
+    HeadlessContext context(screenWidth, screenHeight, glMajor, glMinor, backend);
+    if (!context.valid())
+    {
+        std::cout << "Failed to create the headless OpenGL context" << std::endl;
+        return -1;
+    }
+    std::cout << "Renderer: " << context.renderer() << std::endl;
+
+    glState().enable(GL_DEPTH_TEST);
+    glClearColor(0.26f, 0.46f, 0.98f, 1.0f);
+
+    // the same lighting of both paths: only the source of the model and normal matrices changes
+    Shader light_shader("../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor);
+    Shader instanced_shader("../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor);
+    light_shader.setSubroutine(GL_FRAGMENT_SHADER, light_shader.subroutine(GL_FRAGMENT_SHADER, "GGX"));
+    instanced_shader.setSubroutine(GL_FRAGMENT_SHADER, instanced_shader.subroutine(GL_FRAGMENT_SHADER, "GGX"));
+    UniformHandle modelUniform = light_shader.uniform("modelMatrix"), normalUniform = light_shader.uniform("normalMatrix");
+    Material material;
+
+    // the arena stores full Vertex structs, the per-mesh path uses the same format
+    std::vector<std::unique_ptr<Model>> models;
+    models.emplace_back(new Model("../../models/cube.obj"));
+    models.emplace_back(new Model("../../models/sphere.obj"));
+    models.emplace_back(new Model("../../models/bunny_lp.obj"));
+
+    // a grid of objects, each turned by its own angle
+    std::vector<SceneObject> objects;
+    for (size_t i = 0; i < objectCount; i++)
+    {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(-18.0f + (i % 25) * 1.5f, 0.0f, -(float)(i / 25) * 1.5f));
+        transform = glm::rotate(transform, glm::radians(17.0f * i), glm::vec3(0.0f, 1.0f, 0.0f));
+        objects.push_back(SceneObject{i % models.size(), glm::scale(transform, glm::vec3(i % models.size() == 2 ? 0.2f : 0.5f))});
+    }
+
+    glm::vec3 cameraPosition(0.0f, 12.0f, 14.0f);
+    glm::mat4 view = glm::lookAt(cameraPosition, glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
+    FrameUniforms frame;
+    frame.update(view, projection, cameraPosition, 0.0f, 0.0f);
+
+    LightAttributes la {glm::vec3(0.1f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f), 0.1f, 0.5f, 0.4f};
+    LightManager lights;
+    lights.setPointLights({ PointLight(glm::vec3(20.f, 10.f, 10.f), la), PointLight(glm::vec3(-20.f, 10.f, 10.f), la) });
+    lights.upload();
+
+    bool passed = true;
+
+    // the arena starts smaller than the models, so adding them makes it grow
+    GeometryArena arena(64, 64);
+    std::vector<std::vector<ArenaMesh>> handles;
+    for (size_t m = 0; m < models.size(); m++) { handles.push_back(arena.add(*models[m])); }
+    size_t vertexCapacity = arena.vertexCapacity(), indexCapacity = arena.indexCapacity();
+    std::cout << "Arena grown to " << vertexCapacity << " vertices and " << indexCapacity << " indices" << std::endl;
+    if (vertexCapacity == 64 && indexCapacity == 64)
+    {
+        std::cout << "The arena did not grow - FAILED" << std::endl;
+        passed = false;
+    }
+
+    // the cube and the sphere come back in the other order, in the ranges they left, then everything comes back in
+    // reverse order: the freed ranges have to merge for the bigger meshes to fit without growing
+    arena.remove(handles[0]);
+    arena.remove(handles[1]);
+    handles[1] = arena.add(*models[1]);
+    handles[0] = arena.add(*models[0]);
+    for (size_t m = 0; m < models.size(); m++) { arena.remove(handles[m]); }
+    for (size_t m = models.size(); m-- > 0;) { handles[m] = arena.add(*models[m]); }
+    if (arena.vertexCapacity() != vertexCapacity || arena.indexCapacity() != indexCapacity)
+    {
+        std::cout << "The arena grew again after removing and adding the same models - FAILED" << std::endl;
+        passed = false;
+    }
+
+    size_t meshDraws = 0;
+    for (const SceneObject& object : objects) { meshDraws += models[object.model]->meshes.size(); }
+
+    // draws the objects with a path, returns the counters of the frame
+    auto renderFrame = [&](DrawPath path) -> FrameCounters
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        if (path == PER_MESH)
+        {
+            light_shader.use();
+            material.apply(light_shader);
+            for (const SceneObject& object : objects)
+            {
+                light_shader.setMat4(modelUniform, object.transform);
+                light_shader.setMat3(normalUniform, glm::mat3(view) * glm::inverseTranspose(glm::mat3(object.transform)));
+                models[object.model]->draw();
+            }
+        }
+        else
+        {
+            // the arena takes the highest path the context has: the lower ones are forced by hiding the versions above
+            int hasGL43 = GLAD_GL_VERSION_4_3, hasGL42 = GLAD_GL_VERSION_4_2;
+            if (path != ARENA_MULTI_DRAW_INDIRECT) GLAD_GL_VERSION_4_3 = 0;
+            if (path == ARENA_GL41)                GLAD_GL_VERSION_4_2 = 0;
+
+            instanced_shader.use();
+            material.apply(instanced_shader);
+            arena.clearDraws();
+            for (const SceneObject& object : objects) { arena.submit(handles[object.model], object.transform); }
+            arena.draw(instanced_shader);
+
+            GLAD_GL_VERSION_4_3 = hasGL43;
+            GLAD_GL_VERSION_4_2 = hasGL42;
+        }
+
+        glFinish();
+        glState().endFrame();
+        metrics().endFrame();
+        return metrics().lastFrame();
+    };
+
+    std::vector<uint8_t> reference, image;
+    FrameCounters referenceCounters = renderFrame(PER_MESH);
+    context.readPixels(reference);
+
+    for (int p = 0; p < DRAW_PATH_COUNT; p++)
+    {
+        DrawPath path = (DrawPath)p;
+        if ((path == ARENA_MULTI_DRAW_INDIRECT && !GLAD_GL_VERSION_4_3) || (path == ARENA_BASE_INSTANCE && !GLAD_GL_VERSION_4_2))
+        {
+            std::cout << pathNames[path] << ": not supported by the context, skipped" << std::endl;
+            continue;
+        }
+
+        FrameCounters counters = renderFrame(path);
+        context.readPixels(image);
+        int difference = maxDifference(reference, image);
+
+        uint64_t expectedDraws = path == ARENA_MULTI_DRAW_INDIRECT ? 1 : meshDraws;
+        bool matches = difference <= 1 && counters.values[METRIC_DRAW_CALLS] == expectedDraws
+                       && counters.values[METRIC_TRIANGLES] == referenceCounters.values[METRIC_TRIANGLES];
+        passed = passed && matches;
+
+        // the same frame again, timed
+        auto start = std::chrono::steady_clock::now();
+        for (size_t f = 0; f < frameCount; f++) { renderFrame(path); }
+        double meanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+
+        std::cout << pathNames[path] << ": " << meanMs << " ms per frame, " << counters.values[METRIC_DRAW_CALLS] << " draw calls, "
+                  << counters.values[METRIC_TRIANGLES] << " triangles, max difference " << difference
+                  << (matches ? "" : " - MISMATCH") << std::endl;
+    }
+
+    std::cout << (passed ? "Passed" : "FAILED") << ": " << objects.size() << " objects, " << meshDraws << " meshes" << std::endl;
+
+    light_shader.del();
+    instanced_shader.del();
+    return passed ? 0 : 1;
+}
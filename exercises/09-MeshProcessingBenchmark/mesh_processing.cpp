@@ -0,0 +1,333 @@
+/*
+Check and benchmark of the mesh processing run at import (include/utils/mesh_optimizer.h, include/utils/mesh_simplifier.h)
+
+Every mesh of the models given (the ones of camlight by default), and two procedural meshes whose triangles are
+shuffled (a grid and a sphere, the worst case for the vertex cache), go through MeshOptimizer::optimize and
+MeshSimplifier::buildLodChain as in Model::importMeshData, and the result is checked:
+- the optimized mesh draws the very same triangles: the index buffer is a permutation of the original triangles
+  (compared by the content of their vertices, as the vertices are reordered too), each one with its winding
+- the ACMR (with the FIFO cache of MeshOptimizer::analyze) is not worse than before, and it is lower on the
+  shuffled meshes
+- each LOD gets close to its target of half the triangles of the previous level: at most 3/4 of them
+- no vertex of the full mesh is farther from the surface of a LOD than the error bound of the chain
+- the border edges of each LOD are the ones of the full mesh (the grid has an open border, the sphere a UV seam)
+No GL context is needed.
+
+usage: mesh_processing [model files...]
+
+The ACMR and ATVR before and after, the triangles and distance of each LOD, and the time of the optimization and of
+the simplification are printed for each mesh. The exit code is not 0 if any check fails.
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+
+#include <glad/glad.h>
+
+// the import of the models, and the processing under test
+#include <utils/model.h>
+#include <utils/mesh_optimizer.h>
+#include <utils/mesh_simplifier.h>
+
+#include <glm/glm.hpp>
+
+typedef std::array<GLuint, 3> Triangle;
+
+const float PI = 3.14159265f;
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Grid of n x n quads on the XZ plane
+MeshData gridMesh(size_t n)
+{
+    MeshData mesh;
+    for (size_t z = 0; z <= n; z++)
+    {
+        for (size_t x = 0; x <= n; x++)
+        {
+            Vertex vertex{};
+            vertex.position  = glm::vec3((float)x, 0.0f, (float)z);
+            vertex.normal    = glm::vec3(0.0f, 1.0f, 0.0f);
+            vertex.texCoords = glm::vec2((float)x / n, (float)z / n);
+            mesh.vertices.push_back(vertex);
+        }
+    }
+    for (size_t z = 0; z < n; z++)
+    {
+        for (size_t x = 0; x < n; x++)
+        {
+            GLuint corner = (GLuint)(z * (n + 1) + x), next = corner + (GLuint)(n + 1);
+            GLuint quad[6] = { corner, next, corner + 1, corner + 1, next, next + 1 };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    return mesh;
+}
+
+// UV sphere of unit radius, the poles are made of degenerate quads as in most exported spheres
+MeshData sphereMesh(size_t rings, size_t sectors)
+{
+    MeshData mesh;
+    for (size_t r = 0; r <= rings; r++)
+    {
+        float theta = PI * r / rings;
+        for (size_t s = 0; s <= sectors; s++)
+        {
+            float phi = 2.0f * PI * s / sectors;
+            Vertex vertex{};
+            vertex.normal    = glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            vertex.position  = vertex.normal;
+            vertex.texCoords = glm::vec2((float)s / sectors, (float)r / rings);
+            mesh.vertices.push_back(vertex);
+        }
+    }
+    for (size_t r = 0; r < rings; r++)
+    {
+        for (size_t s = 0; s < sectors; s++)
+        {
+            GLuint corner = (GLuint)(r * (sectors + 1) + s), next = corner + (GLuint)(sectors + 1);
+            GLuint quad[6] = { corner, corner + 1, next, corner + 1, next + 1, next };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    return mesh;
+}
+
+// Same triangles in random order
+void shuffleTriangles(MeshData& mesh, unsigned seed)
+{
+    std::vector<Triangle> triangles(mesh.indices.size() / 3);
+    for (size_t t = 0; t < triangles.size(); t++) { triangles[t] = Triangle{mesh.indices[3 * t], mesh.indices[3 * t + 1], mesh.indices[3 * t + 2]}; }
+    std::shuffle(triangles.begin(), triangles.end(), std::mt19937(seed));
+    for (size_t t = 0; t < triangles.size(); t++) { std::copy(triangles[t].begin(), triangles[t].end(), mesh.indices.begin() + 3 * t); }
+}
+
+// Gives the same id to the vertices with the same content, in any mesh
+class VertexIds
+{
+    public:
+        GLuint id(const Vertex& vertex)
+        {
+            std::string key(reinterpret_cast<const char*>(&vertex), sizeof(Vertex));
+            auto found = ids.find(key);
+            if(found != ids.end()) return found->second;
+
+            GLuint newId = (GLuint)ids.size();
+            ids[key] = newId;
+            return newId;
+        }
+
+    private:
+        std::map<std::string, GLuint> ids;
+};
+
+// The triangles of an index buffer by the content of their vertices, sorted: each one is rotated to start from its
+// lowest id, which keeps the winding
+std::vector<Triangle> sortedTriangles(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, VertexIds& ids)
+{
+    std::vector<Triangle> triangles;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        Triangle triangle{ids.id(vertices[indices[i]]), ids.id(vertices[indices[i + 1]]), ids.id(vertices[indices[i + 2]])};
+        std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end()), triangle.end());
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+// Optimizes a copy of the mesh, returns the number of failed checks
+size_t checkOptimizer(const std::string& name, const MeshData& original, bool mustImprove, MeshData& optimized)
+{
+    optimized = original;
+    auto start = std::chrono::steady_clock::now();
+    MeshOptimizer::optimize(optimized);
+    double ms = elapsedMs(start);
+
+    MeshStats before = MeshOptimizer::analyze(original.indices, original.vertices.size());
+    MeshStats after  = MeshOptimizer::analyze(optimized.indices, optimized.vertices.size());
+
+    VertexIds ids;
+    bool sameTriangles = sortedTriangles(original.vertices, original.indices, ids) == sortedTriangles(optimized.vertices, optimized.indices, ids);
+    bool betterCache   = mustImprove ? after.acmr < before.acmr : after.acmr <= before.acmr;
+
+    std::cout << "  " << name << " (" << original.indices.size() / 3 << " triangles): optimized in " << ms << " ms, ACMR "
+              << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+              << (sameTriangles ? "" : " - TRIANGLES CHANGED") << (betterCache ? "" : " - ACMR NOT IMPROVED") << std::endl;
+    return (sameTriangles ? 0 : 1) + (betterCache ? 0 : 1);
+}
+
+// Squared distance of p from the triangle abc (closest point from "Real-Time Collision Detection", 5.1.5)
+float squaredDistance(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return glm::dot(ap, ap);
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return glm::dot(bp, bp);
+
+    float vc = d1 * d4 - d3 * d2;
+    glm::vec3 closest;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        closest = a + ab * (d1 / (d1 - d3));
+    }
+    else
+    {
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+        float vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+        if (d6 >= 0.0f && d5 <= d6) closest = c;
+        else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) closest = a + ac * (d2 / (d2 - d6));
+        else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) closest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        else
+        {
+            float denominator = 1.0f / (va + vb + vc);
+            closest = a + ab * (vb * denominator) + ac * (vc * denominator);
+        }
+    }
+    glm::vec3 offset = p - closest;
+    return glm::dot(offset, offset);
+}
+
+// Largest distance of the vertices of the full mesh from the surface of a LOD
+float surfaceDistance(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, const std::vector<GLuint>& lod)
+{
+    std::vector<bool> used(vertices.size(), false);
+    for (GLuint index : indices) { used[index] = true; }
+
+    float maxDistance = 0.0f;
+    for (size_t v = 0; v < vertices.size(); v++)
+    {
+        if (!used[v]) continue;
+
+        float nearest = std::numeric_limits<float>::max();
+        for (size_t t = 0; t + 2 < lod.size() && nearest > 0.0f; t += 3)
+        {
+            nearest = std::min(nearest, squaredDistance(vertices[v].position, vertices[lod[t]].position, vertices[lod[t + 1]].position, vertices[lod[t + 2]].position));
+        }
+        maxDistance = std::max(maxDistance, std::sqrt(nearest));
+    }
+    return maxDistance;
+}
+
+// Edges used by one triangle only, sorted
+std::vector<std::pair<GLuint, GLuint>> borderEdges(const std::vector<GLuint>& indices)
+{
+    std::map<std::pair<GLuint, GLuint>, size_t> uses;
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        for (size_t k = 0; k < 3; k++)
+        {
+            GLuint a = indices[t + k], b = indices[t + (k + 1) % 3];
+            uses[std::make_pair(std::min(a, b), std::max(a, b))]++;
+        }
+    }
+
+    std::vector<std::pair<GLuint, GLuint>> edges;
+    for (const auto& edge : uses) { if (edge.second == 1) edges.push_back(edge.first); }
+    return edges;
+}
+
+// Builds the LODs of a mesh as Model::importMeshData does, returns the number of failed checks
+size_t checkSimplifier(MeshData& mesh)
+{
+    const float maxError = 0.05f;
+
+    auto start = std::chrono::steady_clock::now();
+    MeshSimplifier::buildLodChain(mesh, maxError);
+    double ms = elapsedMs(start);
+
+    glm::vec3 minCorner = mesh.vertices[0].position, maxCorner = minCorner;
+    for (const Vertex& vertex : mesh.vertices)
+    {
+        minCorner = glm::min(minCorner, vertex.position);
+        maxCorner = glm::max(maxCorner, vertex.position);
+    }
+    float errorBound = maxError * glm::length(maxCorner - minCorner) * 0.5f;
+
+    std::cout << "    " << mesh.lodIndices.size() << " LODs built in " << ms << " ms" << std::endl;
+
+    size_t failures = 0;
+    std::vector<std::pair<GLuint, GLuint>> border = borderEdges(mesh.indices);
+    for (size_t l = 0; l < mesh.lodIndices.size(); l++)
+    {
+        const std::vector<GLuint>& previous = l == 0 ? mesh.indices : mesh.lodIndices[l - 1];
+        const std::vector<GLuint>& lod = mesh.lodIndices[l];
+
+        size_t target = previous.size() / 3 / 2, triangles = lod.size() / 3;
+        float distance = surfaceDistance(mesh.vertices, mesh.indices, lod);
+
+        // the level is kept only if it gets close to the target: at most 3/4 of the previous level
+        bool meetsTarget = triangles > 0 && triangles <= previous.size() / 3 * 3 / 4;
+        bool withinError = distance <= errorBound;
+        bool keepsBorder = borderEdges(lod) == border;
+        failures += (meetsTarget ? 0 : 1) + (withinError ? 0 : 1) + (keepsBorder ? 0 : 1);
+
+        std::cout << "    LOD " << l + 1 << ": " << triangles << " triangles (target " << target << "), distance from the full mesh "
+                  << distance << " (bound " << errorBound << "), " << border.size() << " border edges"
+                  << (meetsTarget ? "" : " - TOO MANY TRIANGLES") << (withinError ? "" : " - ERROR TOO LARGE")
+                  << (keepsBorder ? "" : " - BORDER CHANGED") << std::endl;
+    }
+    return failures;
+}
+
+// Runs every check on a mesh, returns the number of failed ones
+size_t checkMesh(const std::string& name, const MeshData& mesh, bool shuffled)
+{
+    MeshData optimized;
+    size_t failures = checkOptimizer(name, mesh, shuffled, optimized);
+    return failures + checkSimplifier(optimized);
+}
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> paths(argv + 1, argv + argc);
+    if (paths.empty()) paths = { "../../models/cube.obj", "../../models/sphere.obj", "../../models/bunny_lp.obj" };
+
+    size_t failures = 0;
+
+    std::cout << "Procedural meshes, triangles shuffled" << std::endl;
+    MeshData grid = gridMesh(60), sphere = sphereMesh(50, 100);
+    shuffleTriangles(grid, 1);
+    shuffleTriangles(sphere, 2);
+    failures += checkMesh("grid", grid, true);
+    failures += checkMesh("sphere", sphere, true);
+
+    // imported as Model::importMeshData does, without reading or writing the mesh cache
+    for (const std::string& path : paths)
+    {
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_FlipUVs |
+                                                       aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE)
+        {
+            std::cout << path << ": could not be imported, skipped" << std::endl;
+            continue;
+        }
+
+        std::cout << path << std::endl;
+        for (unsigned m = 0; m < scene->mNumMeshes; m++)
+        {
+            failures += checkMesh("mesh " + std::to_string(m), Model::processMesh(scene->mMeshes[m]), false);
+        }
+    }
+
+    std::cout << (failures ? "FAILED: " : "Passed: ") << failures << " checks failed" << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+/*
+Test and benchmark of the SphereCuller class (include/utils/frustum.h)
+
+Random spheres are scattered in a cube (bigger with the number of spheres, so their density stays the same) and culled
+against the frustum of a camera in its center, turning around to look in several directions. Then every sphere moves
+a little and is updated with set, as World does for the objects moved in a frame, and the culling is repeated. Each
+result is compared with the plane test of Frustum::intersects on every sphere.
+The SIMD path is the one of the compiler flags: AVX with -mavx, SSE on any x64 build, scalar otherwise.
+No GL context is needed.
+
+usage: culling_benchmark [--objects N] [--culls N]
+
+Without --objects the culler is tested with 10k and 50k spheres, and with 1003 (the last spheres do not fill a SIMD
+block). The time of a cull and the visible and culled counters are printed on the console, and the exit code is not
+0 if any result differs from the brute force one.
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+
+#include <glad/glad.h>
+
+// the class under test
+#include <utils/frustum.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+#if defined(FRUSTUM_CULL_AVX)
+const char* simdPath = "AVX";
+#elif defined(FRUSTUM_CULL_SSE)
+const char* simdPath = "SSE";
+#else
+const char* simdPath = "scalar";
+#endif
+
+// True if the sphere touches a plane of the frustum: the SIMD path sums the products in another order, so
+// the result may differ from the brute force one there
+bool onBorder(const Frustum& frustum, const BoundingSphere& sphere)
+{
+    for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+    {
+        float distance = glm::dot(glm::vec3(frustum.planes[p]), sphere.center) + frustum.planes[p].w + sphere.radius;
+        if (std::fabs(distance) <= 1e-4f * (1.0f + std::fabs(frustum.planes[p].w))) return true;
+    }
+    return false;
+}
+
+class CullingTest
+{
+    public:
+        CullingTest(size_t objectCount, size_t cullCount) : objectCount(objectCount), cullCount(cullCount), failures(0), random(7)
+        {
+            // about one sphere every 8 cubic units, of radius between 0.1 and 1
+            halfSide = std::cbrt((float)objectCount * 8.0f) * 0.5f;
+            std::uniform_real_distribution<float> position(-halfSide, halfSide), radius(0.1f, 1.0f);
+
+            spheres.resize(objectCount);
+            for (size_t i = 0; i < objectCount; i++)
+            {
+                spheres[i] = BoundingSphere{glm::vec3(position(random), position(random), position(random)), radius(random)};
+                culler.add(spheres[i]);
+            }
+
+            // the camera turns around in the center of the cube, each frustum sees about a tenth of it
+            glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, halfSide * 2.0f);
+            for (size_t i = 0; i < cullCount; i++)
+            {
+                float angle = glm::radians(360.0f * i / cullCount);
+                glm::vec3 direction(std::sin(angle), 0.3f * std::cos(angle * 3.0f), -std::cos(angle));
+                frustums.push_back(Frustum(projection * glm::lookAt(glm::vec3(0.0f), direction, glm::vec3(0.0f, 1.0f, 0.0f))));
+            }
+        }
+
+        // Returns the number of culls differing from the brute force ones
+        size_t run()
+        {
+            std::cout << objectCount << " spheres (" << simdPath << ")" << std::endl;
+            check("added");
+
+            // every sphere moves a little, as the objects of a scene from a frame to the next one
+            std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+            for (size_t i = 0; i < objectCount; i++)
+            {
+                spheres[i].center += glm::vec3(step(random), step(random), step(random));
+                culler.set(i, spheres[i]);
+            }
+            check("moved");
+
+            return failures;
+        }
+
+    private:
+        size_t objectCount, cullCount, failures;
+        std::mt19937 random;
+        float halfSide;
+
+        std::vector<BoundingSphere> spheres;
+        std::vector<Frustum> frustums;
+        SphereCuller culler;
+
+        // Times the culls, and compares them with the brute force results
+        void check(const char* step)
+        {
+            std::vector<std::vector<uint32_t>> visible(cullCount);
+            size_t visibleCount = 0, testedCount = 0;
+            Clock::time_point start = Clock::now();
+            for (size_t c = 0; c < cullCount; c++)
+            {
+                CullStats stats = culler.cull(frustums[c], visible[c]);
+                visibleCount += stats.visible;
+                testedCount  += stats.tested;
+            }
+            double cullMs = elapsedMs(start) / cullCount;
+
+            std::vector<uint32_t> expected;
+            size_t mismatches = 0, borderDifferences = 0, wrongCounters = 0;
+            start = Clock::now();
+            for (size_t c = 0; c < cullCount; c++)
+            {
+                expected.clear();
+                for (size_t i = 0; i < objectCount; i++)
+                {
+                    if (frustums[c].intersects(spheres[i])) expected.push_back((uint32_t)i);
+                }
+
+                // a result differing only by spheres touching a plane is still right
+                if (visible[c] != expected)
+                {
+                    std::vector<uint32_t> difference;
+                    std::set_symmetric_difference(visible[c].begin(), visible[c].end(), expected.begin(), expected.end(), std::back_inserter(difference));
+                    bool onlyBorder = std::all_of(difference.begin(), difference.end(), [&](uint32_t i) { return onBorder(frustums[c], spheres[i]); });
+                    if (onlyBorder) borderDifferences += difference.size();
+                    else mismatches++;
+                }
+            }
+            double bruteMs = elapsedMs(start) / cullCount;
+
+            // the counters are the ones of the pass
+            if (testedCount != objectCount * cullCount) wrongCounters++;
+            size_t listed = 0;
+            for (const std::vector<uint32_t>& list : visible) { listed += list.size(); }
+            if (listed != visibleCount) wrongCounters++;
+
+            std::cout << "  " << step << ": " << cullMs << " ms per cull (brute force " << bruteMs << " ms), "
+                      << visibleCount / cullCount << " visible and " << objectCount - visibleCount / cullCount << " culled on average"
+                      << (borderDifferences ? ", " + std::to_string(borderDifferences) + " spheres on a plane differ" : "")
+                      << (mismatches ? " - MISMATCH in " + std::to_string(mismatches) + " culls" : "")
+                      << (wrongCounters ? " - WRONG COUNTERS" : "") << std::endl;
+
+            failures += mismatches + wrongCounters;
+        }
+};
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    std::vector<size_t> objectCounts = { 1003, 10000, 50000 };
+    size_t cullCount = 100;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if      (!strcmp(argv[i], "--objects")) objectCounts = std::vector<size_t>(1, (size_t)atoi(argv[i + 1]));
+        else if (!strcmp(argv[i], "--culls"))   cullCount    = (size_t)atoi(argv[i + 1]);
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+
+    size_t failures = 0;
+    for (size_t count : objectCounts)
+    {
+        CullingTest test(count, cullCount);
+        failures += test.run();
+    }
+
+    std::cout << (failures ? "FAILED: " : "Passed: ") << failures << " results differ from brute force" << std::endl;
+    return failures ? 1 : 0;
+}
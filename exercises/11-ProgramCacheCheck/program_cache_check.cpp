@@ -0,0 +1,136 @@
+/*
+Check of the binary cache of the shader programs (include/utils/program_cache.h)
+
+The programs of camlight and of the benchmark are built three times in a headless context, as in three runs:
+- the first time only to find their cache files, which are deleted
+- the second time every program is compiled and its binary is written to the cache
+- the third time every program has to be loaded from its cache, without compiling
+Several of them share both shaders and differ only in their utils (lighting.frag with and without clusters.utils),
+so they have to be cached in different files: with a shared file each build would overwrite the binary of the
+other one, and both would be compiled at every run.
+
+usage: program_cache_check [--backend egl|osmesa]
+
+Every program is printed with where it came from in the last two builds, and the exit code is not 0 if any check fails
+(a driver without program binary formats skips the check).
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <iostream>
+
+#include <glad/glad.h>
+
+// offscreen GL context
+#include <utils/headless_context.h>
+
+// the classes under test
+#include <utils/shader.h>
+#include <utils/program_cache.h>
+
+// OpenGL version
+GLuint glMajor = 4, glMinor = 1;
+
+// The programs of camlight and of the benchmark sharing a vertex shader
+std::vector<std::unique_ptr<Shader>> buildPrograms()
+{
+    std::vector<std::unique_ptr<Shader>> programs;
+    programs.emplace_back(new Shader("../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor));
+    programs.emplace_back(new Shader("../../shaders/procedural_base.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils", "../../shaders/clusters.utils"}, glMajor, glMinor));
+    programs.emplace_back(new Shader("../../shaders/procedural_base.vert", "../../shaders/gbuffer.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"}, glMajor, glMinor));
+    programs.emplace_back(new Shader("../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils"}, glMajor, glMinor));
+    programs.emplace_back(new Shader("../../shaders/procedural_instanced.vert", "../../shaders/lighting.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils", "../../shaders/illumination.utils", "../../shaders/clusters.utils"}, glMajor, glMinor));
+    programs.emplace_back(new Shader("../../shaders/procedural_instanced.vert", "../../shaders/gbuffer.frag", {"../../shaders/types.utils", "../../shaders/constants.utils", "../../shaders/uniform_blocks.utils"}, glMajor, glMinor));
+    return programs;
+}
+
+void deletePrograms(std::vector<std::unique_ptr<Shader>>& programs)
+{
+    for (std::unique_ptr<Shader>& program : programs) { program->del(); }
+    programs.clear();
+}
+
+// The files of the program, the last utils included
+std::string describe(const Shader& program)
+{
+    std::vector<std::string> paths = program.sourcePaths();
+    std::string description = paths[paths.size() - 2] + " + " + paths.back();
+    if (paths.size() > 2) description += " (utils up to " + paths[paths.size() - 3] + ")";
+    return description;
+}
+
+/////////////////// MAIN function ///////////////////////
+int main(int argc, char* argv[])
+{
+    HeadlessBackend backend = HEADLESS_EGL;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--backend")) backend = strcmp(argv[i + 1], "osmesa") ? HEADLESS_EGL : HEADLESS_OSMESA;
+        else
+        {
+            std::cout << "Unknown option " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+
+    HeadlessContext context(64, 64, glMajor, glMinor, backend);
+    if (!context.valid())
+    {
+        std::cout << "Failed to create the headless OpenGL context" << std::endl;
+        return -1;
+    }
+    std::cout << "Renderer: " << context.renderer() << std::endl;
+
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    if (formatCount == 0)
+    {
+        std::cout << "The driver has no program binary formats, nothing to check" << std::endl;
+        return 0;
+    }
+
+    bool passed = true;
+
+    // the cache files of the programs, found from their sources as Shader does
+    std::vector<std::unique_ptr<Shader>> programs = buildPrograms();
+    std::vector<std::string> cachePaths;
+    for (const std::unique_ptr<Shader>& program : programs)
+    {
+        std::vector<std::string> paths = program->sourcePaths();
+        std::vector<std::string> utils(paths.begin(), paths.end() - 2);
+        cachePaths.push_back(ProgramCache::cachePath(paths[paths.size() - 2], paths.back(), utils));
+    }
+    deletePrograms(programs);
+
+    std::vector<std::string> sortedPaths = cachePaths;
+    std::sort(sortedPaths.begin(), sortedPaths.end());
+    if (std::unique(sortedPaths.begin(), sortedPaths.end()) != sortedPaths.end())
+    {
+        std::cout << "Some programs share a cache file - FAILED" << std::endl;
+        passed = false;
+    }
+    for (const std::string& path : cachePaths) { std::remove(path.c_str()); }
+
+    // without cache files everything is compiled, then everything comes from the files just written
+    std::vector<std::unique_ptr<Shader>> compiled = buildPrograms();
+    std::vector<std::unique_ptr<Shader>> loaded = buildPrograms();
+    for (size_t i = 0; i < loaded.size(); i++)
+    {
+        bool matches = !compiled[i]->fromCache() && loaded[i]->fromCache() && compiled[i]->isLinked() && loaded[i]->isLinked();
+        passed = passed && matches;
+
+        std::cout << describe(*loaded[i]) << ": " << (compiled[i]->fromCache() ? "cached" : "compiled") << ", then "
+                  << (loaded[i]->fromCache() ? "cached" : "compiled") << (matches ? "" : " - FAILED") << std::endl;
+    }
+    deletePrograms(compiled);
+    deletePrograms(loaded);
+
+    std::cout << (passed ? "Passed" : "FAILED") << ": " << cachePaths.size() << " programs" << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+#pragma once
+/*
+   AssetLoader class
+   - model files are imported (cache read or Assimp + conversion) by a pool of worker threads
+   - the resulting CPU side meshes are handed to the render thread through a lock-free queue,
+     and uploaded to the GPU a few at a time, within a per-frame budget
+*/
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include <utils/mesh.h>
+#include <utils/model.h>
+
+// Unbounded multi-producer single-consumer queue (D. Vyukov's node based algorithm):
+// producers never block each other, the single consumer never blocks producers
+template <typename T>
+class MPSCQueue
+{
+   struct Node
+   {
+      std::atomic<Node*> next;
+      T value;
+
+      Node() : next(nullptr) {}
+      Node(T&& value) : next(nullptr), value(std::move(value)) {}
+   };
+
+   public:
+      MPSCQueue() : head(new Node()), tail(head.load()) {}
+
+      MPSCQueue(const MPSCQueue& copy) = delete;
+      MPSCQueue& operator=(const MPSCQueue& copy) = delete;
+
+      ~MPSCQueue()
+      {
+         T discarded;
+         while(pop(discarded)) {}
+         delete tail;
+      }
+
+      // Can be called by any thread
+      void push(T value)
+      {
+         Node* node = new Node(std::move(value));
+         Node* prev = head.exchange(node, std::memory_order_acq_rel);
+         // until this store the consumer sees the queue as ending at prev
+         prev->next.store(node, std::memory_order_release);
+      }
+
+      // Must be called by the consumer thread only
+      bool pop(T& value)
+      {
+         Node* next = tail->next.load(std::memory_order_acquire);
+         if(!next) return false;
+
+         // next becomes the new dummy node, its value is moved out
+         value = std::move(next->value);
+         delete tail;
+         tail = next;
+         return true;
+      }
+
+   private:
+      std::atomic<Node*> head; // last pushed node
+      Node* tail;              // dummy node before the first element
+};
+
+class AssetLoader
+{
+   public:
+      AssetLoader(size_t workerCount = std::max(1u, std::thread::hardware_concurrency() / 2)) : stopping(false), inFlight(0)
+      {
+         for (size_t i = 0; i < workerCount; i++)
+         {
+            workers.emplace_back(&AssetLoader::workerLoop, this);
+         }
+      }
+
+      AssetLoader(const AssetLoader& copy) = delete;
+      AssetLoader& operator=(const AssetLoader& copy) = delete;
+
+      ~AssetLoader()
+      {
+         {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+         }
+         jobsAvailable.notify_all();
+         for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+      }
+
+      // Returns immediately with an empty model, which becomes ready once all its meshes have been uploaded
+      std::shared_ptr<Model> load(const std::string& path, VertexFormat format = VERTEX_FULL, const ImportOptions& options = ImportOptions())
+      {
+         std::shared_ptr<Model> model = std::make_shared<Model>();
+         inFlight++;
+         {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back(Job{path, model, format, options});
+         }
+         jobsAvailable.notify_one();
+         return model;
+      }
+
+      // To be called once per frame by the thread owning the GL context: uploads the meshes imported so far,
+      // stopping as soon as byteBudget bytes have been uploaded or msBudget milliseconds have passed
+      void uploadPending(size_t byteBudget = 16 << 20, double msBudget = 2.0)
+      {
+         PROFILE_SCOPE("AssetLoader::uploadPending");
+         auto start = std::chrono::steady_clock::now();
+         size_t uploadedBytes = 0;
+
+         PendingMesh pending;
+         while(uploadedBytes < byteBudget && elapsedMs(start) < msBudget && uploads.pop(pending))
+         {
+            if(pending.meshCount > 0)
+            {
+               uploadedBytes += pending.data.vertices.size() * vertexLayout(pending.format).stride + pending.data.totalIndexCount() * sizeof(GLuint);
+               pending.model->meshes.emplace_back(std::move(pending.data), pending.format);
+            }
+
+            if(pending.model->meshes.size() == pending.meshCount)
+            {
+               pending.model->ready = true;
+               inFlight--;
+            }
+         }
+      }
+
+      // Number of models requested but not ready yet
+      size_t pending() const noexcept { return inFlight.load(); }
+
+   private:
+      struct Job
+      {
+         std::string path;
+         std::shared_ptr<Model> model;
+         VertexFormat format;
+         ImportOptions options;
+      };
+
+      struct PendingMesh
+      {
+         std::shared_ptr<Model> model;
+         MeshData data;
+         VertexFormat format = VERTEX_FULL;
+         size_t meshCount = 0; // total meshes of the model, 0 if the import failed
+      };
+
+      std::vector<std::thread> workers;
+
+      std::deque<Job> jobs;
+      std::mutex jobsMutex;
+      std::condition_variable jobsAvailable;
+      bool stopping;
+
+      MPSCQueue<PendingMesh> uploads;
+      std::atomic<size_t> inFlight;
+
+      void workerLoop()
+      {
+         profiler().setThreadName("AssetLoader worker");
+         while(true)
+         {
+            Job job;
+            {
+               std::unique_lock<std::mutex> lock(jobsMutex);
+               jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+               if(stopping) return;
+
+               job = std::move(jobs.front());
+               jobs.pop_front();
+            }
+
+            // cache read or Assimp import + conversion, no GL call here
+            std::vector<MeshData> data = Model::importMeshData(job.path, job.options);
+
+            if(data.empty())
+            {
+               // the model becomes ready (and empty) anyway, so nobody waits for it forever
+               PendingMesh failed;
+               failed.model = std::move(job.model);
+               uploads.push(std::move(failed));
+               continue;
+            }
+
+            // the last mesh takes our reference to the model, so that the model (and its GL objects)
+            // is never released by a worker thread
+            for (size_t i = 0; i < data.size(); i++)
+            {
+               PendingMesh pending;
+               pending.model     = (i + 1 < data.size()) ? job.model : std::move(job.model);
+               pending.data      = std::move(data[i]);
+               pending.format    = job.format;
+               pending.meshCount = data.size();
+               uploads.push(std::move(pending));
+            }
+         }
+      }
+
+      static double elapsedMs(std::chrono::steady_clock::time_point start)
+      {
+         return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+};
@@ -0,0 +1,145 @@
+#pragma once
+/*
+   FrameBenchmark class
+   - renders a fixed number of frames with a fixed time step, so that every run draws the very same frames
+   - measures the CPU time of each frame (with glFinish at the end, so the time includes the GPU work the frame waits for)
+   - reports mean, median, 99th percentile, minimum and maximum frame time, and the draw calls, as JSON
+*/
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+
+struct BenchmarkSettings
+{
+   size_t frames       = 500;
+   size_t warmupFrames = 20;          // rendered but not measured (shader compilation, first uploads...)
+   float  timeStep     = 1.0f / 60.0f; // seconds of simulated time per frame
+   bool   finishFrames = true;        // glFinish after each frame, or the GPU work piles up in the driver queue
+};
+
+struct BenchmarkResult
+{
+   size_t frames = 0;
+   double meanMs = 0.0, p50Ms = 0.0, p99Ms = 0.0, minMs = 0.0, maxMs = 0.0;
+   double meanDrawCalls = 0.0;
+   size_t totalDrawCalls = 0;
+};
+
+class FrameBenchmark
+{
+   public:
+      // Renders a frame at the given simulated time, returns the draw calls it issued
+      typedef std::function<size_t(float time, float deltaTime)> FrameFunction;
+
+      FrameBenchmark(const BenchmarkSettings& settings = BenchmarkSettings()) : settings(settings) {}
+
+      const BenchmarkResult& run(const FrameFunction& frame)
+      {
+         frameMs.clear();
+         drawCalls.clear();
+         frameMs.reserve(settings.frames);
+         drawCalls.reserve(settings.frames);
+
+         for (size_t i = 0; i < settings.warmupFrames + settings.frames; i++)
+         {
+            float time = i * settings.timeStep;
+
+            auto start = std::chrono::steady_clock::now();
+            size_t draws = frame(time, settings.timeStep);
+            if(settings.finishFrames) glFinish();
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if(i < settings.warmupFrames) continue;
+            frameMs.push_back(elapsed);
+            drawCalls.push_back(draws);
+         }
+
+         summarize();
+         return summary;
+      }
+
+      const BenchmarkResult& result() const noexcept { return summary; }
+
+      // Frame times in rendering order, for a closer look than the summary
+      const std::vector<double>& frameTimes() const noexcept { return frameMs; }
+
+      // name and renderer identify the run, in the JSON next to the results
+      void writeJSON(std::ostream& out, const std::string& name, const std::string& renderer) const
+      {
+         out << "{\n"
+             << "   \"benchmark\": \"" << escape(name) << "\",\n"
+             << "   \"renderer\": \"" << escape(renderer) << "\",\n"
+             << "   \"frames\": " << summary.frames << ",\n"
+             << "   \"warmup_frames\": " << settings.warmupFrames << ",\n"
+             << "   \"time_step\": " << settings.timeStep << ",\n"
+             << "   \"frame_ms\": { \"mean\": " << summary.meanMs << ", \"p50\": " << summary.p50Ms << ", \"p99\": " << summary.p99Ms
+             << ", \"min\": " << summary.minMs << ", \"max\": " << summary.maxMs << " },\n"
+             << "   \"draw_calls\": { \"mean\": " << summary.meanDrawCalls << ", \"total\": " << summary.totalDrawCalls << " }\n"
+             << "}\n";
+      }
+
+      bool writeJSON(const std::string& path, const std::string& name, const std::string& renderer) const
+      {
+         std::ofstream file(path);
+         writeJSON(file, name, renderer);
+         if(!file)
+         {
+            std::cout << "Could not write " << path << std::endl;
+            return false;
+         }
+         return true;
+      }
+
+   private:
+      BenchmarkSettings settings;
+      BenchmarkResult summary;
+      std::vector<double> frameMs;
+      std::vector<size_t> drawCalls;
+
+      void summarize()
+      {
+         summary = BenchmarkResult();
+         summary.frames = frameMs.size();
+         if(frameMs.empty()) return;
+
+         std::vector<double> sorted = frameMs;
+         std::sort(sorted.begin(), sorted.end());
+
+         double total = 0.0;
+         for (double ms : sorted) { total += ms; }
+         for (size_t draws : drawCalls) { summary.totalDrawCalls += draws; }
+
+         summary.meanMs = total / sorted.size();
+         summary.p50Ms  = percentile(sorted, 0.50);
+         summary.p99Ms  = percentile(sorted, 0.99);
+         summary.minMs  = sorted.front();
+         summary.maxMs  = sorted.back();
+         summary.meanDrawCalls = (double)summary.totalDrawCalls / drawCalls.size();
+      }
+
+      // Nearest rank percentile of sorted values
+      static double percentile(const std::vector<double>& sorted, double fraction)
+      {
+         size_t rank = (size_t)std::ceil(fraction * sorted.size());
+         return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+      }
+
+      static std::string escape(const std::string& text)
+      {
+         std::string escaped;
+         for (char c : text)
+         {
+            if(c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+         }
+         return escaped;
+      }
+};
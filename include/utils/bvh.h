@@ -0,0 +1,616 @@
+#pragma once
+/*
+   BVH class
+   - bounding volume hierarchy over world space boxes, each one carrying a user value (e.g. the index of an Object)
+   - built top-down with the surface area heuristic, then kept up to date with incremental inserts and removes
+     and with refits when the boxes move
+   - hierarchical frustum query (subtrees fully inside the frustum are not tested any further) and ray picking
+*/
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+#include <utils/mesh.h>
+#include <utils/frustum.h>
+
+// Box around a bounding sphere, the leaves of the BVH are boxes
+inline BoundingBox sphereBox(const BoundingSphere& sphere)
+{
+   return BoundingBox{sphere.center - glm::vec3(sphere.radius), sphere.center + glm::vec3(sphere.radius)};
+}
+
+// Nearest box hit by a ray
+struct RayHit
+{
+   uint32_t userData;
+   float distance; // along the ray direction, in units of its length
+};
+
+class BVH
+{
+   public:
+      static const int NULL_NODE = -1;
+
+      BVH() : root(NULL_NODE), freeList(NULL_NODE), leafCount(0) {}
+
+      // Replaces the whole tree with a SAH tree over the given boxes,
+      // returns the handle of every box (to update or remove it later)
+      std::vector<int> build(const std::vector<BoundingBox>& boxes, const std::vector<uint32_t>& userData)
+      {
+         clear();
+
+         std::vector<int> leaves(boxes.size());
+         for (size_t i = 0; i < boxes.size(); i++) { leaves[i] = allocateLeaf(boxes[i], userData[i]); }
+         leafCount = boxes.size();
+
+         if(!leaves.empty())
+         {
+            std::vector<int> work(leaves);
+            buildTree(work);
+         }
+         return leaves;
+      }
+
+      // Rebuilds the tree from its current leaves: inserts and refits slowly degrade its quality
+      void rebuild()
+      {
+         std::vector<int> leaves;
+         collectLeaves(root, leaves);
+         if(leaves.empty()) return;
+
+         // the leaves keep their handles, only the inner nodes are replaced
+         freeInnerNodes(root);
+         buildTree(leaves);
+      }
+
+      void clear()
+      {
+         nodes.clear();
+         root = freeList = NULL_NODE;
+         leafCount = 0;
+      }
+
+      // Adds a box, returns its handle
+      int insert(const BoundingBox& box, uint32_t userData)
+      {
+         int leaf = allocateLeaf(box, userData);
+         insertLeaf(leaf);
+         leafCount++;
+         return leaf;
+      }
+
+      void remove(int handle)
+      {
+         removeLeaf(handle);
+         freeNode(handle);
+         leafCount--;
+      }
+
+      // Moves a box and refits its ancestors
+      void update(int handle, const BoundingBox& box)
+      {
+         nodes[handle].box = box;
+         refitAncestors(nodes[handle].parent);
+      }
+
+      // Moves a box without touching the rest of the tree: after many of these, a single refit() is cheaper
+      // than refitting the ancestors of each box
+      void setBox(int handle, const BoundingBox& box) { nodes[handle].box = box; }
+
+      // Recomputes the boxes of all the inner nodes, bottom-up
+      void refit()
+      {
+         if(root == NULL_NODE) return;
+
+         // parents come before their children in this order, so walking it backwards refits children first
+         std::vector<int> order;
+         std::vector<int> stack(1, root);
+         while(!stack.empty())
+         {
+            int index = stack.back();
+            stack.pop_back();
+            if(nodes[index].isLeaf()) continue;
+
+            order.push_back(index);
+            stack.push_back(nodes[index].left);
+            stack.push_back(nodes[index].right);
+         }
+         for (size_t i = order.size(); i-- > 0;)
+         {
+            Node& node = nodes[order[i]];
+            node.box = mergeBoxes(nodes[node.left].box, nodes[node.right].box);
+         }
+      }
+
+      // Calls visit(userData) for every box intersecting the frustum, returns the nodes visited (inner ones and leaves,
+      // also the ones of the subtrees found inside, which are not tested)
+      template <typename F>
+      size_t query(const Frustum& frustum, F visit) const
+      {
+         if(root == NULL_NODE) return 0;
+
+         // each entry carries the planes its parent was not entirely inside of, the only ones left to test
+         const unsigned ALL_PLANES = (1u << Frustum::PLANE_COUNT) - 1;
+         std::vector<std::pair<int, unsigned>> stack(1, std::make_pair(root, ALL_PLANES));
+         size_t visited = 0;
+         while(!stack.empty())
+         {
+            int index = stack.back().first;
+            unsigned planes = stack.back().second;
+            stack.pop_back();
+
+            const Node& node = nodes[index];
+            if(!classify(frustum, node.box, planes))
+            {
+               visited++;
+               continue;
+            }
+
+            if(planes == 0)
+            {
+               // the whole subtree is inside
+               visited += visitLeaves(index, visit);
+            }
+            else if(node.isLeaf())
+            {
+               visited++;
+               visit(node.userData);
+            }
+            else
+            {
+               visited++;
+               stack.push_back(std::make_pair(node.left, planes));
+               stack.push_back(std::make_pair(node.right, planes));
+            }
+         }
+         return visited;
+      }
+
+      // Calls visit(userData) for every box overlapping the given one
+      template <typename F>
+      void query(const BoundingBox& box, F visit) const
+      {
+         if(root == NULL_NODE) return;
+
+         std::vector<int> stack(1, root);
+         while(!stack.empty())
+         {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if(!overlaps(node.box, box)) continue;
+
+            if(node.isLeaf())
+            {
+               visit(node.userData);
+            }
+            else
+            {
+               stack.push_back(node.left);
+               stack.push_back(node.right);
+            }
+         }
+      }
+
+      // Finds the nearest box hit by the ray origin + t * direction with 0 <= t <= maxDistance,
+      // e.g. to pick what is at the center of the screen with camera.position() and camera.direction()
+      bool raycast(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit, float maxDistance = std::numeric_limits<float>::max()) const
+      {
+         if(root == NULL_NODE) return false;
+
+         glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+         bool found = false;
+         hit.distance = maxDistance;
+
+         std::vector<int> stack(1, root);
+         while(!stack.empty())
+         {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+
+            float distance;
+            if(!intersectRay(origin, inverseDirection, node.box, hit.distance, distance)) continue;
+
+            if(node.isLeaf())
+            {
+               hit.userData = node.userData;
+               hit.distance = distance;
+               found = true;
+               continue;
+            }
+
+            // the nearest child goes on top of the stack, so its hits can discard the other child early
+            float leftDistance, rightDistance;
+            bool hitsLeft  = intersectRay(origin, inverseDirection, nodes[node.left].box, hit.distance, leftDistance);
+            bool hitsRight = intersectRay(origin, inverseDirection, nodes[node.right].box, hit.distance, rightDistance);
+            if(hitsLeft && hitsRight)
+            {
+               stack.push_back(leftDistance < rightDistance ? node.right : node.left);
+               stack.push_back(leftDistance < rightDistance ? node.left : node.right);
+            }
+            else if(hitsLeft)  stack.push_back(node.left);
+            else if(hitsRight) stack.push_back(node.right);
+         }
+         return found;
+      }
+
+      size_t size() const noexcept { return leafCount; }
+
+      const BoundingBox& box(int handle) const { return nodes[handle].box; }
+
+      // Sum of the surface areas of the inner nodes relative to the root one: the lower the faster the queries
+      float sahCost() const
+      {
+         if(root == NULL_NODE) return 0.0f;
+
+         float rootArea = surfaceArea(nodes[root].box), cost = 0.0f;
+         std::vector<int> stack(1, root);
+         while(!stack.empty())
+         {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if(node.isLeaf()) continue;
+
+            cost += surfaceArea(node.box) / rootArea;
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+         }
+         return cost;
+      }
+
+   private:
+      struct Node
+      {
+         BoundingBox box;
+         int parent;       // next free node while in the free list
+         int left, right;  // NULL_NODE for leaves
+         uint32_t userData;
+
+         bool isLeaf() const noexcept { return left == NULL_NODE; }
+      };
+
+      static const size_t SAH_BINS = 16;
+
+      std::vector<Node> nodes;
+      int root;
+      int freeList;
+      size_t leafCount;
+
+      int allocateNode()
+      {
+         if(freeList != NULL_NODE)
+         {
+            int index = freeList;
+            freeList = nodes[index].parent;
+            return index;
+         }
+         nodes.push_back(Node());
+         return (int)nodes.size() - 1;
+      }
+
+      void freeNode(int index)
+      {
+         nodes[index].parent = freeList;
+         nodes[index].left = nodes[index].right = NULL_NODE;
+         freeList = index;
+      }
+
+      int allocateLeaf(const BoundingBox& box, uint32_t userData)
+      {
+         int index = allocateNode();
+         nodes[index].box = box;
+         nodes[index].parent = nodes[index].left = nodes[index].right = NULL_NODE;
+         nodes[index].userData = userData;
+         return index;
+      }
+
+      int allocateInner(int left, int right)
+      {
+         int index = allocateNode();
+         nodes[index].box = mergeBoxes(nodes[left].box, nodes[right].box);
+         nodes[index].parent = NULL_NODE;
+         nodes[index].left = left;
+         nodes[index].right = right;
+         nodes[left].parent = nodes[right].parent = index;
+         return index;
+      }
+
+      void buildTree(std::vector<int>& leaves)
+      {
+         // the centroids are read many times while splitting, we compute them once
+         std::vector<glm::vec3> centroids(nodes.size());
+         for (int leaf : leaves) { centroids[leaf] = centroid(nodes[leaf].box); }
+
+         root = buildRange(leaves, centroids, 0, leaves.size());
+         nodes[root].parent = NULL_NODE;
+      }
+
+      // Binned SAH split of leaves[begin, end), returns the root of the subtree
+      int buildRange(std::vector<int>& leaves, const std::vector<glm::vec3>& centroids, size_t begin, size_t end)
+      {
+         if(end - begin == 1) return leaves[begin];
+
+         BoundingBox centroidBounds{centroids[leaves[begin]], centroids[leaves[begin]]};
+         for (size_t i = begin + 1; i < end; i++)
+         {
+            const glm::vec3& c = centroids[leaves[i]];
+            centroidBounds = BoundingBox{glm::min(centroidBounds.minCorner, c), glm::max(centroidBounds.maxCorner, c)};
+         }
+
+         glm::vec3 extent = centroidBounds.maxCorner - centroidBounds.minCorner;
+         int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+         size_t middle = begin + (end - begin) / 2;
+         if(extent[axis] > 0.0f)
+         {
+            // boxes are binned by centroid, then the split between bins with the lowest
+            // count * area on both sides is taken
+            float binScale = SAH_BINS / extent[axis] * 0.9999f;
+            auto binOf = [&](int leaf) { return (size_t)((centroids[leaf][axis] - centroidBounds.minCorner[axis]) * binScale); };
+
+            size_t binCount[SAH_BINS] = {};
+            BoundingBox binBox[SAH_BINS];
+            for (size_t i = begin; i < end; i++)
+            {
+               size_t bin = binOf(leaves[i]);
+               binBox[bin] = binCount[bin]++ ? mergeBoxes(binBox[bin], nodes[leaves[i]].box) : nodes[leaves[i]].box;
+            }
+
+            float rightCost[SAH_BINS] = {};
+            BoundingBox accumulated;
+            size_t count = 0;
+            for (size_t bin = SAH_BINS - 1; bin > 0; bin--)
+            {
+               if(binCount[bin]) accumulated = count ? mergeBoxes(accumulated, binBox[bin]) : binBox[bin];
+               count += binCount[bin];
+               rightCost[bin] = count ? count * surfaceArea(accumulated) : 0.0f;
+            }
+
+            float bestCost = std::numeric_limits<float>::max();
+            size_t bestSplit = 0; // bins <= bestSplit go left
+            count = 0;
+            for (size_t bin = 0; bin + 1 < SAH_BINS; bin++)
+            {
+               if(binCount[bin]) accumulated = count ? mergeBoxes(accumulated, binBox[bin]) : binBox[bin];
+               count += binCount[bin];
+               if(count == 0 || count == end - begin) continue;
+
+               float cost = count * surfaceArea(accumulated) + rightCost[bin + 1];
+               if(cost < bestCost)
+               {
+                  bestCost = cost;
+                  bestSplit = bin;
+               }
+            }
+
+            if(bestCost < std::numeric_limits<float>::max())
+            {
+               middle = std::partition(leaves.begin() + begin, leaves.begin() + end, [&](int leaf) { return binOf(leaf) <= bestSplit; }) - leaves.begin();
+            }
+         }
+         else
+         {
+            // all the centroids in the same spot: any split is as good
+            std::nth_element(leaves.begin() + begin, leaves.begin() + middle, leaves.begin() + end);
+         }
+
+         int left  = buildRange(leaves, centroids, begin, middle);
+         int right = buildRange(leaves, centroids, middle, end);
+         return allocateInner(left, right);
+      }
+
+      // Walks down choosing the child whose box grows the least in area, and pairs the leaf with the node
+      // where that is cheaper than descending any further (Box2D's dynamic tree insertion)
+      void insertLeaf(int leaf)
+      {
+         if(root == NULL_NODE)
+         {
+            root = leaf;
+            nodes[leaf].parent = NULL_NODE;
+            return;
+         }
+
+         const BoundingBox& box = nodes[leaf].box;
+         int index = root;
+         while(!nodes[index].isLeaf())
+         {
+            const Node& node = nodes[index];
+            float area = surfaceArea(node.box);
+            float combinedArea = surfaceArea(mergeBoxes(node.box, box));
+
+            // cost of a new parent for this node and the leaf, and the one pushed down to the children
+            float cost = 2.0f * combinedArea;
+            float inheritedCost = 2.0f * (combinedArea - area);
+
+            float leftCost  = childCost(node.left, box) + inheritedCost;
+            float rightCost = childCost(node.right, box) + inheritedCost;
+            if(cost < leftCost && cost < rightCost) break;
+
+            index = leftCost < rightCost ? node.left : node.right;
+         }
+
+         int sibling = index;
+         int oldParent = nodes[sibling].parent;
+         int newParent = allocateInner(sibling, leaf);
+         nodes[newParent].parent = oldParent;
+
+         if(oldParent == NULL_NODE)
+         {
+            root = newParent;
+         }
+         else
+         {
+            if(nodes[oldParent].left == sibling) nodes[oldParent].left = newParent;
+            else                                 nodes[oldParent].right = newParent;
+            refitAncestors(oldParent);
+         }
+      }
+
+      float childCost(int child, const BoundingBox& box) const
+      {
+         float combinedArea = surfaceArea(mergeBoxes(nodes[child].box, box));
+         return nodes[child].isLeaf() ? combinedArea : combinedArea - surfaceArea(nodes[child].box);
+      }
+
+      void removeLeaf(int leaf)
+      {
+         if(leaf == root)
+         {
+            root = NULL_NODE;
+            return;
+         }
+
+         // the parent goes away, and the sibling takes its place
+         int parent = nodes[leaf].parent;
+         int grandParent = nodes[parent].parent;
+         int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+         if(grandParent == NULL_NODE)
+         {
+            root = sibling;
+            nodes[sibling].parent = NULL_NODE;
+         }
+         else
+         {
+            if(nodes[grandParent].left == parent) nodes[grandParent].left = sibling;
+            else                                  nodes[grandParent].right = sibling;
+            nodes[sibling].parent = grandParent;
+            refitAncestors(grandParent);
+         }
+         freeNode(parent);
+      }
+
+      void refitAncestors(int index)
+      {
+         while(index != NULL_NODE)
+         {
+            Node& node = nodes[index];
+            node.box = mergeBoxes(nodes[node.left].box, nodes[node.right].box);
+            index = node.parent;
+         }
+      }
+
+      void collectLeaves(int index, std::vector<int>& leaves) const
+      {
+         if(index == NULL_NODE) return;
+
+         std::vector<int> stack(1, index);
+         while(!stack.empty())
+         {
+            const Node& node = nodes[stack.back()];
+            int current = stack.back();
+            stack.pop_back();
+
+            if(node.isLeaf())
+            {
+               leaves.push_back(current);
+            }
+            else
+            {
+               stack.push_back(node.left);
+               stack.push_back(node.right);
+            }
+         }
+      }
+
+      void freeInnerNodes(int index)
+      {
+         std::vector<int> stack(1, index);
+         while(!stack.empty())
+         {
+            int current = stack.back();
+            stack.pop_back();
+            if(nodes[current].isLeaf()) continue;
+
+            stack.push_back(nodes[current].left);
+            stack.push_back(nodes[current].right);
+            freeNode(current);
+         }
+      }
+
+      // Returns the nodes of the subtree
+      template <typename F>
+      size_t visitLeaves(int index, F& visit) const
+      {
+         std::vector<int> stack(1, index);
+         size_t visited = 0;
+         while(!stack.empty())
+         {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            visited++;
+
+            if(node.isLeaf())
+            {
+               visit(node.userData);
+            }
+            else
+            {
+               stack.push_back(node.left);
+               stack.push_back(node.right);
+            }
+         }
+         return visited;
+      }
+
+      // Tests the box against the planes in the mask, returns false if it is outside of any of them,
+      // and removes from the mask the planes the box is entirely inside of
+      static bool classify(const Frustum& frustum, const BoundingBox& box, unsigned& planes)
+      {
+         for (int i = 0; i < Frustum::PLANE_COUNT; i++)
+         {
+            if(!(planes & (1u << i))) continue;
+
+            const glm::vec4& plane = frustum.planes[i];
+            glm::vec3 normal(plane);
+
+            // the corners of the box furthest along the normal and against it
+            glm::vec3 positive(plane.x >= 0.0f ? box.maxCorner.x : box.minCorner.x,
+                               plane.y >= 0.0f ? box.maxCorner.y : box.minCorner.y,
+                               plane.z >= 0.0f ? box.maxCorner.z : box.minCorner.z);
+            glm::vec3 negative(plane.x >= 0.0f ? box.minCorner.x : box.maxCorner.x,
+                               plane.y >= 0.0f ? box.minCorner.y : box.maxCorner.y,
+                               plane.z >= 0.0f ? box.minCorner.z : box.maxCorner.z);
+
+            if(glm::dot(normal, positive) + plane.w < 0.0f) return false;
+            if(glm::dot(normal, negative) + plane.w >= 0.0f) planes &= ~(1u << i);
+         }
+         return true;
+      }
+
+      // Slab test: entry distance of the ray in the box, if it enters before maxDistance
+      static bool intersectRay(const glm::vec3& origin, const glm::vec3& inverseDirection, const BoundingBox& box, float maxDistance, float& distance)
+      {
+         float entry = 0.0f, exit = maxDistance;
+         for (int axis = 0; axis < 3; axis++)
+         {
+            float t0 = (box.minCorner[axis] - origin[axis]) * inverseDirection[axis];
+            float t1 = (box.maxCorner[axis] - origin[axis]) * inverseDirection[axis];
+            if(t0 > t1) std::swap(t0, t1);
+
+            entry = std::max(entry, t0);
+            exit  = std::min(exit, t1);
+            if(entry > exit) return false;
+         }
+         distance = entry;
+         return true;
+      }
+
+      static bool overlaps(const BoundingBox& a, const BoundingBox& b)
+      {
+         return a.minCorner.x <= b.maxCorner.x && a.maxCorner.x >= b.minCorner.x
+             && a.minCorner.y <= b.maxCorner.y && a.maxCorner.y >= b.minCorner.y
+             && a.minCorner.z <= b.maxCorner.z && a.maxCorner.z >= b.minCorner.z;
+      }
+
+      static glm::vec3 centroid(const BoundingBox& box) { return (box.minCorner + box.maxCorner) * 0.5f; }
+
+      static float surfaceArea(const BoundingBox& box)
+      {
+         glm::vec3 size = box.maxCorner - box.minCorner;
+         return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+      }
+};
@@ -79,6 +79,12 @@ class Camera
          return pos;
       }
 
+      // Direction the camera is looking at, e.g. to pick what is at the center of the screen
+      glm::vec3 direction()
+      {
+         return front;
+      }
+
    private:
       void updateCameraVectors()
       {
@@ -0,0 +1,175 @@
+#pragma once
+/*
+   DeferredRenderer class
+   - G-buffer of view space normal and illumination model (RGBA16F), material parameters (RGBA16F) and depth
+   - geometry pass: the scene is drawn in the G-buffer with gbuffer.frag, with the usual programs, materials and subroutines
+   - lighting pass: a fullscreen triangle lights each covered pixel once, with all the lights (deferred_lighting.frag),
+     so the cost does not grow with overdraw, and each light costs a loop iteration per pixel instead of per fragment.
+     Lights with a radius add nothing outside of it, but still cost their iteration everywhere: drawing a volume per
+     light would save that, the clustered forward path (LightClusters) already does it for many small lights
+   - the lighting pass writes the depth of the geometry pass too, so forward passes can follow on the target framebuffer
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+
+#include <utils/shader.h>
+#include <utils/gl_state.h>
+#include <utils/metrics.h>
+#include <utils/profiler.h>
+
+// Texture units of the G-buffer during the lighting pass
+enum GBufferUnit { GBUFFER_NORMAL_MODEL_UNIT, GBUFFER_MATERIAL_UNIT, GBUFFER_DEPTH_UNIT };
+
+class DeferredRenderer
+{
+   public:
+      DeferredRenderer(GLsizei width, GLsizei height) : frameWidth(0), frameHeight(0), FBO(0), normalModelTexture(0),
+                                                        materialTexture(0), depthTexture(0), emptyVAO(0)
+      {
+         // the fullscreen triangle is built from gl_VertexID, but the core profile draws only with a VAO bound
+         glGenVertexArrays(1, &emptyVAO);
+         resize(width, height);
+      }
+
+      DeferredRenderer(const DeferredRenderer& copy) = delete;
+      DeferredRenderer& operator=(const DeferredRenderer& copy) = delete;
+
+      ~DeferredRenderer()
+      {
+         freeGBuffer();
+         if(emptyVAO) glState().deleteVertexArray(emptyVAO);
+      }
+
+      // (Re)creates the G-buffer, to be called when the size of the target framebuffer changes.
+      // The framebuffers bound before the call are bound again at the end
+      bool resize(GLsizei width, GLsizei height)
+      {
+         if(FBO && width == frameWidth && height == frameHeight) return true;
+
+         GLint drawFramebuffer, readFramebuffer;
+         glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+         glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+
+         freeGBuffer();
+         frameWidth = width;
+         frameHeight = height;
+
+         normalModelTexture = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+         materialTexture    = createTexture(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+         depthTexture       = createTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+         glGenFramebuffers(1, &FBO);
+         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, normalModelTexture, 0);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, materialTexture, 0);
+         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+         const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+         glDrawBuffers(2, drawBuffers);
+
+         bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, (GLuint)drawFramebuffer);
+         glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)readFramebuffer);
+         if(!complete) std::cout << "G-buffer incomplete" << std::endl;
+         return complete;
+      }
+
+      // Binds and clears the G-buffer: the following draws must use programs with gbuffer.frag
+      void beginGeometryPass()
+      {
+         PROFILE_SCOPE("DeferredRenderer::beginGeometryPass");
+         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+         glViewport(0, 0, frameWidth, frameHeight);
+
+         glState().enable(GL_DEPTH_TEST);
+         glState().setDepthFunc(GL_LESS);
+         glState().setDepthMask(true);
+
+         // the clear color of the application is left alone
+         const GLfloat zero[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+         const GLfloat farDepth = 1.0f;
+         glClearBufferfv(GL_COLOR, 0, zero);
+         glClearBufferfv(GL_COLOR, 1, zero);
+         glClearBufferfv(GL_DEPTH, 0, &farDepth);
+      }
+
+      // Lights the G-buffer in targetFramebuffer (already cleared), with a program made of fullscreen.vert and
+      // deferred_lighting.frag. The pixels without geometry are left untouched
+      void lightingPass(const Shader& lightingShader, const glm::mat4& projection, GLuint targetFramebuffer = 0)
+      {
+         PROFILE_SCOPE("DeferredRenderer::lightingPass");
+         glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+         glViewport(0, 0, frameWidth, frameHeight);
+
+         lightingShader.use();
+         if(cachedSerial != lightingShader.serial())
+         {
+            cachedSerial = lightingShader.serial();
+            normalModelUniform       = lightingShader.uniform("gNormalModel");
+            materialUniform          = lightingShader.uniform("gMaterial");
+            depthUniform             = lightingShader.uniform("gDepth");
+            inverseProjectionUniform = lightingShader.uniform("inverseProjectionMatrix");
+         }
+         lightingShader.setInt(normalModelUniform, GBUFFER_NORMAL_MODEL_UNIT);
+         lightingShader.setInt(materialUniform, GBUFFER_MATERIAL_UNIT);
+         lightingShader.setInt(depthUniform, GBUFFER_DEPTH_UNIT);
+         lightingShader.setMat4(inverseProjectionUniform, glm::inverse(projection));
+
+         glState().bindTexture(GBUFFER_NORMAL_MODEL_UNIT, GL_TEXTURE_2D, normalModelTexture);
+         glState().bindTexture(GBUFFER_MATERIAL_UNIT, GL_TEXTURE_2D, materialTexture);
+         glState().bindTexture(GBUFFER_DEPTH_UNIT, GL_TEXTURE_2D, depthTexture);
+
+         // the triangle covers every pixel, the depth it writes is the one of the G-buffer (gl_FragDepth)
+         glState().setDepthFunc(GL_ALWAYS);
+         // the geometry pass may have been drawn in wireframe, the triangle must not
+         glState().setPolygonMode(GL_FILL);
+
+         glState().bindVertexArray(emptyVAO);
+         glDrawArrays(GL_TRIANGLES, 0, 3);
+         METRIC_ADD(METRIC_DRAW_CALLS, 1);
+         METRIC_ADD(METRIC_TRIANGLES, 1);
+
+         glState().setDepthFunc(GL_LESS);
+      }
+
+      GLsizei width()  const noexcept { return frameWidth; }
+      GLsizei height() const noexcept { return frameHeight; }
+      GLuint framebuffer() const noexcept { return FBO; }
+
+   private:
+      GLsizei frameWidth, frameHeight;
+      GLuint FBO, normalModelTexture, materialTexture, depthTexture;
+      GLuint emptyVAO;
+
+      // uniform handles of the last lighting program used (see Shader::serial())
+      uint32_t cachedSerial = 0;
+      UniformHandle normalModelUniform, materialUniform, depthUniform, inverseProjectionUniform;
+
+      // Read with texture() at the center of the pixels of the same size framebuffer: no filtering, no mipmaps
+      GLuint createTexture(GLenum internalFormat, GLenum format, GLenum type)
+      {
+         GLuint texture;
+         glGenTextures(1, &texture);
+         glState().bindTexture(0, GL_TEXTURE_2D, texture);
+         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, frameWidth, frameHeight, 0, format, type, NULL);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+         glState().bindTexture(0, GL_TEXTURE_2D, 0);
+         return texture;
+      }
+
+      void freeGBuffer()
+      {
+         if(!FBO) return;
+
+         glDeleteFramebuffers(1, &FBO);
+         glState().deleteTexture(normalModelTexture);
+         glState().deleteTexture(materialTexture);
+         glState().deleteTexture(depthTexture);
+         FBO = 0;
+      }
+};
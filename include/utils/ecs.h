@@ -0,0 +1,403 @@
+#pragma once
+/*
+   Entity/component storage
+   - an entity is just an id, each type of component lives in its own packed array (ComponentStore)
+   - World owns the stores of the rendering components, and runs the systems over them: each system is
+     a loop over one packed array, split over threads when it is big enough
+   - the world bounds are also kept in a BVH, for hierarchical culling and for picking with a ray
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <utils/object.h>
+#include <utils/material.h>
+#include <utils/render_queue.h>
+#include <utils/light.h>
+#include <utils/light_clusters.h>
+#include <utils/parallel.h>
+#include <utils/bvh.h>
+
+typedef uint32_t Entity;
+const Entity NO_ENTITY = 0xFFFFFFFFu;
+
+// Index of an entity without the component
+const uint32_t NO_COMPONENT = 0xFFFFFFFFu;
+
+// Contiguous range of components, valid until a component is added to or removed from the store
+template <typename T>
+struct Span
+{
+   T* first;
+   size_t count;
+
+   T* begin() const noexcept { return first; }
+   T* end()   const noexcept { return first + count; }
+   size_t size() const noexcept { return count; }
+   T& operator[](size_t i) const { return first[i]; }
+};
+
+// Sparse set: the components are packed in a dense array, and a sparse array maps each entity to its component
+template <typename T>
+class ComponentStore
+{
+   public:
+      // Adds the component to the entity, or replaces the one it has
+      T& add(Entity entity, const T& component)
+      {
+         if(entity >= sparse.size()) sparse.resize(entity + 1, NO_COMPONENT);
+         if(sparse[entity] != NO_COMPONENT) return dense[sparse[entity]] = component;
+
+         sparse[entity] = (uint32_t)dense.size();
+         dense.push_back(component);
+         owners.push_back(entity);
+         return dense.back();
+      }
+
+      // The last component fills the hole, so the array stays packed (but its order changes)
+      void remove(Entity entity)
+      {
+         uint32_t index = indexOf(entity);
+         if(index == NO_COMPONENT) return;
+
+         Entity last = owners.back();
+         dense[index]  = dense.back();
+         owners[index] = last;
+         sparse[last]  = index;
+
+         dense.pop_back();
+         owners.pop_back();
+         sparse[entity] = NO_COMPONENT;
+      }
+
+      uint32_t indexOf(Entity entity) const noexcept { return entity < sparse.size() ? sparse[entity] : NO_COMPONENT; }
+      bool has(Entity entity) const noexcept { return indexOf(entity) != NO_COMPONENT; }
+
+      // The entity must have the component
+      T&       get(Entity entity)       { return dense[sparse[entity]]; }
+      const T& get(Entity entity) const { return dense[sparse[entity]]; }
+
+      // nullptr if the entity has no component
+      T*       find(Entity entity)       { uint32_t index = indexOf(entity); return index != NO_COMPONENT ? &dense[index] : nullptr; }
+      const T* find(Entity entity) const { uint32_t index = indexOf(entity); return index != NO_COMPONENT ? &dense[index] : nullptr; }
+
+      Span<T>       span()       { return Span<T>{dense.data(), dense.size()}; }
+      Span<const T> span() const { return Span<const T>{dense.data(), dense.size()}; }
+
+      // Owner of each component of span()
+      const std::vector<Entity>& entities() const noexcept { return owners; }
+      size_t size() const noexcept { return dense.size(); }
+
+      void clear() { dense.clear(); owners.clear(); sparse.clear(); }
+
+   private:
+      std::vector<T> dense;
+      std::vector<Entity> owners;
+      std::vector<uint32_t> sparse;
+};
+
+// World space matrices: the ones of node after every World::syncTransforms(), if the entity follows a scene node
+struct Transform
+{
+   glm::mat4 world  = glm::mat4(1.0f);
+   glm::mat3 normal = glm::mat3(1.0f); // inverse transpose of world, brings normals in world space
+   SceneNode node   = NO_NODE;
+};
+
+struct Renderable
+{
+   const Model*    model;
+   const Material* material;   // nullptr to keep the values already set on the shader
+   const Shader*   shader;
+   GLuint          subroutine; // of the fragment stage, GL_INVALID_INDEX to keep the one selected on the shader
+   uint32_t        lod;        // chosen by World::selectLods()
+};
+
+// Bounding sphere in model space and in world space, the latter updated by World::updateBounds().
+// With a source model the model space sphere is read from it, as models loaded in background have no bounds
+// until they are ready
+struct Bounds
+{
+   BoundingSphere local;
+   BoundingSphere world;
+   const Model*   source;
+   int            bvhNode = BVH::NULL_NODE; // leaf of the world BVH, inserted by World::updateBounds()
+};
+
+enum LightType { POINT_LIGHT, DIRECTIONAL_LIGHT, SPOT_LIGHT };
+
+// Position and direction are in world space, or relative to the Transform of the entity if it has one
+struct LightSource
+{
+   LightType       type;
+   LightAttributes attrs;
+   glm::vec3       position;
+   glm::vec3       direction;
+   float           cutoffAngle;
+   float           radius = 0.0f; // the light fades to nothing at this distance, 0 reaches everything
+};
+
+class World
+{
+   public:
+      ComponentStore<Transform>   transforms;
+      ComponentStore<Renderable>  renderables;
+      ComponentStore<Bounds>      bounds;
+      ComponentStore<LightSource> lights;
+
+      // Ids of destroyed entities are reused
+      Entity create()
+      {
+         Entity entity;
+         if(!freeEntities.empty())
+         {
+            entity = freeEntities.back();
+            freeEntities.pop_back();
+         }
+         else
+         {
+            entity = entityCount++;
+            alive.push_back(false);
+         }
+         alive[entity] = true;
+         return entity;
+      }
+
+      bool isAlive(Entity entity) const { return entity < alive.size() && alive[entity]; }
+
+      // Destroying an entity twice does nothing, its id must not be reused twice
+      void destroy(Entity entity)
+      {
+         if(!isAlive(entity)) return;
+         alive[entity] = false;
+
+         // bounds must be removed through destroy(), which takes them out of the BVH too
+         const Bounds* bound = bounds.find(entity);
+         if(bound && bound->bvhNode != BVH::NULL_NODE) bvh.remove(bound->bvhNode);
+
+         transforms.remove(entity);
+         renderables.remove(entity);
+         bounds.remove(entity);
+         lights.remove(entity);
+         freeEntities.push_back(entity);
+      }
+
+      size_t size() const noexcept { return entityCount - freeEntities.size(); }
+
+      // Entity with all the components needed to be culled and drawn, following a scene node
+      Entity createRenderable(const Model& model, const Material& material, const Shader& shader, SceneNode node,
+                              GLuint subroutine = GL_INVALID_INDEX)
+      {
+         Entity entity = create();
+
+         Transform transform;
+         transform.node = node;
+         transforms.add(entity, transform);
+         renderables.add(entity, Renderable{&model, &material, &shader, subroutine, 0});
+         bounds.add(entity, Bounds{BoundingSphere{glm::vec3(0.0f), 0.0f}, BoundingSphere{glm::vec3(0.0f), 0.0f}, &model});
+         return entity;
+      }
+
+      // Fixed world matrix, for the entities not following a scene node
+      void setTransform(Entity entity, const glm::mat4& world)
+      {
+         Transform transform;
+         transform.world  = world;
+         transform.normal = glm::inverseTranspose(glm::mat3(world));
+         transforms.add(entity, transform);
+      }
+
+      /////////////////// SYSTEMS ////////////////////////////////////////////////
+      // Copies the matrices of the scene nodes (after scene.update()) in the transforms following them
+      void syncTransforms(const SceneGraph& scene)
+      {
+         Span<Transform> transformSpan = transforms.span();
+         parallelFor(transformSpan.size(), [&](size_t begin, size_t end)
+         {
+            for (size_t i = begin; i < end; i++)
+            {
+               Transform& transform = transformSpan[i];
+               if(transform.node == NO_NODE) continue;
+
+               transform.world  = scene.world(transform.node);
+               transform.normal = scene.normalMatrix(transform.node);
+            }
+         }, 1 << 14);
+      }
+
+      // World space bounds, after syncTransforms()
+      void updateBounds()
+      {
+         Span<Bounds> boundsSpan = bounds.span();
+         const std::vector<Entity>& owners = bounds.entities();
+         parallelFor(boundsSpan.size(), [&](size_t begin, size_t end)
+         {
+            for (size_t i = begin; i < end; i++)
+            {
+               Bounds& bound = boundsSpan[i];
+               if(bound.source && bound.source->isReady()) bound.local = bound.source->boundingSphere();
+
+               const Transform* transform = transforms.find(owners[i]);
+               bound.world = transform ? transformSphere(bound.local, transform->world) : bound.local;
+            }
+         }, 1 << 14);
+
+         // the new bounds go in the BVH, the others are moved in place and the tree is refit once
+         for (size_t i = 0; i < boundsSpan.size(); i++)
+         {
+            Bounds& bound = boundsSpan[i];
+            BoundingBox box = sphereBox(bound.world);
+            if(bound.bvhNode == BVH::NULL_NODE) bound.bvhNode = bvh.insert(box, owners[i]);
+            else                                bvh.setBox(bound.bvhNode, box);
+         }
+         bvh.refit();
+      }
+
+      // Level of detail of every renderable with bounds, from its size on screen (see lodFromScreenSize)
+      void selectLods(const glm::mat4& view, const glm::mat4& projection, float lodScreenSize = 0.5f)
+      {
+         Span<Renderable> renderableSpan = renderables.span();
+         const std::vector<Entity>& owners = renderables.entities();
+         parallelFor(renderableSpan.size(), [&](size_t begin, size_t end)
+         {
+            for (size_t i = begin; i < end; i++)
+            {
+               Renderable& renderable = renderableSpan[i];
+               const Bounds* bound = bounds.find(owners[i]);
+               renderable.lod = bound ? (uint32_t)lodFromScreenSize(bound->world, view, projection, renderable.model->lodCount(), lodScreenSize) : 0;
+            }
+         }, 1 << 14);
+      }
+
+      // Fills visible with the entities whose world bounds intersect the frustum, after updateBounds().
+      // Renderables without bounds are always visible
+      CullStats cull(const Frustum& frustum, std::vector<Entity>& visible)
+      {
+         Span<Bounds> boundsSpan = bounds.span();
+         culler.clear();
+         for (size_t i = 0; i < boundsSpan.size(); i++) { culler.add(boundsSpan[i].world); }
+
+         CullStats stats = culler.cull(frustum, visibleIndices);
+
+         visible.clear();
+         const std::vector<Entity>& boundsOwners = bounds.entities();
+         for (uint32_t index : visibleIndices) { visible.push_back(boundsOwners[index]); }
+
+         const std::vector<Entity>& renderableOwners = renderables.entities();
+         for (Entity entity : renderableOwners)
+         {
+            if(!bounds.has(entity)) visible.push_back(entity);
+         }
+         return stats;
+      }
+
+      // As cull(), but with the BVH of the world bounds: the subtrees entirely inside the frustum are not tested any further,
+      // the ones entirely outside are skipped at once. The bounds are tested as boxes, so a few more entities may pass
+      CullStats cullHierarchical(const Frustum& frustum, std::vector<Entity>& visible) const
+      {
+         visible.clear();
+         CullStats stats;
+         stats.tested  = bvh.query(frustum, [&](uint32_t entity) { visible.push_back(entity); });
+         stats.visible = visible.size();
+
+         for (Entity entity : renderables.entities())
+         {
+            if(!bounds.has(entity)) visible.push_back(entity);
+         }
+         return stats;
+      }
+
+      // Nearest entity whose world bounds are hit by the ray origin + t * direction (t >= 0), after updateBounds():
+      // with camera.position() and camera.direction() it is what is at the center of the screen
+      bool pick(const glm::vec3& origin, const glm::vec3& direction, Entity& entity, float& distance) const
+      {
+         RayHit hit;
+         if(!bvh.raycast(origin, direction, hit)) return false;
+
+         entity   = hit.userData;
+         distance = hit.distance;
+         return true;
+      }
+
+      // Submits the visible entities with a Renderable and a Transform to the queue, which sorts them by render state
+      void submit(const std::vector<Entity>& visible, RenderQueue& queue) const
+      {
+         for (Entity entity : visible)
+         {
+            const Renderable* renderable = renderables.find(entity);
+            const Transform* transform = transforms.find(entity);
+            if(!renderable || !transform) continue;
+
+            queue.submit(*renderable->model, *renderable->shader, renderable->material, renderable->subroutine,
+                         transform->world, transform->normal, renderable->lod);
+         }
+      }
+
+      // Packs the light sources in the LightManager, up to its capacity for each type
+      void gatherLights(LightManager& manager)
+      {
+         collectLights();
+
+         manager.setPointLights(pointLights);
+         manager.setDirectionalLights(directionalLights);
+         manager.setSpotLights(spotLights);
+      }
+
+      // Gives the point and spot light sources to the clusters (the directional ones still go in the LightManager)
+      void gatherLights(LightClusters& clusters)
+      {
+         collectLights();
+
+         clusters.setPointLights(pointLights);
+         clusters.setSpotLights(spotLights);
+      }
+
+   private:
+      Entity entityCount = 0;
+      std::vector<Entity> freeEntities;
+      std::vector<bool> alive;
+
+      BVH bvh;
+
+      // scratch buffers of the systems, kept to avoid reallocating them every frame
+      SphereCuller culler;
+      std::vector<uint32_t> visibleIndices;
+      std::vector<PointLight> pointLights;
+      std::vector<DirectionalLight> directionalLights;
+      std::vector<SpotLight> spotLights;
+
+      // Light sources in world space
+      void collectLights()
+      {
+         pointLights.clear();
+         directionalLights.clear();
+         spotLights.clear();
+
+         Span<LightSource> lightSpan = lights.span();
+         const std::vector<Entity>& owners = lights.entities();
+         for (size_t i = 0; i < lightSpan.size(); i++)
+         {
+            const LightSource& light = lightSpan[i];
+            LightAttributes attrs = light.attrs;
+
+            glm::vec3 position = light.position, direction = light.direction;
+            const Transform* transform = transforms.find(owners[i]);
+            if(transform)
+            {
+               position  = glm::vec3(transform->world * glm::vec4(light.position, 1.0f));
+               direction = glm::normalize(glm::mat3(transform->world) * light.direction);
+            }
+
+            switch(light.type)
+            {
+               case POINT_LIGHT:       pointLights.emplace_back(position, attrs, light.radius);                              break;
+               case DIRECTIONAL_LIGHT: directionalLights.emplace_back(direction, attrs);                                     break;
+               case SPOT_LIGHT:        spotLights.emplace_back(position, direction, light.cutoffAngle, attrs, light.radius); break;
+            }
+         }
+      }
+};
@@ -0,0 +1,193 @@
+#pragma once
+/*
+   FileWatcher class
+   - a background thread reports the watched files that changed on disk, in batches
+   - on Linux the directories of the files are watched with inotify (editors often save by replacing the file,
+     so watching the file itself would lose it after the first save), elsewhere the modification times are polled
+*/
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+   #include <sys/inotify.h>
+   #include <poll.h>
+   #include <unistd.h>
+#endif
+
+class FileWatcher
+{
+   public:
+      // Called by the watcher thread with the paths (as passed to add()) changed since the last call
+      typedef std::function<void(const std::vector<std::string>&)> Callback;
+
+      // Changes closer than settleMs are reported together, as an editor can write a file in several steps
+      FileWatcher(Callback onChange, unsigned pollMs = 250, unsigned settleMs = 50) :
+         onChange(onChange), pollMs(pollMs), settleMs(settleMs), stopping(false)
+      {
+#ifdef __linux__
+         inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+         watcher = std::thread(&FileWatcher::watchLoop, this);
+      }
+
+      FileWatcher(const FileWatcher& copy) = delete;
+      FileWatcher& operator=(const FileWatcher& copy) = delete;
+
+      ~FileWatcher()
+      {
+         {
+            std::lock_guard<std::mutex> lock(filesMutex);
+            stopping = true;
+         }
+         wakeUp.notify_all();
+         watcher.join();
+#ifdef __linux__
+         if(inotifyFd != -1) close(inotifyFd);
+#endif
+      }
+
+      // Can be called by any thread, adding a file twice has no effect
+      void add(const std::string& path)
+      {
+         std::lock_guard<std::mutex> lock(filesMutex);
+         if(stamps.count(path)) return;
+         stamps[path] = stamp(path);
+
+#ifdef __linux__
+         size_t slash = path.find_last_of('/');
+         std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+         std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+         if(inotifyFd != -1)
+         {
+            int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if(wd != -1) watchedNames[wd][name] = path;
+         }
+#endif
+      }
+
+   private:
+      Callback onChange;
+      unsigned pollMs, settleMs;
+
+      std::thread watcher;
+      std::mutex filesMutex;
+      std::condition_variable wakeUp;
+      bool stopping;
+
+      // The stat times have a resolution of one second on some systems, the size catches most of the saves within it
+      struct FileStamp
+      {
+         time_t time;
+         off_t  size;
+
+         bool operator==(const FileStamp& other) const { return time == other.time && size == other.size; }
+      };
+
+      // path -> last stamp seen, used by the polling
+      std::map<std::string, FileStamp> stamps;
+
+#ifdef __linux__
+      int inotifyFd;
+      // watch descriptor of a directory -> name in the directory -> watched path
+      std::map<int, std::map<std::string, std::string>> watchedNames;
+#endif
+
+      void watchLoop()
+      {
+         std::set<std::string> changed;
+         auto firstChange = std::chrono::steady_clock::now();
+
+         while(true)
+         {
+            size_t before = changed.size();
+            if(!waitForChanges(changed)) return;
+            if(changed.empty()) continue;
+
+            // the batch is reported once the files stop changing for settleMs
+            auto now = std::chrono::steady_clock::now();
+            if(changed.size() != before) firstChange = now;
+            if(now - firstChange < std::chrono::milliseconds(settleMs)) continue;
+
+            onChange(std::vector<std::string>(changed.begin(), changed.end()));
+            changed.clear();
+         }
+      }
+
+      // Adds to changed the files changed within the next poll interval (or settle interval, if a batch is open),
+      // returns false when the watcher is stopping
+      bool waitForChanges(std::set<std::string>& changed)
+      {
+         unsigned waitMs = changed.empty() ? pollMs : settleMs;
+
+#ifdef __linux__
+         if(inotifyFd != -1)
+         {
+            pollfd descriptor = { inotifyFd, POLLIN, 0 };
+            int ready = poll(&descriptor, 1, (int)waitMs);
+
+            std::lock_guard<std::mutex> lock(filesMutex);
+            if(stopping) return false;
+            if(ready > 0) readEvents(changed);
+            return true;
+         }
+#endif
+
+         std::unique_lock<std::mutex> lock(filesMutex);
+         wakeUp.wait_for(lock, std::chrono::milliseconds(waitMs), [this]() { return stopping; });
+         if(stopping) return false;
+
+         for (auto& file : stamps)
+         {
+            FileStamp current = stamp(file.first);
+            if(current == file.second) continue;
+
+            file.second = current;
+            changed.insert(file.first);
+         }
+         return true;
+      }
+
+#ifdef __linux__
+      // Must be called with filesMutex locked
+      void readEvents(std::set<std::string>& changed)
+      {
+         alignas(inotify_event) char buffer[4096];
+         ssize_t length;
+         while((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+         {
+            for (char* event = buffer; event < buffer + length; )
+            {
+               const inotify_event* notification = reinterpret_cast<const inotify_event*>(event);
+               event += sizeof(inotify_event) + notification->len;
+               if(notification->len == 0) continue;
+
+               auto directory = watchedNames.find(notification->wd);
+               if(directory == watchedNames.end()) continue;
+
+               auto file = directory->second.find(notification->name);
+               if(file != directory->second.end()) changed.insert(file->second);
+            }
+         }
+      }
+#endif
+
+      static FileStamp stamp(const std::string& path)
+      {
+         struct stat info;
+         if(stat(path.c_str(), &info) != 0) return FileStamp{0, 0};
+         return FileStamp{info.st_mtime, info.st_size};
+      }
+};
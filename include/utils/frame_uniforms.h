@@ -0,0 +1,43 @@
+#pragma once
+
+#include <utils/uniform_buffer.h>
+
+#include <glm/glm.hpp>
+
+// CPU mirror of the std140 FrameUniforms block in shaders/uniform_blocks.utils
+struct FrameUniformsStd140
+{
+   glm::mat4 viewMatrix;
+   glm::mat4 projectionMatrix;
+   glm::mat4 viewProjectionMatrix;
+   glm::vec3 cameraPosition; float time;
+   float deltaTime;          float pad0[3];
+};
+
+static_assert(sizeof(FrameUniformsStd140) == 224, "FrameUniforms std140 layout mismatch");
+
+// Per-frame camera and time values, written once per frame and read by every program
+// including uniform_blocks.utils, instead of setting the matrices on each program
+class FrameUniforms
+{
+   public:
+      FrameUniforms() : data{}, ubo(sizeof(FrameUniformsStd140), FRAME_UNIFORMS_BINDING) {}
+
+      void update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, float time, float deltaTime)
+      {
+         data.viewMatrix           = view;
+         data.projectionMatrix     = projection;
+         data.viewProjectionMatrix = projection * view;
+         data.cameraPosition       = cameraPosition;
+         data.time                 = time;
+         data.deltaTime            = deltaTime;
+
+         ubo.orphanAndUpdate(&data);
+      }
+
+      const FrameUniformsStd140& values() const noexcept { return data; }
+
+   private:
+      FrameUniformsStd140 data;
+      UniformBuffer ubo;
+};
@@ -0,0 +1,224 @@
+#pragma once
+/*
+   Frustum culling
+   - Frustum: the 6 planes of a view volume, extracted from a projection * view matrix
+   - SphereCuller: bounding spheres stored as a structure of arrays and tested 8 (AVX) or 4 (SSE) at a time
+*/
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#if defined(__AVX__)
+   #define FRUSTUM_CULL_AVX
+   #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #define FRUSTUM_CULL_SSE
+   #include <emmintrin.h>
+#endif
+
+#include <utils/mesh.h>
+
+// Box containing the given one after a transformation (Arvo's method)
+inline BoundingBox transformBox(const BoundingBox& box, const glm::mat4& transform)
+{
+   glm::vec3 minCorner(transform[3]), maxCorner(transform[3]);
+   for (int column = 0; column < 3; column++)
+   {
+      for (int row = 0; row < 3; row++)
+      {
+         float a = transform[column][row] * box.minCorner[column];
+         float b = transform[column][row] * box.maxCorner[column];
+         minCorner[row] += std::min(a, b);
+         maxCorner[row] += std::max(a, b);
+      }
+   }
+   return BoundingBox{minCorner, maxCorner};
+}
+
+// Sphere containing the given one after a transformation: with a non uniform scale, the radius grows
+// as much as the most scaled axis
+inline BoundingSphere transformSphere(const BoundingSphere& sphere, const glm::mat4& transform)
+{
+   float scale = std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+   return BoundingSphere{glm::vec3(transform * glm::vec4(sphere.center, 1.0f)), sphere.radius * scale};
+}
+
+class Frustum
+{
+   public:
+      enum Plane { LEFT, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+
+      // (a, b, c, d) with ax + by + cz + d >= 0 inside, and (a, b, c) of unit length
+      glm::vec4 planes[PLANE_COUNT];
+
+      Frustum() = default;
+
+      // Gribb and Hartmann's method: with viewProjection = projection * view the planes are in world space,
+      // with projection * view * model they would be in model space
+      explicit Frustum(const glm::mat4& viewProjection)
+      {
+         // glm is column major, so row i is made of the i-th component of every column
+         glm::vec4 rows[4];
+         for (int i = 0; i < 4; i++)
+         {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+         }
+
+         planes[LEFT]       = rows[3] + rows[0];
+         planes[RIGHT]      = rows[3] - rows[0];
+         planes[BOTTOM]     = rows[3] + rows[1];
+         planes[TOP]        = rows[3] - rows[1];
+         planes[NEAR_PLANE] = rows[3] + rows[2];
+         planes[FAR_PLANE]  = rows[3] - rows[2];
+
+         for (int i = 0; i < PLANE_COUNT; i++)
+         {
+            planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+         }
+      }
+
+      bool intersects(const BoundingSphere& sphere) const noexcept
+      {
+         for (int i = 0; i < PLANE_COUNT; i++)
+         {
+            if(glm::dot(glm::vec3(planes[i]), sphere.center) + planes[i].w < -sphere.radius) return false;
+         }
+         return true;
+      }
+
+      // Conservative: a box near a corner of the frustum may be reported as intersecting it
+      bool intersects(const BoundingBox& box) const noexcept
+      {
+         for (int i = 0; i < PLANE_COUNT; i++)
+         {
+            // the corner of the box furthest along the normal of the plane
+            glm::vec3 corner(planes[i].x >= 0.0f ? box.maxCorner.x : box.minCorner.x,
+                             planes[i].y >= 0.0f ? box.maxCorner.y : box.minCorner.y,
+                             planes[i].z >= 0.0f ? box.maxCorner.z : box.minCorner.z);
+            if(glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f) return false;
+         }
+         return true;
+      }
+};
+
+// Counters of the last culling pass
+struct CullStats
+{
+   size_t tested  = 0; // spheres, or nodes and leaves visited in the BVH for World::cullHierarchical
+   size_t visible = 0;
+};
+
+class SphereCuller
+{
+   public:
+      // Adds a sphere and returns its index
+      size_t add(const BoundingSphere& sphere)
+      {
+         x.push_back(sphere.center.x);
+         y.push_back(sphere.center.y);
+         z.push_back(sphere.center.z);
+         r.push_back(sphere.radius);
+         return r.size() - 1;
+      }
+
+      void set(size_t index, const BoundingSphere& sphere)
+      {
+         x[index] = sphere.center.x;
+         y[index] = sphere.center.y;
+         z[index] = sphere.center.z;
+         r[index] = sphere.radius;
+      }
+
+      void clear()                 { x.clear(); y.clear(); z.clear(); r.clear(); }
+      size_t size() const noexcept { return r.size(); }
+
+      // Fills visible with the indices of the spheres intersecting the frustum, in increasing order
+      CullStats cull(const Frustum& frustum, std::vector<uint32_t>& visible) const
+      {
+         visible.clear();
+         size_t count = r.size(), i = 0;
+
+      #if defined(FRUSTUM_CULL_AVX)
+         __m256 planeX[Frustum::PLANE_COUNT], planeY[Frustum::PLANE_COUNT], planeZ[Frustum::PLANE_COUNT], planeW[Frustum::PLANE_COUNT];
+         for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+         {
+            planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+         }
+
+         for (; i + 8 <= count; i += 8)
+         {
+            __m256 cx = _mm256_loadu_ps(&x[i]), cy = _mm256_loadu_ps(&y[i]), cz = _mm256_loadu_ps(&z[i]);
+            __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&r[i]));
+
+            // a sphere is inside as long as its center is not further than its radius behind any plane
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+            {
+               __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, planeX[p]), _mm256_mul_ps(cy, planeY[p])),
+                                               _mm256_add_ps(_mm256_mul_ps(cz, planeZ[p]), planeW[p]));
+               inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+            }
+
+            appendMask(visible, i, _mm256_movemask_ps(inside));
+         }
+      #elif defined(FRUSTUM_CULL_SSE)
+         __m128 planeX[Frustum::PLANE_COUNT], planeY[Frustum::PLANE_COUNT], planeZ[Frustum::PLANE_COUNT], planeW[Frustum::PLANE_COUNT];
+         for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+         {
+            planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+            planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+            planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+            planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+         }
+
+         for (; i + 4 <= count; i += 4)
+         {
+            __m128 cx = _mm_loadu_ps(&x[i]), cy = _mm_loadu_ps(&y[i]), cz = _mm_loadu_ps(&z[i]);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&r[i]));
+
+            // a sphere is inside as long as its center is not further than its radius behind any plane
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < Frustum::PLANE_COUNT; p++)
+            {
+               __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, planeX[p]), _mm_mul_ps(cy, planeY[p])),
+                                            _mm_add_ps(_mm_mul_ps(cz, planeZ[p]), planeW[p]));
+               inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+
+            appendMask(visible, i, _mm_movemask_ps(inside));
+         }
+      #endif
+
+         // what is left of the last block (or everything, without SIMD)
+         for (; i < count; i++)
+         {
+            if(frustum.intersects(BoundingSphere{glm::vec3(x[i], y[i], z[i]), r[i]})) visible.push_back((uint32_t)i);
+         }
+
+         CullStats stats;
+         stats.tested  = count;
+         stats.visible = visible.size();
+         return stats;
+      }
+
+   private:
+      std::vector<float> x, y, z, r;
+
+      // Appends the indices of the bits set in mask, bit k being sphere first + k
+      static void appendMask(std::vector<uint32_t>& visible, size_t first, int mask)
+      {
+         while(mask)
+         {
+            int bit = 0;
+            while(!(mask & (1 << bit))) bit++;
+            visible.push_back((uint32_t)(first + bit));
+            mask &= mask - 1;
+         }
+      }
+};
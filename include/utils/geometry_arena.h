@@ -0,0 +1,354 @@
+#pragma once
+/*
+   GeometryArena class
+   - one shared VBO + EBO sub-allocated per mesh, with a single VAO for the Vertex layout
+   - a render pass is drawn with one glMultiDrawElementsIndirect call
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <vector>
+#include <map>
+#include <iterator>
+#include <algorithm>
+#include <iostream>
+
+#include <utils/mesh.h>
+#include <utils/model.h>
+#include <utils/shader.h>
+
+// Layout of a command in GL_DRAW_INDIRECT_BUFFER, as defined by the GL specification
+struct DrawElementsIndirectCommand
+{
+   GLuint count;
+   GLuint instanceCount;
+   GLuint firstIndex;
+   GLint  baseVertex;
+   GLuint baseInstance;
+};
+
+// First-fit allocator of [offset, offset + size) ranges inside [0, capacity).
+// Freed ranges are kept ordered by offset, so that neighbours are merged back together
+class RangeAllocator
+{
+   public:
+      static const size_t INVALID_OFFSET = (size_t)-1;
+
+      RangeAllocator(size_t capacity = 0) : totalCapacity(0) { grow(capacity); }
+
+      // Returns the offset of the allocated range, or INVALID_OFFSET if no free range is big enough
+      size_t allocate(size_t size)
+      {
+         if(size == 0) return INVALID_OFFSET;
+
+         for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it)
+         {
+            if(it->second < size) continue;
+
+            size_t offset = it->first, remaining = it->second - size;
+            freeRanges.erase(it);
+            if(remaining) freeRanges[offset + size] = remaining;
+            return offset;
+         }
+         return INVALID_OFFSET;
+      }
+
+      void free(size_t offset, size_t size)
+      {
+         if(size == 0) return;
+
+         auto next = freeRanges.lower_bound(offset);
+
+         // merge with the following free range
+         if(next != freeRanges.end() && offset + size == next->first)
+         {
+            size += next->second;
+            next = freeRanges.erase(next);
+         }
+         // merge with the preceding free range
+         if(next != freeRanges.begin())
+         {
+            auto prev = std::prev(next);
+            if(prev->first + prev->second == offset)
+            {
+               prev->second += size;
+               return;
+            }
+         }
+         freeRanges[offset] = size;
+      }
+
+      // Extends the managed space, the new tail is free
+      void grow(size_t newCapacity)
+      {
+         if(newCapacity <= totalCapacity) return;
+
+         size_t oldCapacity = totalCapacity;
+         totalCapacity = newCapacity;
+         free(oldCapacity, newCapacity - oldCapacity);
+      }
+
+      size_t capacity() const noexcept { return totalCapacity; }
+
+   private:
+      std::map<size_t, size_t> freeRanges; // offset -> size
+      size_t totalCapacity;
+};
+
+// Position of a mesh inside the arena buffers
+struct ArenaMesh
+{
+   GLint  baseVertex  = -1;
+   GLuint vertexCount = 0;
+   GLuint firstIndex  = 0;
+   GLuint indexCount  = 0;
+
+   bool valid() const noexcept { return baseVertex != -1; }
+};
+
+class GeometryArena
+{
+   public:
+      GLuint VAO;
+
+      GeometryArena(size_t vertexCapacity = 1 << 18, size_t indexCapacity = 1 << 20) :
+         VBO(0), EBO(0), instanceVBO(0), commandBuffer(0),
+         vertexAllocator(0), indexAllocator(0), instanceCapacity(0), commandCapacity(0)
+      {
+         glGenVertexArrays(1, &VAO);
+         glGenBuffers(1, &instanceVBO);
+         glGenBuffers(1, &commandBuffer);
+
+         resize(vertexCapacity, indexCapacity);
+
+         glState().bindVertexArray(VAO);
+         glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+         setupInstanceAttributes();
+         glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+         glState().bindVertexArray(0);
+      }
+
+      GeometryArena(const GeometryArena& copy) = delete;
+      GeometryArena& operator=(const GeometryArena& copy) = delete;
+
+      ~GeometryArena() noexcept
+      {
+         glState().deleteVertexArray(VAO);
+         glState().deleteBuffer(VBO);
+         glState().deleteBuffer(EBO);
+         glState().deleteBuffer(instanceVBO);
+         glState().deleteBuffer(commandBuffer);
+      }
+
+      // Copies the mesh geometry in the shared buffers, growing them if there is no free range big enough
+      ArenaMesh add(const Mesh& mesh)
+      {
+         ArenaMesh handle;
+         if(mesh.vertices.empty() || mesh.indices.empty()) return handle;
+
+         size_t baseVertex = vertexAllocator.allocate(mesh.vertices.size());
+         size_t firstIndex = indexAllocator.allocate(mesh.indices.size());
+         if(baseVertex == RangeAllocator::INVALID_OFFSET || firstIndex == RangeAllocator::INVALID_OFFSET)
+         {
+            if(baseVertex != RangeAllocator::INVALID_OFFSET) vertexAllocator.free(baseVertex, mesh.vertices.size());
+            if(firstIndex != RangeAllocator::INVALID_OFFSET) indexAllocator.free(firstIndex, mesh.indices.size());
+
+            resize(std::max(vertexAllocator.capacity() * 2, vertexAllocator.capacity() + mesh.vertices.size()),
+                   std::max(indexAllocator.capacity()  * 2, indexAllocator.capacity()  + mesh.indices.size()));
+            return add(mesh);
+         }
+
+         handle.baseVertex  = (GLint)baseVertex;
+         handle.vertexCount = (GLuint)mesh.vertices.size();
+         handle.firstIndex  = (GLuint)firstIndex;
+         handle.indexCount  = (GLuint)mesh.indices.size();
+
+         // indices are kept relative to the mesh, baseVertex is added by the draw call
+         glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+         glBufferSubData(GL_ARRAY_BUFFER, baseVertex * sizeof(Vertex), mesh.vertices.size() * sizeof(Vertex), mesh.vertices.data());
+         METRIC_ADD(METRIC_BUFFER_BYTES, mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(GLuint));
+         glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+
+         glState().bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+         glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(GLuint), mesh.indices.size() * sizeof(GLuint), mesh.indices.data());
+         glState().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+         return handle;
+      }
+
+      std::vector<ArenaMesh> add(const Model& model)
+      {
+         std::vector<ArenaMesh> handles;
+         handles.reserve(model.meshes.size());
+         for (size_t i = 0; i < model.meshes.size(); i++) { handles.push_back(add(model.meshes[i])); }
+         return handles;
+      }
+
+      // Gives the ranges of an unloaded mesh back to the allocators, to be reused by the next meshes
+      void remove(ArenaMesh& handle)
+      {
+         if(!handle.valid()) return;
+
+         vertexAllocator.free(handle.baseVertex, handle.vertexCount);
+         indexAllocator.free(handle.firstIndex, handle.indexCount);
+         handle = ArenaMesh{};
+      }
+
+      void remove(std::vector<ArenaMesh>& handles)
+      {
+         for (size_t i = 0; i < handles.size(); i++) { remove(handles[i]); }
+      }
+
+      // Vertices and indices the shared buffers can hold, they grow when an added mesh does not fit
+      size_t vertexCapacity() const noexcept { return vertexAllocator.capacity(); }
+      size_t indexCapacity()  const noexcept { return indexAllocator.capacity(); }
+
+      #pragma region render_pass
+         // Starts a new render pass
+         void clearDraws() { commands.clear(); instances.clear(); }
+
+         // Queues a mesh in the current render pass, with its own transform
+         void submit(const ArenaMesh& handle, const glm::mat4& transform)
+         {
+            if(!handle.valid()) return;
+
+            DrawElementsIndirectCommand command;
+            command.count         = handle.indexCount;
+            command.instanceCount = 1;
+            command.firstIndex    = handle.firstIndex;
+            command.baseVertex    = handle.baseVertex;
+            command.baseInstance  = (GLuint)instances.size(); // selects the InstanceData of this draw
+
+            commands.push_back(command);
+            instances.push_back(InstanceData{transform, glm::inverseTranspose(glm::mat3(transform))});
+            // counted here, draw() issues every queued command
+            METRIC_ADD(METRIC_OBJECTS, 1);
+            METRIC_ADD(METRIC_TRIANGLES, handle.indexCount / 3);
+         }
+
+         void submit(const std::vector<ArenaMesh>& handles, const glm::mat4& transform)
+         {
+            for (size_t i = 0; i < handles.size(); i++) { submit(handles[i], transform); }
+         }
+
+         // Draws the whole render pass, the shader must read the per-instance matrices (see procedural_instanced.vert)
+         void draw(const Shader& shader)
+         {
+            if(commands.empty()) return;
+
+            shader.use();
+            uploadPass();
+
+            glState().bindVertexArray(VAO);
+
+            #ifdef GL_VERSION_4_3
+            if(GLAD_GL_VERSION_4_3)
+            {
+               // a single call for the whole pass, commands are read from the bound GL_DRAW_INDIRECT_BUFFER
+               glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+               glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)commands.size(), 0);
+               METRIC_ADD(METRIC_DRAW_CALLS, 1);
+               return;
+            }
+            #endif
+
+            // without multi draw indirect (GL < 4.3) we issue the same commands one by one
+            METRIC_ADD(METRIC_DRAW_CALLS, commands.size());
+            for (size_t i = 0; i < commands.size(); i++)
+            {
+               const DrawElementsIndirectCommand& command = commands[i];
+               const GLvoid* indexOffset = (GLvoid*)(command.firstIndex * sizeof(GLuint));
+
+               #ifdef GL_VERSION_4_2
+               if(GLAD_GL_VERSION_4_2)
+               {
+                  glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, indexOffset,
+                                                                command.instanceCount, command.baseVertex, command.baseInstance);
+                  continue;
+               }
+               #endif
+
+               // GL 4.1 has no baseInstance: we move the instance attributes to the InstanceData of this draw
+               glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+               setupInstanceAttributes(command.baseInstance * sizeof(InstanceData));
+               glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, indexOffset,
+                                                 command.instanceCount, command.baseVertex);
+            }
+         }
+      #pragma endregion
+
+   private:
+      GLuint VBO, EBO, instanceVBO, commandBuffer;
+      RangeAllocator vertexAllocator, indexAllocator;
+
+      std::vector<DrawElementsIndirectCommand> commands;
+      std::vector<InstanceData> instances;
+      size_t instanceCapacity, commandCapacity;
+
+      // (Re)creates the shared buffers with the new capacities, copying the content of the old ones on the GPU
+      void resize(size_t vertexCapacity, size_t indexCapacity)
+      {
+         size_t oldVertexCapacity = vertexAllocator.capacity(), oldIndexCapacity = indexAllocator.capacity();
+
+         VBO = resizeBuffer(VBO, oldVertexCapacity * sizeof(Vertex), vertexCapacity * sizeof(Vertex));
+         EBO = resizeBuffer(EBO, oldIndexCapacity * sizeof(GLuint), indexCapacity * sizeof(GLuint));
+
+         vertexAllocator.grow(vertexCapacity);
+         indexAllocator.grow(indexCapacity);
+
+         // attribute pointers refer to the buffer bound when they were set, so they have to be set again
+         glState().bindVertexArray(VAO);
+         glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+         glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+         setupVertexAttributes();
+         glState().bindBuffer(GL_ARRAY_BUFFER, 0);
+         glState().bindVertexArray(0); // the EBO stays bound to the VAO
+      }
+
+      static GLuint resizeBuffer(GLuint oldBuffer, size_t oldSize, size_t newSize)
+      {
+         GLuint newBuffer;
+         glGenBuffers(1, &newBuffer);
+         glState().bindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+         glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+
+         if(oldBuffer)
+         {
+            glState().bindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+            glState().bindBuffer(GL_COPY_READ_BUFFER, 0);
+            glState().deleteBuffer(oldBuffer);
+         }
+
+         glState().bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+         return newBuffer;
+      }
+
+      void uploadPass()
+      {
+         glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+         if(instances.size() > instanceCapacity)
+         {
+            instanceCapacity = std::max(instances.size(), instanceCapacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+         }
+         glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(InstanceData), instances.data());
+         METRIC_ADD(METRIC_BUFFER_BYTES, instances.size() * sizeof(InstanceData));
+
+         #ifdef GL_VERSION_4_3
+         if(GLAD_GL_VERSION_4_3)
+         {
+            glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+            if(commands.size() > commandCapacity)
+            {
+               commandCapacity = std::max(commands.size(), commandCapacity * 2);
+               glBufferData(GL_DRAW_INDIRECT_BUFFER, commandCapacity * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+            }
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+            METRIC_ADD(METRIC_BUFFER_BYTES, commands.size() * sizeof(DrawElementsIndirectCommand));
+         }
+         #endif
+      }
+};
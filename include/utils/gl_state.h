@@ -0,0 +1,317 @@
+#pragma once
+/*
+   GLStateCache class
+   - shadow copy of the GL state the utils change: program, subroutines, VAO, buffer and texture bindings,
+     polygon mode, depth and blend state
+   - a call is issued to the driver only if it changes the shadow copy, and the calls issued and elided are counted
+   - all the state changes must go through glState(), or the shadow copy must be invalidated after them
+*/
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+#include <utils/metrics.h>
+
+// Calls issued to the driver and elided by the cache
+struct GLStateStats
+{
+   size_t issued = 0;
+   size_t elided = 0;
+};
+
+class GLStateCache
+{
+   public:
+      static const GLuint UNKNOWN = 0xFFFFFFFFu;
+      static const GLuint MAX_TEXTURE_UNITS = 32;
+
+      GLStateCache() { invalidate(); }
+
+      // Forgets the whole state, so that the next call of every kind is issued
+      void invalidate()
+      {
+         currentProgram = UNKNOWN;
+         currentVAO = UNKNOWN;
+         for (size_t i = 0; i < BUFFER_TARGET_COUNT; i++) { buffers[i] = UNKNOWN; }
+         activeUnit = UNKNOWN;
+         for (size_t unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+         {
+            for (size_t i = 0; i < TEXTURE_TARGET_COUNT; i++) { textures[unit][i] = UNKNOWN; }
+         }
+         polygonMode = UNKNOWN;
+         for (size_t i = 0; i < CAPABILITY_COUNT; i++) { capabilities[i] = -1; }
+         depthFunc = UNKNOWN;
+         depthMask = -1;
+         blendSource = blendDestination = UNKNOWN;
+         vertexSubroutines.clear();
+         fragmentSubroutines.clear();
+      }
+
+      // Returns true if the program changed, GL forgets the selected subroutines in that case
+      bool useProgram(GLuint program)
+      {
+         if(!changed(currentProgram, program)) return false;
+
+         glUseProgram(program);
+         METRIC_ADD(METRIC_PROGRAM_BINDS, 1);
+         vertexSubroutines.clear();
+         fragmentSubroutines.clear();
+         return true;
+      }
+
+      // All the subroutine uniform locations of the stage, for the program in use
+      void setSubroutines(GLenum stage, GLsizei count, const GLuint* indices)
+      {
+         std::vector<GLuint>& current = stage == GL_VERTEX_SHADER ? vertexSubroutines : fragmentSubroutines;
+         if(current.size() == (size_t)count && std::equal(current.begin(), current.end(), indices))
+         {
+            stats.elided++;
+            return;
+         }
+
+         stats.issued++;
+         current.assign(indices, indices + count);
+         glUniformSubroutinesuiv(stage, count, indices);
+      }
+
+      void bindVertexArray(GLuint vao)
+      {
+         if(!changed(currentVAO, vao)) return;
+
+         glBindVertexArray(vao);
+         METRIC_ADD(METRIC_VAO_BINDS, 1);
+         // the element array binding is part of the VAO
+         buffers[ELEMENT_ARRAY] = UNKNOWN;
+      }
+
+      void bindBuffer(GLenum target, GLuint buffer)
+      {
+         int index = bufferTarget(target);
+         if(index != -1 && !changed(buffers[index], buffer)) return;
+         if(index == -1) stats.issued++;
+
+         glBindBuffer(target, buffer);
+      }
+
+      // Binds to an indexed binding point, which binds to the generic one of the target too
+      void bindBufferBase(GLenum target, GLuint bindingIndex, GLuint buffer)
+      {
+         stats.issued++;
+         glBindBufferBase(target, bindingIndex, buffer);
+
+         int index = bufferTarget(target);
+         if(index != -1) buffers[index] = buffer;
+      }
+
+      void bindTexture(GLuint unit, GLenum target, GLuint texture)
+      {
+         int index = textureTarget(target);
+         if(unit < MAX_TEXTURE_UNITS && index != -1 && textures[unit][index] == texture)
+         {
+            stats.elided++;
+            return;
+         }
+
+         if(changed(activeUnit, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+         stats.issued++;
+         glBindTexture(target, texture);
+         if(unit < MAX_TEXTURE_UNITS && index != -1) textures[unit][index] = texture;
+      }
+
+      // Core profiles accept only GL_FRONT_AND_BACK
+      void setPolygonMode(GLenum mode)
+      {
+         if(changed(polygonMode, mode)) glPolygonMode(GL_FRONT_AND_BACK, mode);
+      }
+
+      void enable (GLenum capability) { setCapability(capability, true);  }
+      void disable(GLenum capability) { setCapability(capability, false); }
+
+      void setDepthFunc(GLenum func)
+      {
+         if(changed(depthFunc, func)) glDepthFunc(func);
+      }
+
+      void setDepthMask(bool write)
+      {
+         if(depthMask == (write ? 1 : 0))
+         {
+            stats.elided++;
+            return;
+         }
+
+         stats.issued++;
+         depthMask = write ? 1 : 0;
+         glDepthMask(write ? GL_TRUE : GL_FALSE);
+      }
+
+      void setBlendFunc(GLenum source, GLenum destination)
+      {
+         if(blendSource == source && blendDestination == destination)
+         {
+            stats.elided++;
+            return;
+         }
+
+         stats.issued++;
+         blendSource = source; blendDestination = destination;
+         glBlendFunc(source, destination);
+      }
+
+      #pragma region deletion
+         // Deleting an object bound in the current context binds 0 in its place
+         void deleteProgram(GLuint program)
+         {
+            if(currentProgram == program) currentProgram = 0;
+            glDeleteProgram(program);
+         }
+
+         void deleteVertexArray(GLuint vao)
+         {
+            if(currentVAO == vao)
+            {
+               currentVAO = 0;
+               buffers[ELEMENT_ARRAY] = UNKNOWN;
+            }
+            glDeleteVertexArrays(1, &vao);
+         }
+
+         void deleteBuffer(GLuint buffer)
+         {
+            for (size_t i = 0; i < BUFFER_TARGET_COUNT; i++)
+            {
+               if(buffers[i] == buffer) buffers[i] = 0;
+            }
+            glDeleteBuffers(1, &buffer);
+         }
+
+         void deleteTexture(GLuint texture)
+         {
+            for (size_t unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+            {
+               for (size_t i = 0; i < TEXTURE_TARGET_COUNT; i++)
+               {
+                  if(textures[unit][i] == texture) textures[unit][i] = 0;
+               }
+            }
+            glDeleteTextures(1, &texture);
+         }
+      #pragma endregion
+
+      GLuint program() const noexcept { return currentProgram; }
+      GLuint vertexArray() const noexcept { return currentVAO; }
+
+      // Counters of the calls since the last endFrame(), and of the last whole frame
+      const GLStateStats& currentStats() const noexcept { return stats; }
+      const GLStateStats& frameStats()   const noexcept { return lastFrame; }
+
+      void endFrame()
+      {
+         lastFrame = stats;
+         stats = GLStateStats();
+      }
+
+   private:
+      enum BufferTarget
+      {
+         ARRAY, ELEMENT_ARRAY, UNIFORM, COPY_READ, COPY_WRITE, DRAW_INDIRECT, PIXEL_PACK, PIXEL_UNPACK, TEXTURE_BUFFER,
+         BUFFER_TARGET_COUNT
+      };
+      enum TextureTarget { TEXTURE_2D, TEXTURE_2D_ARRAY, TEXTURE_3D, TEXTURE_CUBE_MAP, TEXTURE_BUFFER_TARGET, TEXTURE_TARGET_COUNT };
+      enum Capability { DEPTH_TEST, BLEND, CULL_FACE, SCISSOR_TEST, STENCIL_TEST, CAPABILITY_COUNT };
+
+      GLuint currentProgram, currentVAO;
+      GLuint buffers[BUFFER_TARGET_COUNT];
+      GLuint activeUnit;
+      GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+      GLenum polygonMode;
+      int capabilities[CAPABILITY_COUNT]; // -1 unknown, 0 disabled, 1 enabled
+      GLenum depthFunc;
+      int depthMask;
+      GLenum blendSource, blendDestination;
+      std::vector<GLuint> vertexSubroutines, fragmentSubroutines; // empty when unknown
+
+      GLStateStats stats, lastFrame;
+
+      // Updates the shadow value and counts the call, returns whether it has to be issued
+      bool changed(GLuint& current, GLuint value)
+      {
+         if(current == value)
+         {
+            stats.elided++;
+            return false;
+         }
+
+         stats.issued++;
+         current = value;
+         return true;
+      }
+
+      void setCapability(GLenum capability, bool enabled)
+      {
+         int index = capabilityIndex(capability);
+         if(index != -1 && capabilities[index] == (enabled ? 1 : 0))
+         {
+            stats.elided++;
+            return;
+         }
+
+         stats.issued++;
+         if(index != -1) capabilities[index] = enabled ? 1 : 0;
+         if(enabled) glEnable(capability);
+         else        glDisable(capability);
+      }
+
+      static int bufferTarget(GLenum target)
+      {
+         switch(target)
+         {
+            case GL_ARRAY_BUFFER:         return ARRAY;
+            case GL_ELEMENT_ARRAY_BUFFER: return ELEMENT_ARRAY;
+            case GL_UNIFORM_BUFFER:       return UNIFORM;
+            case GL_COPY_READ_BUFFER:     return COPY_READ;
+            case GL_COPY_WRITE_BUFFER:    return COPY_WRITE;
+            case GL_DRAW_INDIRECT_BUFFER: return DRAW_INDIRECT;
+            case GL_PIXEL_PACK_BUFFER:    return PIXEL_PACK;
+            case GL_PIXEL_UNPACK_BUFFER:  return PIXEL_UNPACK;
+            case GL_TEXTURE_BUFFER:       return TEXTURE_BUFFER;
+            default:                      return -1;
+         }
+      }
+
+      static int textureTarget(GLenum target)
+      {
+         switch(target)
+         {
+            case GL_TEXTURE_2D:       return TEXTURE_2D;
+            case GL_TEXTURE_2D_ARRAY: return TEXTURE_2D_ARRAY;
+            case GL_TEXTURE_3D:       return TEXTURE_3D;
+            case GL_TEXTURE_CUBE_MAP: return TEXTURE_CUBE_MAP;
+            case GL_TEXTURE_BUFFER:   return TEXTURE_BUFFER_TARGET;
+            default:                  return -1;
+         }
+      }
+
+      static int capabilityIndex(GLenum capability)
+      {
+         switch(capability)
+         {
+            case GL_DEPTH_TEST:   return DEPTH_TEST;
+            case GL_BLEND:        return BLEND;
+            case GL_CULL_FACE:    return CULL_FACE;
+            case GL_SCISSOR_TEST: return SCISSOR_TEST;
+            case GL_STENCIL_TEST: return STENCIL_TEST;
+            default:              return -1;
+         }
+      }
+};
+
+// The state cache of the GL context of the application (there is only one, used by the main thread)
+inline GLStateCache& glState()
+{
+   static GLStateCache cache;
+   return cache;
+}
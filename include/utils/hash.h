@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit FNV-1a hash: passing the result of a previous call as hash continues it, so that
+// several buffers can be hashed as if they were one
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+   const unsigned char* bytes = static_cast<const unsigned char*>(data);
+   for (size_t i = 0; i < size; i++)
+   {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+   }
+   return hash;
+}
@@ -0,0 +1,227 @@
+#pragma once
+/*
+   HeadlessContext class
+   - GL context without a window, for benchmarks and tests on machines without a display (or without a GPU):
+     a surfaceless EGL context (any Mesa driver, llvmpipe included) or an OSMesa one
+   - the frames are rendered in a framebuffer object of the requested size, bound as the draw framebuffer
+   - the backends are compiled in only if requested, as each one needs its library:
+     UTILS_HEADLESS_EGL (link libEGL) and/or UTILS_HEADLESS_OSMESA (link libOSMesa)
+*/
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+#ifdef UTILS_HEADLESS_EGL
+   // no X11 headers dragged in by eglplatform.h
+   #define EGL_NO_X11
+   #define MESA_EGL_NO_X11_HEADERS
+   #include <EGL/egl.h>
+   #include <EGL/eglext.h>
+#endif
+
+#ifdef UTILS_HEADLESS_OSMESA
+   // glad has already defined the GL types, osmesa.h finds gl.h as already included
+   #include <GL/osmesa.h>
+#endif
+
+enum HeadlessBackend { HEADLESS_EGL, HEADLESS_OSMESA };
+
+class HeadlessContext
+{
+   public:
+      // A GL core context of the requested version, current on the calling thread: check valid() before using it
+      HeadlessContext(GLsizei width, GLsizei height, GLuint glMajor = 4, GLuint glMinor = 1, HeadlessBackend backend = HEADLESS_EGL) :
+         frameWidth(width), frameHeight(height), backend(backend), created(false), FBO(0), colorBuffer(0), depthBuffer(0)
+      {
+         bool current = false;
+         switch(backend)
+         {
+            case HEADLESS_EGL:    current = createEGL(glMajor, glMinor);    break;
+            case HEADLESS_OSMESA: current = createOSMesa(glMajor, glMinor); break;
+         }
+         if(!current) return;
+
+         if(!gladLoadGLLoader(loader()))
+         {
+            std::cout << "Failed to initialize OpenGL context" << std::endl;
+            return;
+         }
+
+         created = createFramebuffer();
+      }
+
+      HeadlessContext(const HeadlessContext& copy) = delete;
+      HeadlessContext& operator=(const HeadlessContext& copy) = delete;
+
+      ~HeadlessContext()
+      {
+         if(FBO)
+         {
+            glDeleteFramebuffers(1, &FBO);
+            glDeleteRenderbuffers(1, &colorBuffer);
+            glDeleteRenderbuffers(1, &depthBuffer);
+         }
+
+#ifdef UTILS_HEADLESS_EGL
+         if(backend == HEADLESS_EGL && eglDisplay != EGL_NO_DISPLAY)
+         {
+            eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if(eglContext != EGL_NO_CONTEXT) eglDestroyContext(eglDisplay, eglContext);
+            eglTerminate(eglDisplay);
+         }
+#endif
+#ifdef UTILS_HEADLESS_OSMESA
+         if(backend == HEADLESS_OSMESA && osmesaContext) OSMesaDestroyContext(osmesaContext);
+#endif
+      }
+
+      bool valid() const noexcept { return created; }
+      GLsizei width()  const noexcept { return frameWidth; }
+      GLsizei height() const noexcept { return frameHeight; }
+      GLuint framebuffer() const noexcept { return FBO; }
+
+      // The renderer string, to tell llvmpipe from a real GPU in the reports
+      const char* renderer() const { return reinterpret_cast<const char*>(glGetString(GL_RENDERER)); }
+
+      // Reads the color buffer (RGBA, bottom row first)
+      void readPixels(std::vector<uint8_t>& pixels) const
+      {
+         pixels.resize((size_t)frameWidth * frameHeight * 4);
+         glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+         glReadPixels(0, 0, frameWidth, frameHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+      }
+
+   private:
+      GLsizei frameWidth, frameHeight;
+      HeadlessBackend backend;
+      bool created;
+      GLuint FBO, colorBuffer, depthBuffer;
+
+#ifdef UTILS_HEADLESS_EGL
+      EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+      EGLContext eglContext = EGL_NO_CONTEXT;
+#endif
+#ifdef UTILS_HEADLESS_OSMESA
+      OSMesaContext osmesaContext = nullptr;
+      // OSMesa needs a buffer to make the context current, the frames go to the FBO anyway
+      std::vector<uint8_t> osmesaBuffer;
+#endif
+
+      bool createEGL(GLuint glMajor, GLuint glMinor)
+      {
+#ifdef UTILS_HEADLESS_EGL
+         // the surfaceless platform of Mesa needs neither a display server nor a render node
+         PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+         if(getPlatformDisplay) eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+         if(eglDisplay == EGL_NO_DISPLAY) eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+         EGLint major, minor;
+         if(eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+         {
+            std::cout << "Failed to initialize EGL" << std::endl;
+            return false;
+         }
+         eglBindAPI(EGL_OPENGL_API);
+
+         // no surface will ever be created, any config rendering with desktop GL will do
+         const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+         EGLConfig config = EGL_NO_CONFIG_KHR;
+         EGLint configCount = 0;
+         eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount);
+         if(configCount == 0) config = EGL_NO_CONFIG_KHR;
+
+         const EGLint contextAttributes[] =
+         {
+            EGL_CONTEXT_MAJOR_VERSION, (EGLint)glMajor,
+            EGL_CONTEXT_MINOR_VERSION, (EGLint)glMinor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+         };
+         eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+         if(eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+         {
+            std::cout << "Failed to create a surfaceless EGL context (GL " << glMajor << "." << glMinor << " core)" << std::endl;
+            return false;
+         }
+         return true;
+#else
+         std::cout << "EGL support not compiled in (define UTILS_HEADLESS_EGL)" << std::endl;
+         return false;
+#endif
+      }
+
+      bool createOSMesa(GLuint glMajor, GLuint glMinor)
+      {
+#ifdef UTILS_HEADLESS_OSMESA
+         const int attributes[] =
+         {
+            OSMESA_FORMAT,                OSMESA_RGBA,
+            OSMESA_DEPTH_BITS,            24,
+            OSMESA_PROFILE,               OSMESA_CORE_PROFILE,
+            OSMESA_CONTEXT_MAJOR_VERSION, (int)glMajor,
+            OSMESA_CONTEXT_MINOR_VERSION, (int)glMinor,
+            0
+         };
+         osmesaContext = OSMesaCreateContextAttribs(attributes, nullptr);
+
+         osmesaBuffer.resize((size_t)frameWidth * frameHeight * 4);
+         if(!osmesaContext || !OSMesaMakeCurrent(osmesaContext, osmesaBuffer.data(), GL_UNSIGNED_BYTE, frameWidth, frameHeight))
+         {
+            std::cout << "Failed to create an OSMesa context (GL " << glMajor << "." << glMinor << " core)" << std::endl;
+            return false;
+         }
+         return true;
+#else
+         std::cout << "OSMesa support not compiled in (define UTILS_HEADLESS_OSMESA)" << std::endl;
+         return false;
+#endif
+      }
+
+      GLADloadproc loader() const
+      {
+#ifdef UTILS_HEADLESS_EGL
+         if(backend == HEADLESS_EGL) return &eglLoader;
+#endif
+#ifdef UTILS_HEADLESS_OSMESA
+         if(backend == HEADLESS_OSMESA) return &osmesaLoader;
+#endif
+         return nullptr;
+      }
+
+#ifdef UTILS_HEADLESS_EGL
+      static void* eglLoader(const char* name) { return reinterpret_cast<void*>(eglGetProcAddress(name)); }
+#endif
+#ifdef UTILS_HEADLESS_OSMESA
+      static void* osmesaLoader(const char* name) { return reinterpret_cast<void*>(OSMesaGetProcAddress(name)); }
+#endif
+
+      // Color and depth renderbuffers, the FBO stays bound as the target of every draw
+      bool createFramebuffer()
+      {
+         glGenRenderbuffers(1, &colorBuffer);
+         glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+         glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, frameWidth, frameHeight);
+
+         glGenRenderbuffers(1, &depthBuffer);
+         glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+         glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, frameWidth, frameHeight);
+
+         glGenFramebuffers(1, &FBO);
+         glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+         glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+         if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+         {
+            std::cout << "Offscreen framebuffer incomplete" << std::endl;
+            return false;
+         }
+
+         glViewport(0, 0, frameWidth, frameHeight);
+         return true;
+      }
+};
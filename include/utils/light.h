@@ -1,10 +1,21 @@
 #pragma once
 
-#include <utils/shader.h>
+#include <utils/uniform_buffer.h>
+#include <utils/profiler.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// Capacities of the LightBlock arrays, they must match the values in shaders/constants.utils
+const size_t MAX_POINT_LIGHTS = 128;
+const size_t MAX_DIR_LIGHTS   = 4;
+const size_t MAX_SPOT_LIGHTS  = 32;
+
 struct LightAttributes
 {
    // Light values
@@ -18,6 +29,53 @@ struct LightAttributes
    float kS;
 };
 
+// CPU mirrors of the std140 structs in shaders/types.utils:
+// in std140 a vec3 is aligned to 16 bytes, but a following scalar can fill its last 4 bytes
+struct LightAttributesStd140
+{
+   glm::vec3 ambient;  float pad0;
+   glm::vec3 diffuse;  float pad1;
+   glm::vec3 specular; float kA;
+   float kD, kS;       float pad2[2];
+};
+
+struct PointLightStd140
+{
+   glm::vec3 position; float radius;
+   LightAttributesStd140 lightAttrs;
+};
+
+struct DirectionalLightStd140
+{
+   glm::vec3 direction; float pad0;
+   LightAttributesStd140 lightAttrs;
+};
+
+struct SpotLightStd140
+{
+   glm::vec3 position;  float radius;
+   glm::vec3 direction; float cutoffAngle;
+   LightAttributesStd140 lightAttrs;
+};
+
+// CPU mirror of the LightBlock in shaders/uniform_blocks.utils
+struct LightBlockStd140
+{
+   GLuint nPointLights, nDirLights, nSpotLights, pad0;
+
+   PointLightStd140       pointLights[MAX_POINT_LIGHTS];
+   DirectionalLightStd140 directionalLights[MAX_DIR_LIGHTS];
+   SpotLightStd140        spotLights[MAX_SPOT_LIGHTS];
+};
+
+static_assert(sizeof(LightAttributesStd140)  == 64, "LightAttributes std140 layout mismatch");
+static_assert(sizeof(PointLightStd140)       == 80, "PointLight std140 layout mismatch");
+static_assert(sizeof(DirectionalLightStd140) == 80, "DirectionalLight std140 layout mismatch");
+static_assert(sizeof(SpotLightStd140)        == 96, "SpotLight std140 layout mismatch");
+static_assert(offsetof(LightBlockStd140, pointLights) == 16, "LightBlock std140 layout mismatch");
+// GL guarantees at least 16KB for a uniform block
+static_assert(sizeof(LightBlockStd140) <= 16384, "LightBlock exceeds GL_MAX_UNIFORM_BLOCK_SIZE minimum");
+
 class Light
 {
    public:
@@ -25,37 +83,43 @@ class Light
 
       Light(LightAttributes &attrs) : attrs(attrs) {}
 
-      virtual void setLightAttrs(Shader shader, std::string &prefix)
+   protected:
+      LightAttributesStd140 packLightAttrs() const
       {
-         shader.setVec3(prefix + "lightAttrs.diffuse", attrs.diffuse);
-         shader.setVec3(prefix + "lightAttrs.specular", attrs.specular);
-         shader.setVec3(prefix + "lightAttrs.ambient", attrs.ambient);
-
-         shader.setFloat(prefix + "lightAttrs.kA", attrs.kA);
-         shader.setFloat(prefix + "lightAttrs.kD", attrs.kD);
-         shader.setFloat(prefix + "lightAttrs.kS", attrs.kS);
+         LightAttributesStd140 packed{};
+         packed.ambient  = attrs.ambient;
+         packed.diffuse  = attrs.diffuse;
+         packed.specular = attrs.specular;
+
+         packed.kA = attrs.kA;
+         packed.kD = attrs.kD;
+         packed.kS = attrs.kS;
+         return packed;
       }
-      virtual void setup(Shader shader, size_t index) = 0;
 };
 
 class PointLight : Light
 {
    public:
       glm::vec3 position;
+      // the light fades to nothing at this distance (0: it reaches everything, with no decay)
+      float radius;
 
       /* Decay values TODO LATER
       float constant    = 1.f;
       float linear      = 1.f;
       float quadratic   = 1.f;*/
 
-      PointLight(glm::vec3 position, LightAttributes &attrs) :
-         Light(attrs), position(position) {}
+      PointLight(glm::vec3 position, LightAttributes &attrs, float radius = 0.0f) :
+         Light(attrs), position(position), radius(radius) {}
 
-      void setup(Shader shader, size_t index) override
+      PointLightStd140 pack() const
       {
-         std::string prefix = "pointLights[" + std::to_string(index) + "].";
-         setLightAttrs(shader, prefix);
-         shader.setVec3(prefix + "position", position);
+         PointLightStd140 packed{};
+         packed.position   = position;
+         packed.radius     = radius;
+         packed.lightAttrs = packLightAttrs();
+         return packed;
       }
 };
 
@@ -67,11 +131,12 @@ class DirectionalLight : Light
       DirectionalLight(glm::vec3 direction, LightAttributes &attrs) :
          Light(attrs), direction(direction) {}
 
-      void setup(Shader shader, size_t index) override
+      DirectionalLightStd140 pack() const
       {
-         std::string prefix = "directionalLights[" + std::to_string(index) + "].";
-         setLightAttrs(shader, prefix);
-         shader.setVec3(prefix + "direction", direction);
+         DirectionalLightStd140 packed{};
+         packed.direction  = direction;
+         packed.lightAttrs = packLightAttrs();
+         return packed;
       }
 };
 
@@ -80,17 +145,96 @@ class SpotLight : Light
    public:
       glm::vec3 position;
       glm::vec3 direction;
-      float cutoffAngle;
+      float cutoffAngle; // half angle of the cone, in radians
+      float radius;      // as the one of PointLight
    
-      SpotLight(glm::vec3 position, glm::vec3 direction, float cutoffAngle, LightAttributes &attrs) :
-         Light(attrs), position(position), direction(direction), cutoffAngle(cutoffAngle) {}
+      SpotLight(glm::vec3 position, glm::vec3 direction, float cutoffAngle, LightAttributes &attrs, float radius = 0.0f) :
+         Light(attrs), position(position), direction(direction), cutoffAngle(cutoffAngle), radius(radius) {}
+
+      SpotLightStd140 pack() const
+      {
+         SpotLightStd140 packed{};
+         packed.position    = position;
+         packed.radius      = radius;
+         packed.direction   = direction;
+         packed.cutoffAngle = cutoffAngle;
+         packed.lightAttrs  = packLightAttrs();
+         return packed;
+      }
+};
+
+// Packs every light of the scene in the LightBlock uniform buffer shared by all the programs using lighting.frag.
+// Lights are compared with their packed copy, and only the byte range that actually changed is uploaded once per frame
+class LightManager
+{
+   public:
+      LightManager() : block{}, ubo(sizeof(LightBlockStd140), LIGHT_BLOCK_BINDING)
+      {
+         markDirty(0, sizeof(LightBlockStd140));
+      }
+
+      void setPointLights(const std::vector<PointLight>& lights)
+      {
+         size_t count = std::min(lights.size(), MAX_POINT_LIGHTS);
+         for (size_t i = 0; i < count; i++)
+         {
+            write(block.pointLights[i], lights[i].pack());
+         }
+         write(block.nPointLights, (GLuint)count);
+      }
+
+      void setDirectionalLights(const std::vector<DirectionalLight>& lights)
+      {
+         size_t count = std::min(lights.size(), MAX_DIR_LIGHTS);
+         for (size_t i = 0; i < count; i++)
+         {
+            write(block.directionalLights[i], lights[i].pack());
+         }
+         write(block.nDirLights, (GLuint)count);
+      }
+
+      void setSpotLights(const std::vector<SpotLight>& lights)
+      {
+         size_t count = std::min(lights.size(), MAX_SPOT_LIGHTS);
+         for (size_t i = 0; i < count; i++)
+         {
+            write(block.spotLights[i], lights[i].pack());
+         }
+         write(block.nSpotLights, (GLuint)count);
+      }
+
+      // Uploads the dirty range (if any) with a single buffer update, to be called once per frame before drawing
+      void upload()
+      {
+         if(dirtyBegin >= dirtyEnd) return;
+         PROFILE_SCOPE("LightManager::upload");
+
+         const char* base = reinterpret_cast<const char*>(&block);
+         ubo.update(dirtyBegin, dirtyEnd - dirtyBegin, base + dirtyBegin);
+
+         dirtyBegin = sizeof(LightBlockStd140); dirtyEnd = 0;
+      }
+
+   private:
+      LightBlockStd140 block;
+      UniformBuffer ubo;
+
+      // [dirtyBegin, dirtyEnd) byte range of the block not yet uploaded
+      size_t dirtyBegin = sizeof(LightBlockStd140), dirtyEnd = 0;
+
+      template <typename T>
+      void write(T& dst, const T& src)
+      {
+         if(std::memcmp(&dst, &src, sizeof(T)) == 0) return;
+
+         dst = src;
+         size_t offset = reinterpret_cast<const char*>(&dst) - reinterpret_cast<const char*>(&block);
+         markDirty(offset, offset + sizeof(T));
+      }
 
-      void setup(Shader shader, size_t index) override
+      void markDirty(size_t begin, size_t end)
       {
-         std::string prefix = "spotLights[" + std::to_string(index) + "].";
-         setLightAttrs(shader, prefix);
-         shader.setVec3(prefix + "position", position);
-         shader.setVec3(prefix + "direction", direction);
-         shader.setFloat(prefix + "cutoffAngle", cutoffAngle);
+         dirtyBegin = std::min(dirtyBegin, begin);
+         dirtyEnd   = std::max(dirtyEnd, end);
       }
 };
\ No newline at end of file
@@ -0,0 +1,364 @@
+#pragma once
+/*
+   LightClusters class
+   - clustered forward shading: the view frustum is split in CLUSTERS_X * CLUSTERS_Y screen tiles, each one sliced
+     in CLUSTERS_Z slices along the view depth (exponential steps, so the clusters are about as deep as they are wide),
+     and every cluster gets the list of the lights reaching it
+   - lighting.frag with clusters.utils lights a fragment only with the lights of its cluster, so the cost per fragment
+     follows the lights nearby instead of all the lights of the scene
+   - the lights are assigned on the CPU once per frame: the ranged ones are culled against the frustum with SphereCuller,
+     then each one goes in the clusters overlapped by the screen bounds of its sphere, slice by slice.
+     Lights with radius 0 reach everything, so they go in every cluster
+   - the lights, the offset/count of each cluster and the light indices are uploaded in three texture buffers,
+     the size of the grid in the ClusterBlock uniform block
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+
+#include <utils/light.h>
+#include <utils/frustum.h>
+#include <utils/shader.h>
+#include <utils/gl_state.h>
+#include <utils/uniform_buffer.h>
+#include <utils/metrics.h>
+#include <utils/profiler.h>
+
+// Size of the cluster grid (16:9 tiles)
+const GLuint CLUSTERS_X = 16;
+const GLuint CLUSTERS_Y = 9;
+const GLuint CLUSTERS_Z = 24;
+const size_t CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+// The light indices are 16 bits
+const size_t MAX_CLUSTERED_LIGHTS = 65535;
+
+// Texture units of the cluster texture buffers, after the ones of the G-buffer (see deferred_renderer.h)
+enum ClusterTextureUnit { CLUSTER_LIGHTS_UNIT = 3, CLUSTER_RANGES_UNIT, CLUSTER_INDICES_UNIT };
+
+// A light in the clusterLights texture buffer, it must match fetchClusterLight() in shaders/clusters.utils
+struct ClusterLightTexels
+{
+   glm::vec4 positionRadius;
+   glm::vec4 directionCutoff; // cosine of the half angle of a spot light, -2 for a point light
+   glm::vec4 ambientKA;
+   glm::vec4 diffuseKD;
+   glm::vec4 specularKS;
+};
+
+// CPU mirror of the ClusterBlock in shaders/clusters.utils
+struct ClusterBlockStd140
+{
+   GLuint clusterCounts[3]; float sliceScale;
+   glm::vec2 tileSize;      float sliceBias; float pad0;
+};
+
+// A texel of the clusterRanges texture buffer: the lights of a cluster in clusterLightIndices
+struct ClusterRange
+{
+   GLuint offset;
+   GLuint count;
+};
+
+static_assert(sizeof(ClusterLightTexels) == 5 * 16, "ClusterLightTexels must be 5 RGBA32F texels");
+static_assert(sizeof(ClusterBlockStd140) == 32, "ClusterBlock std140 layout mismatch");
+
+struct ClusterStats
+{
+   size_t lights        = 0; // lights given to the clusters
+   size_t globalLights  = 0; // lights with radius 0, in every cluster
+   CullStats culled;         // ranged lights tested against the frustum, and visible
+   size_t indices       = 0; // light indices of all the clusters
+   size_t maxPerCluster = 0;
+};
+
+class LightClusters
+{
+   public:
+      LightClusters() : blockUBO(sizeof(ClusterBlockStd140), CLUSTER_BLOCK_BINDING)
+      {
+         // GL 4.1 guarantees only 64K texels in a texture buffer
+         GLint maxTexels = 0;
+         glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+         maxTexelCount = std::max<size_t>((size_t)maxTexels, 65536);
+         maxLights = std::min(MAX_CLUSTERED_LIGHTS, maxTexelCount / 5);
+
+         lightsBuffer.create(GL_RGBA32F);
+         rangesBuffer.create(GL_RG32UI);
+         indicesBuffer.create(GL_R16UI);
+      }
+
+      LightClusters(const LightClusters& copy) = delete;
+      LightClusters& operator=(const LightClusters& copy) = delete;
+
+      ~LightClusters()
+      {
+         lightsBuffer.free();
+         rangesBuffer.free();
+         indicesBuffer.free();
+      }
+
+      // The lights in world space: the point lights come first, then the spot lights
+      void setPointLights(const std::vector<PointLight>& lights)
+      {
+         pointLights.clear();
+         for (size_t i = 0; i < lights.size(); i++)
+         {
+            PointLightStd140 packed = lights[i].pack();
+            pointLights.push_back(texels(packed.position, packed.radius, glm::vec3(0.0f), -2.0f, packed.lightAttrs));
+         }
+      }
+
+      void setSpotLights(const std::vector<SpotLight>& lights)
+      {
+         spotLights.clear();
+         for (size_t i = 0; i < lights.size(); i++)
+         {
+            SpotLightStd140 packed = lights[i].pack();
+            spotLights.push_back(texels(packed.position, packed.radius, packed.direction, std::cos(packed.cutoffAngle), packed.lightAttrs));
+         }
+      }
+
+      // Assigns the lights to the clusters and uploads them, to be called once per frame after the lights and
+      // the camera moved. The planes and the viewport must be the ones of projection and of the framebuffer
+      void update(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+                  GLsizei viewportWidth, GLsizei viewportHeight)
+      {
+         PROFILE_SCOPE("LightClusters::update");
+         stats = ClusterStats();
+
+         // the lights go to the GPU in view space, the world space spheres are culled
+         size_t lightCount = std::min(pointLights.size() + spotLights.size(), maxLights);
+         if(pointLights.size() + spotLights.size() > maxLights && !warned)
+         {
+            std::cout << "LightClusters: only the first " << maxLights << " lights are used" << std::endl;
+            warned = true;
+         }
+
+         viewLights.resize(lightCount);
+         culler.clear();
+         rangedLights.clear();
+         globalLights.clear();
+         for (size_t i = 0; i < lightCount; i++)
+         {
+            const ClusterLightTexels& light = i < pointLights.size() ? pointLights[i] : spotLights[i - pointLights.size()];
+            ClusterLightTexels& viewLight = viewLights[i];
+            viewLight = light;
+            viewLight.positionRadius = glm::vec4(glm::vec3(view * glm::vec4(glm::vec3(light.positionRadius), 1.0f)), light.positionRadius.w);
+            viewLight.directionCutoff = glm::vec4(glm::mat3(view) * glm::vec3(light.directionCutoff), light.directionCutoff.w);
+
+            if(light.positionRadius.w > 0.0f)
+            {
+               culler.add(BoundingSphere{glm::vec3(light.positionRadius), light.positionRadius.w});
+               rangedLights.push_back((uint32_t)i);
+            }
+            else
+            {
+               globalLights.push_back((uint16_t)i);
+            }
+         }
+         stats.lights = lightCount;
+         stats.globalLights = globalLights.size();
+         stats.culled = culler.cull(Frustum(projection * view), visibleLights);
+
+         // exponential slices: slice = log(depth) * sliceScale + sliceBias, 0 at the near plane and CLUSTERS_Z at the far one
+         float logDepthRange = std::log(farPlane / nearPlane);
+         block.clusterCounts[0] = CLUSTERS_X; block.clusterCounts[1] = CLUSTERS_Y; block.clusterCounts[2] = CLUSTERS_Z;
+         block.sliceScale = CLUSTERS_Z / logDepthRange;
+         block.sliceBias  = -(float)CLUSTERS_Z * std::log(nearPlane) / logDepthRange;
+         block.tileSize   = glm::vec2((float)viewportWidth / CLUSTERS_X, (float)viewportHeight / CLUSTERS_Y);
+
+         // every cluster has the global lights, then the (cluster, light) pairs of the ranged ones are counted
+         counts.assign(CLUSTER_COUNT, (uint32_t)globalLights.size());
+         pairs.clear();
+         for (uint32_t visible : visibleLights)
+         {
+            assign(rangedLights[visible], projection, nearPlane, farPlane);
+         }
+
+         // counting sort of the pairs by cluster, each cluster keeps at most the indices left in the texture buffer
+         ranges.resize(CLUSTER_COUNT);
+         cursors.resize(CLUSTER_COUNT);
+         size_t offset = 0;
+         for (size_t c = 0; c < CLUSTER_COUNT; c++)
+         {
+            uint32_t count = (uint32_t)std::min<size_t>(counts[c], maxTexelCount - offset);
+            ranges[c] = ClusterRange{(GLuint)offset, count};
+            offset += count;
+            stats.maxPerCluster = std::max<size_t>(stats.maxPerCluster, count);
+         }
+         stats.indices = offset;
+
+         indices.resize(std::max<size_t>(offset, 1));
+         for (size_t c = 0; c < CLUSTER_COUNT; c++)
+         {
+            size_t globals = std::min<size_t>(globalLights.size(), ranges[c].count);
+            std::copy(globalLights.begin(), globalLights.begin() + globals, indices.begin() + ranges[c].offset);
+            cursors[c] = (uint32_t)(ranges[c].offset + globals);
+         }
+         for (const ClusterPair& pair : pairs)
+         {
+            if(cursors[pair.cluster] < ranges[pair.cluster].offset + ranges[pair.cluster].count) indices[cursors[pair.cluster]++] = pair.light;
+         }
+
+         if(!viewLights.empty()) lightsBuffer.upload(viewLights.data(), viewLights.size() * sizeof(ClusterLightTexels));
+         rangesBuffer.upload(ranges.data(), ranges.size() * sizeof(ClusterRange));
+         indicesBuffer.upload(indices.data(), indices.size() * sizeof(uint16_t));
+         blockUBO.orphanAndUpdate(&block);
+
+         bind();
+      }
+
+      // Points the samplers of clusters.utils to the texture units, to be called once after each build of the program
+      void setSamplers(const Shader& shader) const
+      {
+         shader.use();
+         shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+         shader.setInt("clusterRanges", CLUSTER_RANGES_UNIT);
+         shader.setInt("clusterLightIndices", CLUSTER_INDICES_UNIT);
+      }
+
+      // Binds the texture buffers to their units (update() already does it)
+      void bind() const
+      {
+         glState().bindTexture(CLUSTER_LIGHTS_UNIT, GL_TEXTURE_BUFFER, lightsBuffer.texture);
+         glState().bindTexture(CLUSTER_RANGES_UNIT, GL_TEXTURE_BUFFER, rangesBuffer.texture);
+         glState().bindTexture(CLUSTER_INDICES_UNIT, GL_TEXTURE_BUFFER, indicesBuffer.texture);
+      }
+
+      const ClusterStats& lastStats() const noexcept { return stats; }
+
+   private:
+      // A buffer read through a buffer texture
+      struct TextureBuffer
+      {
+         GLuint buffer = 0, texture = 0;
+         size_t capacity = 0;
+
+         void create(GLenum internalFormat)
+         {
+            glGenBuffers(1, &buffer);
+            glGenTextures(1, &texture);
+            capacity = 256;
+            glState().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+            glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+            // the texture follows the buffer, even when its storage is reallocated
+            glState().bindTexture(0, GL_TEXTURE_BUFFER, texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, internalFormat, buffer);
+            glState().bindTexture(0, GL_TEXTURE_BUFFER, 0);
+         }
+
+         // The storage is orphaned at every upload, the draws of the previous frame may still read it
+         void upload(const void* data, size_t bytes)
+         {
+            glState().bindBuffer(GL_TEXTURE_BUFFER, buffer);
+            // we grow geometrically, the number of indices changes a little every frame
+            if(bytes > capacity) capacity = std::max(bytes, capacity * 2);
+            glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+            METRIC_ADD(METRIC_BUFFER_BYTES, bytes);
+         }
+
+         void free()
+         {
+            if(texture) glState().deleteTexture(texture);
+            if(buffer)  glState().deleteBuffer(buffer);
+            texture = buffer = 0;
+         }
+      };
+
+      struct ClusterPair
+      {
+         uint32_t cluster;
+         uint16_t light;
+      };
+
+      std::vector<ClusterLightTexels> pointLights, spotLights, viewLights;
+      size_t maxTexelCount, maxLights;
+      bool warned = false;
+
+      SphereCuller culler;
+      std::vector<uint32_t> rangedLights, visibleLights;
+      std::vector<uint16_t> globalLights;
+
+      std::vector<uint32_t> counts, cursors;
+      std::vector<ClusterPair> pairs;
+      std::vector<ClusterRange> ranges;
+      std::vector<uint16_t> indices;
+
+      ClusterBlockStd140 block{};
+      UniformBuffer blockUBO;
+      TextureBuffer lightsBuffer, rangesBuffer, indicesBuffer;
+      ClusterStats stats;
+
+      static ClusterLightTexels texels(glm::vec3 position, float radius, glm::vec3 direction, float cosCutoff,
+                                       const LightAttributesStd140& attrs)
+      {
+         return ClusterLightTexels{glm::vec4(position, radius), glm::vec4(direction, cosCutoff), glm::vec4(attrs.ambient, attrs.kA),
+                                   glm::vec4(attrs.diffuse, attrs.kD), glm::vec4(attrs.specular, attrs.kS)};
+      }
+
+      // Slice of the clusters at a view depth, as clusterLightRange() in clusters.utils
+      int slice(float depth) const
+      {
+         return (int)std::floor(std::log(depth) * block.sliceScale + block.sliceBias);
+      }
+
+      // Depth where a slice starts
+      float sliceDepth(int slice, float nearPlane, float farPlane) const
+      {
+         return nearPlane * std::pow(farPlane / nearPlane, (float)slice / CLUSTERS_Z);
+      }
+
+      // Adds the pairs of a visible ranged light: in each slice it overlaps, the tiles under the screen bounds
+      // of its sphere between the depths of the slice (a conservative box: x / depth is the largest at the nearest
+      // depth on the positive side, and at the farthest one on the negative side)
+      void assign(uint32_t light, const glm::mat4& projection, float nearPlane, float farPlane)
+      {
+         glm::vec3 center = glm::vec3(viewLights[light].positionRadius);
+         float radius = viewLights[light].positionRadius.w;
+         // the camera looks down -z
+         float depth = -center.z;
+
+         float minDepth = std::max(depth - radius, nearPlane), maxDepth = std::min(depth + radius, farPlane);
+         if(minDepth > maxDepth) return;
+
+         int firstSlice = std::max(slice(minDepth), 0), lastSlice = std::min(slice(maxDepth), (int)CLUSTERS_Z - 1);
+         for (int z = firstSlice; z <= lastSlice; z++)
+         {
+            float sliceNear = std::max(sliceDepth(z, nearPlane, farPlane), minDepth);
+            float sliceFar  = std::min(sliceDepth(z + 1, nearPlane, farPlane), maxDepth);
+
+            // screen bounds in NDC, then in tiles (projection[0][0] and [1][1] scale x / depth and y / depth)
+            float minX = projection[0][0] * (center.x - radius) / (center.x - radius < 0.0f ? sliceNear : sliceFar);
+            float maxX = projection[0][0] * (center.x + radius) / (center.x + radius > 0.0f ? sliceNear : sliceFar);
+            float minY = projection[1][1] * (center.y - radius) / (center.y - radius < 0.0f ? sliceNear : sliceFar);
+            float maxY = projection[1][1] * (center.y + radius) / (center.y + radius > 0.0f ? sliceNear : sliceFar);
+
+            int firstX = tile(minX, CLUSTERS_X), lastX = tile(maxX, CLUSTERS_X);
+            int firstY = tile(minY, CLUSTERS_Y), lastY = tile(maxY, CLUSTERS_Y);
+            for (int y = firstY; y <= lastY; y++)
+            {
+               for (int x = firstX; x <= lastX; x++)
+               {
+                  uint32_t cluster = ((uint32_t)z * CLUSTERS_Y + (uint32_t)y) * CLUSTERS_X + (uint32_t)x;
+                  pairs.push_back(ClusterPair{cluster, (uint16_t)light});
+                  counts[cluster]++;
+               }
+            }
+         }
+      }
+
+      // Tile of a NDC coordinate, clamped to the grid
+      static int tile(float ndc, GLuint tiles)
+      {
+         int t = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+         return std::min(std::max(t, 0), (int)tiles - 1);
+      }
+};
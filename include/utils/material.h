@@ -0,0 +1,39 @@
+#pragma once
+/*
+   Material class
+   - surface parameters read by lighting.frag (and gbuffer.frag), shared by every object drawn with them
+*/
+
+#include <utils/shader.h>
+
+class Material
+{
+   public:
+      float shininess; // exponent of the Phong and Blinn-Phong specular lobes
+      float alpha;     // rugosity of GGX - 0 : smooth, 1: rough
+      float F0;        // fresnel reflectance at normal incidence
+
+      Material(float shininess = 25.0f, float alpha = 0.2f, float F0 = 0.9f) :
+         shininess(shininess), alpha(alpha), F0(F0) {}
+
+      // Sets the parameters on the shader, which must be in use
+      void apply(const Shader& shader) const
+      {
+         if(cachedSerial != shader.serial())
+         {
+            cachedSerial     = shader.serial();
+            shininessUniform = shader.uniform("shininess");
+            alphaUniform     = shader.uniform("alpha");
+            F0Uniform        = shader.uniform("F0");
+         }
+
+         shader.setFloat(shininessUniform, shininess);
+         shader.setFloat(alphaUniform, alpha);
+         shader.setFloat(F0Uniform, F0);
+      }
+
+   private:
+      // uniform handles of the last program this material was applied to (see Shader::serial())
+      mutable uint32_t cachedSerial = 0;
+      mutable UniformHandle shininessUniform, alphaUniform, F0Uniform;
+};
@@ -2,10 +2,15 @@
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <vector>
 #include <string>
 #include <iostream>
+#include <algorithm>
+
+#include <utils/gl_state.h>
+#include <utils/metrics.h>
 
 struct Vertex
 {
@@ -13,22 +18,237 @@ struct Vertex
    glm::vec2 texCoords;
 };
 
+// CPU side geometry of a mesh, not yet uploaded to the GPU (it can be produced by any thread)
+struct MeshData
+{
+   std::vector<Vertex> vertices;
+   std::vector<GLuint> indices;                 // full detail triangles (LOD 0)
+   std::vector<std::vector<GLuint>> lodIndices; // simplified triangles of LOD 1, 2, ... over the same vertices
+
+   MeshData() = default;
+   // the indices of the LODs follow the ones of LOD 0 in i, lodIndexCounts holds their sizes
+   MeshData(const Vertex* v, size_t vertexCount, const GLuint* i, size_t indexCount, const GLuint* lodIndexCounts = nullptr, size_t lodCount = 0) :
+      vertices(v, v + vertexCount), indices(i, i + indexCount)
+   {
+      const GLuint* lod = i + indexCount;
+      for (size_t l = 0; l < lodCount; l++)
+      {
+         lodIndices.emplace_back(lod, lod + lodIndexCounts[l]);
+         lod += lodIndexCounts[l];
+      }
+   }
+
+   // Indices of all the LODs
+   size_t totalIndexCount() const noexcept
+   {
+      size_t count = indices.size();
+      for (size_t l = 0; l < lodIndices.size(); l++) { count += lodIndices[l].size(); }
+      return count;
+   }
+};
+
+// Range of the index buffer drawn for one level of detail
+struct IndexRange
+{
+   GLuint firstIndex;
+   GLuint indexCount;
+};
+
+struct BoundingSphere
+{
+   glm::vec3 center;
+   float radius;
+};
+
+// Axis aligned bounding box
+struct BoundingBox
+{
+   glm::vec3 minCorner, maxCorner;
+};
+
+// Smallest box containing both boxes
+inline BoundingBox mergeBoxes(const BoundingBox& a, const BoundingBox& b)
+{
+   return BoundingBox{glm::min(a.minCorner, b.minCorner), glm::max(a.maxCorner, b.maxCorner)};
+}
+
+// Smallest sphere containing both spheres
+inline BoundingSphere mergeSpheres(const BoundingSphere& a, const BoundingSphere& b)
+{
+   glm::vec3 offset = b.center - a.center;
+   float distance = glm::length(offset);
+
+   if(distance + b.radius <= a.radius) return a;
+   if(distance + a.radius <= b.radius) return b;
+
+   float radius = (distance + a.radius + b.radius) * 0.5f;
+   return BoundingSphere{a.center + offset * ((radius - a.radius) / distance), radius};
+}
+
+// Per-instance attributes for instanced draws: world space model and normal matrices
+struct InstanceData
+{
+   glm::mat4 modelMatrix;
+   glm::mat3 normalMatrix;
+};
+
+// First attribute location of the per-instance data (model matrix uses 5-8, normal matrix 9-11)
+const GLuint INSTANCE_ATTRIB_LOCATION = 5;
+
+// Formats a Mesh can be uploaded with: the CPU side copy is always made of full Vertex structs
+enum VertexFormat
+{
+   VERTEX_FULL,    // 56 bytes, every attribute as floats
+   VERTEX_COMPACT, // 24 bytes, see CompactVertex
+};
+
+// Vertex as stored in GPU memory by the VERTEX_COMPACT format:
+// - normal and tangent are 10:10:10:2 signed normalized, the 2 bits of the tangent w hold the handedness of the
+//   tangent frame, so the bitangent is not stored (location 4 is left disabled). None of our shaders read
+//   tangents yet: a normal mapping shader will have to rebuild the bitangent as
+//   cross(normal, tangent.xyz) * sign(tangent.w) (sign() because GL 4.1 converts the 2 bits -1 to -1/3)
+// - texture coordinates are half floats
+struct CompactVertex
+{
+   glm::vec3 position;
+   GLuint    normal;
+   GLuint    tangent;
+   GLuint    texCoords;
+};
+static_assert(sizeof(CompactVertex) == 24, "CompactVertex must be tightly packed");
+
+inline CompactVertex packVertex(const Vertex& v)
+{
+   float handedness = glm::dot(glm::cross(v.normal, v.tangent), v.bitangent) < 0.0f ? -1.0f : 1.0f;
+
+   CompactVertex packed;
+   packed.position  = v.position;
+   packed.normal    = glm::packSnorm3x10_1x2(glm::vec4(v.normal, 0.0f));
+   packed.tangent   = glm::packSnorm3x10_1x2(glm::vec4(v.tangent, handedness));
+   packed.texCoords = glm::packHalf2x16(v.texCoords);
+   return packed;
+}
+
+// One vertex attribute, as passed to glVertexAttribPointer
+struct VertexAttribute
+{
+   GLuint    location;
+   GLint     size;
+   GLenum    type;
+   GLboolean normalized;
+   size_t    offset;
+};
+
+// Memory layout of the vertices of a VAO
+struct VertexLayout
+{
+   GLsizei stride;
+   std::vector<VertexAttribute> attributes;
+};
+
+inline const VertexLayout& vertexLayout(VertexFormat format)
+{
+   static const VertexLayout full
+   {
+      sizeof(Vertex),
+      {
+         {0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position)},  // positions (location = 0 in shader)
+         {1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal)},    // normals (location = 1 in shader)
+         {2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, texCoords)}, // texcoords (location = 2 in shader)
+         {3, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, tangent)},   // tangent (location = 3 in shader)
+         {4, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, bitangent)}, // bitangent (location = 4 in shader)
+      }
+   };
+   static const VertexLayout compact
+   {
+      sizeof(CompactVertex),
+      {
+         {0, 3, GL_FLOAT,               GL_FALSE, offsetof(CompactVertex, position)},
+         {1, 4, GL_INT_2_10_10_10_REV,  GL_TRUE,  offsetof(CompactVertex, normal)},
+         {2, 2, GL_HALF_FLOAT,          GL_FALSE, offsetof(CompactVertex, texCoords)},
+         {3, 4, GL_INT_2_10_10_10_REV,  GL_TRUE,  offsetof(CompactVertex, tangent)},
+      }
+   };
+   return format == VERTEX_COMPACT ? compact : full;
+}
+
+// Describes a vertex layout to the currently bound VAO, reading from the currently bound GL_ARRAY_BUFFER
+inline void setupVertexAttributes(const VertexLayout& layout = vertexLayout(VERTEX_FULL))
+{
+   for (const VertexAttribute& attribute : layout.attributes)
+   {
+      glEnableVertexAttribArray(attribute.location);
+      glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, layout.stride, (GLvoid*)attribute.offset);
+   }
+}
+
+// Describes the InstanceData layout to the currently bound VAO, reading from the currently bound GL_ARRAY_BUFFER
+// starting at baseOffset, and advancing once per instance
+inline void setupInstanceAttributes(GLintptr baseOffset = 0)
+{
+   // a matrix attribute takes one location per column
+   for (GLuint i = 0; i < 4; i++)
+   {
+      GLuint location = INSTANCE_ATTRIB_LOCATION + i;
+      glEnableVertexAttribArray(location);
+      glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)(baseOffset + offsetof(InstanceData, modelMatrix) + i * sizeof(glm::vec4)));
+      glVertexAttribDivisor(location, 1);
+   }
+   for (GLuint i = 0; i < 3; i++)
+   {
+      GLuint location = INSTANCE_ATTRIB_LOCATION + 4 + i;
+      glEnableVertexAttribArray(location);
+      glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)(baseOffset + offsetof(InstanceData, normalMatrix) + i * sizeof(glm::vec3)));
+      glVertexAttribDivisor(location, 1);
+   }
+}
+
 class Mesh
 {
    public:
       std::vector<Vertex> vertices;
-      std::vector<GLuint> indices;
+      std::vector<GLuint> indices; // LOD 0 only, the simplified LODs live in the GPU buffer alone
+      std::vector<IndexRange> lods;
+      BoundingSphere bounds;
+      BoundingBox box;
+      VertexFormat format;
       GLuint VAO;
 
-      Mesh(std::vector<Vertex>& v, std::vector<GLuint>& i) noexcept :
-         vertices(std::move(v)), indices(std::move(i)) { setupMesh();}
+      Mesh(std::vector<Vertex>& v, std::vector<GLuint>& i, VertexFormat format = VERTEX_FULL) noexcept :
+         vertices(std::move(v)), indices(std::move(i)), format(format)
+      {
+         setupLods(nullptr, 0);
+         setupMesh(vertices.data(), indices.data());
+      }
+
+      // Uploads geometry prepared by another thread, taking ownership of its arrays
+      Mesh(MeshData&& data, VertexFormat format = VERTEX_FULL) noexcept :
+         vertices(std::move(data.vertices)), indices(std::move(data.indices)), format(format)
+      {
+         std::vector<GLuint> lodIndexCounts;
+         for (size_t l = 0; l < data.lodIndices.size(); l++) { lodIndexCounts.push_back((GLuint)data.lodIndices[l].size()); }
+         setupLods(lodIndexCounts.data(), lodIndexCounts.size());
+
+         setupMesh(vertices.data(), indices.data(), data.lodIndices);
+      }
+
+      // Builds the mesh from raw arrays (e.g. a memory mapped cache file): the GPU buffers are filled
+      // straight from the given memory, and the CPU copies are made with a single bulk copy.
+      // The indices of the LODs follow the ones of LOD 0 in i, lodIndexCounts holds their sizes
+      Mesh(const Vertex* v, size_t vertexCount, const GLuint* i, size_t indexCount,
+           const GLuint* lodIndexCounts = nullptr, size_t lodCount = 0, VertexFormat format = VERTEX_FULL) noexcept :
+         vertices(v, v + vertexCount), indices(i, i + indexCount), format(format)
+      {
+         setupLods(lodIndexCounts, lodCount);
+         setupMesh(v, i);
+      }
 
       Mesh(const Mesh& copy) = delete;
       Mesh& operator=(const Mesh& copy) = delete;
 
       Mesh(Mesh&& move) noexcept : 
-         vertices(std::move(move.vertices)), indices(std::move(move.indices)),
-         VAO(move.VAO), VBO(move.VBO), EBO(move.EBO)
+         vertices(std::move(move.vertices)), indices(std::move(move.indices)), lods(std::move(move.lods)),
+         bounds(move.bounds), box(move.box), format(move.format), VAO(move.VAO), VBO(move.VBO), EBO(move.EBO)
       {
          move.VAO = 0;
       }
@@ -42,6 +262,10 @@ class Mesh
          {
             vertices = std::move(move.vertices);
             indices = std::move(move.indices);
+            lods = std::move(move.lods);
+            bounds = move.bounds;
+            box = move.box;
+            format = move.format;
             VAO = move.VAO; VBO = move.VBO; EBO = move.EBO;
 
             move.VAO = 0;
@@ -59,54 +283,122 @@ class Mesh
          freeGPU();
       }
 
-      void draw() const
+      // Levels past the last one available draw the last one.
+      // The VAO stays bound: the state cache skips the bind when the next draw uses the same mesh
+      void draw(size_t lod = 0) const
       {
-         glBindVertexArray(VAO);
-         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-         glBindVertexArray(0);
+         const IndexRange& range = lodRange(lod);
+
+         glState().bindVertexArray(VAO);
+         glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (GLvoid*)(range.firstIndex * sizeof(GLuint)));
+         METRIC_ADD(METRIC_DRAW_CALLS, 1);
+         METRIC_ADD(METRIC_TRIANGLES, range.indexCount / 3);
       }  
 
+      size_t lodCount() const noexcept { return lods.size(); }
+
+      // Indices of a level of detail, the last one for the levels this mesh does not have
+      const IndexRange& lodRange(size_t lod) const { return lods[std::min(lod, lods.size() - 1)]; }
+
+      void drawInstanced(GLsizei instanceCount) const
+      {
+         glState().bindVertexArray(VAO);
+         glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, instanceCount);
+         METRIC_ADD(METRIC_DRAW_CALLS, 1);
+         METRIC_ADD(METRIC_TRIANGLES, indices.size() / 3 * instanceCount);
+      }
+
+      // Sources the per-instance attributes of the VAO from an InstanceData buffer, advancing once per instance
+      void bindInstanceBuffer(GLuint instanceVBO) const
+      {
+         glState().bindVertexArray(VAO);
+         glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+         setupInstanceAttributes();
+      }
+
    private:
       GLuint VBO, EBO;
 
-      void setupMesh()
+      // LOD 0 is the whole indices array, every other LOD follows the previous one in the index buffer
+      void setupLods(const GLuint* lodIndexCounts, size_t lodCount)
       {
+         lods.push_back(IndexRange{0, (GLuint)indices.size()});
+         for (size_t l = 0; l < lodCount; l++)
+         {
+            lods.push_back(IndexRange{lods.back().firstIndex + lods.back().indexCount, lodIndexCounts[l]});
+         }
+      }
+
+      // If lodIndices is empty, indexData holds the indices of all the LODs one after the other
+      void setupMesh(const Vertex* vertexData, const GLuint* indexData, const std::vector<std::vector<GLuint>>& lodIndices = {})
+      {
+         computeBounds();
+
          glGenVertexArrays(1, &VAO);
          glGenBuffers(1, &VBO);
          glGenBuffers(1, &EBO);
          
          // VAO is made "active"    
-         glBindVertexArray(VAO);
+         glState().bindVertexArray(VAO);
          // we copy data in the VBO - we must set the data dimension, and the pointer to the structure cointaining the data
-         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+         glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+         if(format == VERTEX_COMPACT)
+         {
+            std::vector<CompactVertex> packed(vertices.size());
+            for (size_t i = 0; i < packed.size(); i++) { packed[i] = packVertex(vertexData[i]); }
+            glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(CompactVertex), packed.data(), GL_STATIC_DRAW);
+         }
+         else
+         {
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
+         }
          // we copy data in the EBO - we must set the data dimension, and the pointer to the structure cointaining the data
-         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-         glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+         glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+         GLsizeiptr indexBytes = (lods.back().firstIndex + lods.back().indexCount) * sizeof(GLuint);
+         if(lodIndices.empty())
+         {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexData, GL_STATIC_DRAW);
+         }
+         else
+         {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, NULL, GL_STATIC_DRAW);
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(GLuint), indexData);
+            for (size_t l = 0; l < lodIndices.size(); l++)
+            {
+               glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, lods[l + 1].firstIndex * sizeof(GLuint), lodIndices[l].size() * sizeof(GLuint), lodIndices[l].data());
+            }
+         }
 
-         // positions (location = 0 in shader)
-         glEnableVertexAttribArray(0);
-         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+         METRIC_ADD(METRIC_BUFFER_BYTES, (format == VERTEX_COMPACT ? sizeof(CompactVertex) : sizeof(Vertex)) * vertices.size() + indexBytes);
 
-         // normals (location = 1 in shader)
-         glEnableVertexAttribArray(1);
-         glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal));
+         setupVertexAttributes(vertexLayout(format));
 
-         // texcoords (location = 2 in shader)
-         glEnableVertexAttribArray(2);
-         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, texCoords));
-         
-         // tangent (location = 3 in shader)
-         glEnableVertexAttribArray(3);
-         glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, tangent));
+         glState().bindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+         glState().bindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
 
-         // bitangent (location = 4 in shader)
-         glEnableVertexAttribArray(4);
-         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, bitangent));
+      }
 
-         glBindBuffer(GL_ARRAY_BUFFER, 0); // Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
-         glBindVertexArray(0); // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
+      // Bounding box of the vertices, and the sphere around it
+      void computeBounds()
+      {
+         bounds = BoundingSphere{glm::vec3(0.0f), 0.0f};
+         box = BoundingBox{glm::vec3(0.0f), glm::vec3(0.0f)};
+         if(vertices.empty()) return;
 
+         glm::vec3 minCorner = vertices[0].position, maxCorner = vertices[0].position;
+         for (size_t i = 1; i < vertices.size(); i++)
+         {
+            minCorner = glm::min(minCorner, vertices[i].position);
+            maxCorner = glm::max(maxCorner, vertices[i].position);
+         }
+
+         box = BoundingBox{minCorner, maxCorner};
+         bounds.center = (minCorner + maxCorner) * 0.5f;
+         for (size_t i = 0; i < vertices.size(); i++)
+         {
+            bounds.radius = std::max(bounds.radius, glm::distance(bounds.center, vertices[i].position));
+         }
       }
 
       void freeGPU()
@@ -114,9 +406,9 @@ class Mesh
          // Check if we have something in GPU
          if(VAO)
          {
-            glDeleteVertexArrays(1, &VAO);
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
+            glState().deleteVertexArray(VAO);
+            glState().deleteBuffer(VBO);
+            glState().deleteBuffer(EBO);
          }
       }
 };
\ No newline at end of file
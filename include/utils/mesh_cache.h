@@ -0,0 +1,252 @@
+#pragma once
+/*
+   MeshCache class
+   - binary cache of the meshes imported from a model file, written next to it after the first import
+   - on the following loads the cache file is memory mapped and the meshes are built straight from it
+*/
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+   #ifndef WIN32_LEAN_AND_MEAN
+      #define WIN32_LEAN_AND_MEAN
+   #endif
+   #ifndef NOMINMAX
+      #define NOMINMAX
+   #endif
+   #include <windows.h>
+#else
+   #include <sys/mman.h>
+   #include <fcntl.h>
+   #include <unistd.h>
+#endif
+
+#include <utils/mesh.h>
+#include <utils/hash.h>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+   public:
+      MappedFile(const std::string& path) noexcept : ptr(nullptr), length(0)
+      {
+      #ifdef _WIN32
+         file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+         if(file == INVALID_HANDLE_VALUE) return;
+
+         LARGE_INTEGER fileSize;
+         if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+         mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+         if(!mapping) return;
+
+         ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+         if(ptr) length = (size_t)fileSize.QuadPart;
+      #else
+         fd = open(path.c_str(), O_RDONLY);
+         if(fd == -1) return;
+
+         struct stat fileStat;
+         if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) return;
+
+         void* mapped = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if(mapped == MAP_FAILED) return;
+
+         ptr = static_cast<const char*>(mapped);
+         length = (size_t)fileStat.st_size;
+      #endif
+      }
+
+      MappedFile(const MappedFile& copy) = delete;
+      MappedFile& operator=(const MappedFile& copy) = delete;
+
+      ~MappedFile() noexcept
+      {
+      #ifdef _WIN32
+         if(ptr) UnmapViewOfFile(ptr);
+         if(mapping) CloseHandle(mapping);
+         if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+      #else
+         if(ptr) munmap(const_cast<char*>(ptr), length);
+         if(fd != -1) close(fd);
+      #endif
+      }
+
+      bool        valid() const noexcept { return ptr != nullptr; }
+      const char* data()  const noexcept { return ptr; }
+      size_t      size()  const noexcept { return length; }
+
+   private:
+      const char* ptr;
+      size_t length;
+   #ifdef _WIN32
+      HANDLE file = INVALID_HANDLE_VALUE;
+      HANDLE mapping = NULL;
+   #else
+      int fd = -1;
+   #endif
+};
+
+class MeshCache
+{
+   public:
+      // Bumped every time the file layout (or the Vertex struct) changes
+      static const uint32_t VERSION = 3;
+
+      static std::string cachePath(const std::string& sourcePath) { return sourcePath + ".meshcache"; }
+
+      // Fills meshes from the cache of sourcePath, returns false if the cache is missing or stale
+      // (importFlags are the options of the import pipeline, a cache written with different ones is stale).
+      // T is Mesh (GL thread, buffers filled straight from the mapping) or MeshData (any thread),
+      // args are appended to the arguments of every T constructor (e.g. the VertexFormat of a Mesh)
+      template <typename T, typename... Args>
+      static bool load(const std::string& sourcePath, uint32_t importFlags, std::vector<T>& meshes, const Args&... args)
+      {
+         Header expected;
+         if(!stampSource(sourcePath, importFlags, expected)) return false;
+
+         MappedFile cache(cachePath(sourcePath));
+         if(!cache.valid() || cache.size() < sizeof(Header)) return false;
+
+         Header header;
+         std::memcpy(&header, cache.data(), sizeof(Header));
+         if(std::memcmp(&header, &expected, offsetof(Header, meshCount)) != 0) return false;
+
+         // we validate the whole file before creating any mesh
+         size_t offset = sizeof(Header);
+         for (uint32_t i = 0; i < header.meshCount; i++)
+         {
+            MeshEntry entry;
+            if(!readEntry(cache, offset, entry)) return false;
+            offset += sizeof(MeshEntry);
+            if(offset + entry.lodCount * sizeof(uint32_t) > cache.size()) return false;
+
+            size_t lodIndexCount = 0;
+            const uint32_t* lodIndexCounts = reinterpret_cast<const uint32_t*>(cache.data() + offset);
+            offset += entry.lodCount * sizeof(uint32_t);
+            for (uint32_t l = 0; l < entry.lodCount; l++) { lodIndexCount += lodIndexCounts[l]; }
+
+            offset += entry.vertexCount * sizeof(Vertex) + (entry.indexCount + lodIndexCount) * sizeof(GLuint);
+            if(offset > cache.size()) return false;
+         }
+         if(offset != cache.size()) return false;
+
+         meshes.reserve(meshes.size() + header.meshCount);
+         offset = sizeof(Header);
+         for (uint32_t i = 0; i < header.meshCount; i++)
+         {
+            MeshEntry entry;
+            readEntry(cache, offset, entry);
+            offset += sizeof(MeshEntry);
+
+            // all the arrays are 4 bytes aligned in the file, so they can be read in place
+            const GLuint* lodIndexCounts = reinterpret_cast<const GLuint*>(cache.data() + offset);
+            offset += entry.lodCount * sizeof(uint32_t);
+            const Vertex* vertices = reinterpret_cast<const Vertex*>(cache.data() + offset);
+            offset += entry.vertexCount * sizeof(Vertex);
+            // the indices of the LODs follow the ones of LOD 0
+            const GLuint* indices  = reinterpret_cast<const GLuint*>(cache.data() + offset);
+            offset += entry.indexCount * sizeof(GLuint);
+            for (uint32_t l = 0; l < entry.lodCount; l++) { offset += lodIndexCounts[l] * sizeof(GLuint); }
+
+            meshes.emplace_back(vertices, entry.vertexCount, indices, entry.indexCount, lodIndexCounts, entry.lodCount, args...);
+         }
+         return true;
+      }
+
+      template <typename T>
+      static bool save(const std::string& sourcePath, uint32_t importFlags, const std::vector<T>& meshes)
+      {
+         Header header;
+         if(!stampSource(sourcePath, importFlags, header)) return false;
+         header.meshCount = (uint32_t)meshes.size();
+
+         std::ofstream cache(cachePath(sourcePath), std::ios::binary | std::ios::trunc);
+         cache.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+         for (size_t i = 0; i < meshes.size(); i++)
+         {
+            const std::vector<std::vector<GLuint>>& lodIndices = meshes[i].lodIndices;
+
+            MeshEntry entry{(uint32_t)meshes[i].vertices.size(), (uint32_t)meshes[i].indices.size(), (uint32_t)lodIndices.size(), 0};
+            cache.write(reinterpret_cast<const char*>(&entry), sizeof(MeshEntry));
+            for (size_t l = 0; l < lodIndices.size(); l++)
+            {
+               uint32_t lodIndexCount = (uint32_t)lodIndices[l].size();
+               cache.write(reinterpret_cast<const char*>(&lodIndexCount), sizeof(uint32_t));
+            }
+            cache.write(reinterpret_cast<const char*>(meshes[i].vertices.data()), entry.vertexCount * sizeof(Vertex));
+            cache.write(reinterpret_cast<const char*>(meshes[i].indices.data()), entry.indexCount * sizeof(GLuint));
+            for (size_t l = 0; l < lodIndices.size(); l++)
+            {
+               cache.write(reinterpret_cast<const char*>(lodIndices[l].data()), lodIndices[l].size() * sizeof(GLuint));
+            }
+         }
+
+         if(!cache)
+         {
+            std::cout << "Warning: could not write mesh cache " << cachePath(sourcePath) << std::endl;
+            return false;
+         }
+         return true;
+      }
+
+   private:
+      struct Header
+      {
+         char     magic[8];
+         uint32_t version;
+         uint32_t vertexSize;
+         // identity of the source file the cache was built from
+         uint64_t sourceSize;
+         uint64_t sourceMtime;
+         uint64_t sourceHash;
+         uint32_t importFlags;
+         uint32_t meshCount;
+      };
+
+      // followed by lodCount index counts, the vertices, the indices of LOD 0 and the ones of every other LOD
+      struct MeshEntry
+      {
+         uint32_t vertexCount;
+         uint32_t indexCount;
+         uint32_t lodCount;
+         uint32_t pad0;
+      };
+
+      // Fills everything but meshCount with the values the cache of sourcePath must have
+      static bool stampSource(const std::string& sourcePath, uint32_t importFlags, Header& header)
+      {
+         std::memset(&header, 0, sizeof(Header));
+         std::memcpy(header.magic, "PGMESH", 6);
+         header.version     = VERSION;
+         header.vertexSize  = sizeof(Vertex);
+         header.importFlags = importFlags;
+
+         struct stat sourceStat;
+         if(stat(sourcePath.c_str(), &sourceStat) != 0) return false;
+         header.sourceSize  = (uint64_t)sourceStat.st_size;
+         header.sourceMtime = (uint64_t)sourceStat.st_mtime;
+
+         // size and mtime alone miss files replaced with a copy keeping the same size and timestamp
+         MappedFile source(sourcePath);
+         if(!source.valid()) return false;
+         header.sourceHash = fnv1a(source.data(), source.size());
+         return true;
+      }
+
+      static bool readEntry(const MappedFile& cache, size_t offset, MeshEntry& entry)
+      {
+         if(offset + sizeof(MeshEntry) > cache.size()) return false;
+         std::memcpy(&entry, cache.data() + offset, sizeof(MeshEntry));
+         return true;
+      }
+};
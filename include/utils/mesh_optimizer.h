@@ -0,0 +1,322 @@
+#pragma once
+/*
+   MeshOptimizer class
+   - reorders the triangles of a mesh for the post-transform vertex cache (Forsyth's algorithm)
+   - reorders clusters of triangles so that the outer ones are drawn first, reducing overdraw
+   - reorders the vertices in the order they are first used, so the vertex fetch reads memory linearly
+   - measures the ACMR (average cache miss ratio, transformed vertices per triangle) and the
+     ATVR (average transformed vertex ratio, transformed vertices per vertex) of an index buffer
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <utils/mesh.h>
+
+struct MeshStats
+{
+   float acmr; // 3 is the worst case, 0.5 the ideal one for big regular meshes
+   float atvr; // 1 is the ideal case
+};
+
+class MeshOptimizer
+{
+   public:
+      // Cache size assumed by the vertex cache optimization
+      static const size_t CACHE_SIZE = 32;
+
+      // Runs all the passes, in the order they must be applied
+      static void optimize(MeshData& mesh)
+      {
+         // only triangle lists can be reordered
+         if(mesh.indices.size() % 3 != 0) return;
+
+         optimizeVertexCache(mesh.indices, mesh.vertices.size());
+         optimizeOverdraw(mesh.indices, mesh.vertices);
+         optimizeVertexFetch(mesh.vertices, mesh.indices);
+      }
+
+      // Simulates a FIFO post-transform cache of cacheSize entries over the index buffer
+      static MeshStats analyze(const std::vector<GLuint>& indices, size_t vertexCount, size_t cacheSize = 16)
+      {
+         MeshStats stats{0.0f, 0.0f};
+         if(indices.empty()) return stats;
+
+         // a vertex is in the FIFO if fewer than cacheSize misses happened since it entered
+         std::vector<size_t> timestamps(vertexCount, 0);
+         std::vector<bool> used(vertexCount, false);
+         size_t time = cacheSize + 1, misses = 0, usedCount = 0;
+
+         for (GLuint index : indices)
+         {
+            if(time - timestamps[index] > cacheSize)
+            {
+               timestamps[index] = time++;
+               misses++;
+            }
+            if(!used[index])
+            {
+               used[index] = true;
+               usedCount++;
+            }
+         }
+
+         stats.acmr = (float)misses / (float)(indices.size() / 3);
+         stats.atvr = (float)misses / (float)usedCount;
+         return stats;
+      }
+
+      // Tom Forsyth's "Linear-speed vertex cache optimisation": the next triangle is always the one
+      // with the best score among those using a cached vertex, where a vertex scores higher
+      // the more recently it was used and the fewer triangles it has left
+      static void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount)
+      {
+         const size_t triangleCount = indices.size() / 3;
+         const size_t NONE = std::numeric_limits<size_t>::max();
+         if(triangleCount == 0) return;
+
+         // triangles using each vertex, as one array with an offset per vertex
+         std::vector<GLuint> adjacencyOffset(vertexCount + 1, 0);
+         for (GLuint index : indices) { adjacencyOffset[index + 1]++; }
+         for (size_t v = 0; v < vertexCount; v++) { adjacencyOffset[v + 1] += adjacencyOffset[v]; }
+
+         std::vector<GLuint> adjacency(indices.size());
+         std::vector<GLuint> remaining(vertexCount, 0); // triangles not emitted yet of each vertex
+         for (size_t i = 0; i < indices.size(); i++)
+         {
+            GLuint v = indices[i];
+            adjacency[adjacencyOffset[v] + remaining[v]++] = (GLuint)(i / 3);
+         }
+
+         std::vector<int> cachePosition(vertexCount, -1);
+         std::vector<float> vertexScore(vertexCount);
+         for (size_t v = 0; v < vertexCount; v++) { vertexScore[v] = score(-1, remaining[v]); }
+
+         std::vector<float> triangleScore(triangleCount);
+         std::vector<bool> emitted(triangleCount, false);
+         size_t best = 0;
+         for (size_t t = 0; t < triangleCount; t++)
+         {
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+            if(triangleScore[t] > triangleScore[best]) best = t;
+         }
+
+         std::vector<GLuint> cache, newCache, result;
+         cache.reserve(CACHE_SIZE + 3);
+         newCache.reserve(CACHE_SIZE + 3);
+         result.reserve(indices.size());
+         size_t scanCursor = 0;
+
+         while(result.size() < indices.size())
+         {
+            if(best == NONE)
+            {
+               // no triangle left around the cache: we restart from the first one not emitted yet
+               while(emitted[scanCursor]) scanCursor++;
+               best = scanCursor;
+            }
+
+            emitted[best] = true;
+            newCache.clear();
+            for (size_t k = 0; k < 3; k++)
+            {
+               GLuint v = indices[best * 3 + k];
+               result.push_back(v);
+
+               // the triangle is removed from the ones left to the vertex
+               GLuint* triangles = &adjacency[adjacencyOffset[v]];
+               for (GLuint j = 0; j < remaining[v]; j++)
+               {
+                  if(triangles[j] == best)
+                  {
+                     triangles[j] = triangles[remaining[v] - 1];
+                     break;
+                  }
+               }
+               remaining[v]--;
+
+               if(std::find(newCache.begin(), newCache.end(), v) == newCache.end()) newCache.push_back(v);
+            }
+
+            // the vertices of the triangle move to the front of the cache (LRU), pushing the others back
+            for (GLuint v : cache)
+            {
+               if(std::find(newCache.begin(), newCache.end(), v) == newCache.end()) newCache.push_back(v);
+            }
+            for (size_t i = 0; i < newCache.size(); i++)
+            {
+               GLuint v = newCache[i];
+               cachePosition[v] = i < CACHE_SIZE ? (int)i : -1;
+               vertexScore[v] = score(cachePosition[v], remaining[v]);
+            }
+
+            // only the triangles around the cache changed their score, the best one is among them
+            best = NONE;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < newCache.size(); i++)
+            {
+               GLuint v = newCache[i];
+               const GLuint* triangles = &adjacency[adjacencyOffset[v]];
+               for (GLuint j = 0; j < remaining[v]; j++)
+               {
+                  size_t t = triangles[j];
+                  triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                  if(triangleScore[t] > bestScore)
+                  {
+                     bestScore = triangleScore[t];
+                     best = t;
+                  }
+               }
+            }
+
+            if(newCache.size() > CACHE_SIZE) newCache.resize(CACHE_SIZE);
+            cache.swap(newCache);
+         }
+
+         indices.swap(result);
+      }
+
+      // Sander et al. "Fast triangle reordering for vertex locality and reduced overdraw", on the
+      // output of optimizeVertexCache: the triangles are split in clusters where the cache restarts
+      // (none of the 3 vertices is cached, so the split costs no cache misses), then the clusters facing
+      // away from the center of the mesh are drawn first, as they are likely to occlude the others
+      static void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, size_t cacheSize = 16)
+      {
+         const size_t triangleCount = indices.size() / 3;
+         if(triangleCount < 2) return;
+
+         std::vector<size_t> clusterStart;
+         std::vector<size_t> timestamps(vertices.size(), 0);
+         size_t time = cacheSize + 1;
+         for (size_t t = 0; t < triangleCount; t++)
+         {
+            size_t misses = 0;
+            for (size_t k = 0; k < 3; k++)
+            {
+               GLuint v = indices[t * 3 + k];
+               if(time - timestamps[v] > cacheSize)
+               {
+                  timestamps[v] = time++;
+                  misses++;
+               }
+            }
+            if(misses == 3) clusterStart.push_back(t);
+         }
+         if(clusterStart.size() < 2) return;
+         clusterStart.push_back(triangleCount);
+
+         // area weighted centroids and normals, the cross product length being twice the triangle area
+         const size_t clusterCount = clusterStart.size() - 1;
+         std::vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f)), clusterNormal(clusterCount, glm::vec3(0.0f));
+         std::vector<float> clusterArea(clusterCount, 0.0f);
+         glm::vec3 meshCentroid(0.0f);
+         float meshArea = 0.0f;
+
+         for (size_t c = 0; c < clusterCount; c++)
+         {
+            for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+            {
+               const glm::vec3& p0 = vertices[indices[t * 3]].position;
+               const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+               const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+
+               glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+               float area = glm::length(normal);
+
+               clusterCentroid[c] = clusterCentroid[c] + (p0 + p1 + p2) * (area / 3.0f);
+               clusterNormal[c]   = clusterNormal[c] + normal;
+               clusterArea[c]    += area;
+            }
+            meshCentroid = meshCentroid + clusterCentroid[c];
+            meshArea    += clusterArea[c];
+         }
+         if(meshArea <= 0.0f) return;
+         meshCentroid = meshCentroid / meshArea;
+
+         std::vector<float> sortKey(clusterCount, 0.0f);
+         for (size_t c = 0; c < clusterCount; c++)
+         {
+            float normalLength = glm::length(clusterNormal[c]);
+            if(clusterArea[c] <= 0.0f || normalLength <= 0.0f) continue;
+
+            glm::vec3 centroid = clusterCentroid[c] / clusterArea[c];
+            sortKey[c] = glm::dot(centroid - meshCentroid, clusterNormal[c] / normalLength);
+         }
+
+         std::vector<size_t> order(clusterCount);
+         for (size_t c = 0; c < clusterCount; c++) { order[c] = c; }
+         std::stable_sort(order.begin(), order.end(), [&sortKey](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+         std::vector<GLuint> result;
+         result.reserve(indices.size());
+         for (size_t c : order)
+         {
+            result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+         }
+         indices.swap(result);
+      }
+
+      // Moves the vertices in the order the index buffer first uses them, and remaps the indices;
+      // vertices no triangle uses are dropped
+      static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+      {
+         const GLuint UNUSED = std::numeric_limits<GLuint>::max();
+         std::vector<GLuint> remap(vertices.size(), UNUSED);
+
+         std::vector<Vertex> reordered;
+         reordered.reserve(vertices.size());
+         for (GLuint& index : indices)
+         {
+            if(remap[index] == UNUSED)
+            {
+               remap[index] = (GLuint)reordered.size();
+               reordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+         }
+
+         vertices.swap(reordered);
+      }
+
+   private:
+      static const size_t VALENCE_TABLE_SIZE = 32;
+
+      // Score tables of Forsyth's algorithm, computed once
+      struct ScoreTables
+      {
+         float cache[CACHE_SIZE];
+         float valence[VALENCE_TABLE_SIZE];
+
+         ScoreTables()
+         {
+            for (size_t i = 0; i < CACHE_SIZE; i++)
+            {
+               // the 3 vertices of the last triangle get a fixed score, so that the next triangle
+               // does not just share an edge with it (which would be a strip, worse than a fan here)
+               cache[i] = i < 3 ? 0.75f : std::pow(1.0f - (float)(i - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+            }
+            valence[0] = 0.0f;
+            for (size_t i = 1; i < VALENCE_TABLE_SIZE; i++)
+            {
+               // vertices with few triangles left are boosted, so that they leave the mesh early
+               valence[i] = 2.0f * std::pow((float)i, -0.5f);
+            }
+         }
+      };
+
+      static float score(int cachePosition, GLuint remainingTriangles)
+      {
+         static const ScoreTables tables;
+
+         if(remainingTriangles == 0) return -1.0f;
+
+         float result = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+         result += remainingTriangles < VALENCE_TABLE_SIZE ? tables.valence[remainingTriangles] : 2.0f * std::pow((float)remainingTriangles, -0.5f);
+         return result;
+      }
+};
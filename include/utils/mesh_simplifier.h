@@ -0,0 +1,306 @@
+#pragma once
+/*
+   MeshSimplifier class
+   - simplifies the triangles of a mesh by edge collapses ordered by the quadric error metric
+     (Garland and Heckbert, "Surface simplification using quadric error metrics")
+   - vertices are never moved nor created: a vertex collapses onto one of its neighbours, so all the
+     levels of detail of a mesh share its vertex buffer and only need an index buffer of their own
+   - vertices on open borders are never collapsed, which also keeps UV and normal seams intact
+     (the vertices of a seam are duplicated, so the seam is a border for the index topology)
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+#include <utils/mesh.h>
+#include <utils/mesh_optimizer.h>
+
+class MeshSimplifier
+{
+   public:
+      // Maximum number of simplified LODs built for a mesh
+      static const size_t MAX_LODS = 3;
+
+      // Appends to mesh.lodIndices up to MAX_LODS levels, each with about half the triangles of the previous one;
+      // the chain stops when a level cannot be simplified enough within maxError (relative to the mesh size)
+      static void buildLodChain(MeshData& mesh, float maxError = 0.05f, size_t minTriangles = 32)
+      {
+         mesh.lodIndices.clear();
+         if(mesh.indices.size() % 3 != 0) return;
+
+         const std::vector<GLuint>* previous = &mesh.indices;
+         while(mesh.lodIndices.size() < MAX_LODS)
+         {
+            size_t previousTriangles = previous->size() / 3;
+            if(previousTriangles / 2 < minTriangles) break;
+
+            std::vector<GLuint> lod = simplify(mesh.vertices, *previous, previousTriangles / 2, maxError);
+            // not worth a level of its own
+            if(lod.size() / 3 > previousTriangles * 3 / 4) break;
+
+            MeshOptimizer::optimizeVertexCache(lod, mesh.vertices.size());
+            mesh.lodIndices.push_back(std::move(lod));
+            previous = &mesh.lodIndices.back();
+         }
+      }
+
+      // Returns the indices of at least targetTriangles triangles, collapsing edges until the error of the next
+      // collapse would exceed maxError times the radius of the mesh
+      static std::vector<GLuint> simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, size_t targetTriangles, float maxError)
+      {
+         const size_t vertexCount = vertices.size();
+         std::vector<GLuint> result(indices);
+
+         // errors are squared distances, measured relative to the size of the mesh
+         glm::vec3 minCorner(0.0f), maxCorner(0.0f);
+         if(vertexCount > 0) minCorner = maxCorner = vertices[0].position;
+         for (size_t i = 1; i < vertexCount; i++)
+         {
+            minCorner = glm::min(minCorner, vertices[i].position);
+            maxCorner = glm::max(maxCorner, vertices[i].position);
+         }
+         float radius = glm::length(maxCorner - minCorner) * 0.5f;
+         double errorLimit = (double)(maxError * radius) * (double)(maxError * radius);
+
+         // quadric of a vertex: sum of the squared distances from the planes of its triangles
+         std::vector<Quadric> quadrics(vertexCount);
+         for (size_t t = 0; t + 2 < result.size(); t += 3)
+         {
+            const glm::vec3& p0 = vertices[result[t]].position;
+            glm::vec3 normal = glm::cross(vertices[result[t + 1]].position - p0, vertices[result[t + 2]].position - p0);
+            float length = glm::length(normal);
+            if(length <= 0.0f) continue;
+
+            normal = normal / length;
+            Quadric plane(normal.x, normal.y, normal.z, -glm::dot(normal, p0));
+            for (size_t k = 0; k < 3; k++) { quadrics[result[t + k]].add(plane); }
+         }
+
+         std::vector<bool> locked = findBorderVertices(result, vertexCount);
+
+         std::vector<GLuint> collapseTarget(vertexCount);
+         std::vector<bool> touched(vertexCount);
+         std::vector<Collapse> collapses;
+         std::vector<GLuint> adjacencyOffset, adjacency;
+
+         // every pass collapses a set of edges not sharing any vertex, in order of increasing error
+         while(result.size() / 3 > targetTriangles)
+         {
+            buildAdjacency(result, vertexCount, adjacencyOffset, adjacency);
+
+            collapses.clear();
+            for (size_t t = 0; t < result.size(); t += 3)
+            {
+               for (size_t k = 0; k < 3; k++)
+               {
+                  GLuint a = result[t + k], b = result[t + (k + 1) % 3];
+                  // each inner edge is shared by two triangles, we take it from the one listing it as a < b
+                  if(a > b) continue;
+
+                  Quadric sum = quadrics[a];
+                  sum.add(quadrics[b]);
+
+                  // a collapses onto b, or the other way around, whichever is allowed and moves the surface less
+                  Collapse collapse{0, 0, errorLimit + 1.0};
+                  if(!locked[a]) collapse = Collapse{a, b, sum.error(vertices[b].position)};
+                  if(!locked[b])
+                  {
+                     double error = sum.error(vertices[a].position);
+                     if(error < collapse.error) collapse = Collapse{b, a, error};
+                  }
+                  if(collapse.error <= errorLimit) collapses.push_back(collapse);
+               }
+            }
+            if(collapses.empty()) break;
+
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+            for (size_t v = 0; v < vertexCount; v++) { collapseTarget[v] = (GLuint)v; }
+            std::fill(touched.begin(), touched.end(), false);
+
+            size_t trianglesToRemove = result.size() / 3 - targetTriangles, removed = 0;
+            for (const Collapse& collapse : collapses)
+            {
+               if(touched[collapse.from] || touched[collapse.to]) continue;
+               if(!keepsManifold(result, adjacencyOffset, adjacency, collapse.from, collapse.to)) continue;
+               if(flipsTriangles(vertices, result, adjacencyOffset, adjacency, collapse.from, collapse.to)) continue;
+
+               collapseTarget[collapse.from] = collapse.to;
+               quadrics[collapse.to].add(quadrics[collapse.from]);
+
+               // the neighbours of from stay still for the rest of the pass, so the flip checks see the final positions
+               touched[collapse.to] = true;
+               for (GLuint i = adjacencyOffset[collapse.from]; i < adjacencyOffset[collapse.from + 1]; i++)
+               {
+                  for (size_t k = 0; k < 3; k++) { touched[result[adjacency[i] * 3 + k]] = true; }
+               }
+
+               removed += sharedTriangles(result, adjacencyOffset, adjacency, collapse.from, collapse.to);
+               if(removed >= trianglesToRemove) break;
+            }
+            if(removed == 0) break;
+
+            // the triangles of the collapsed edges are left with two equal indices, and are dropped
+            size_t write = 0;
+            for (size_t t = 0; t < result.size(); t += 3)
+            {
+               GLuint a = collapseTarget[result[t]], b = collapseTarget[result[t + 1]], c = collapseTarget[result[t + 2]];
+               if(a == b || b == c || a == c) continue;
+
+               result[write++] = a; result[write++] = b; result[write++] = c;
+            }
+            result.resize(write);
+         }
+
+         return result;
+      }
+
+   private:
+      // Symmetric 4x4 matrix, the upper triangle is stored
+      struct Quadric
+      {
+         double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+         Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+         // quadric of the plane ax + by + cz + d = 0
+         Quadric(double a, double b, double c, double d) :
+            a2(a * a), ab(a * b), ac(a * c), ad(a * d), b2(b * b), bc(b * c), bd(b * d), c2(c * c), cd(c * d), d2(d * d) {}
+
+         void add(const Quadric& q)
+         {
+            a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+            bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+         }
+
+         // v^T Q v with v = (p, 1)
+         double error(const glm::vec3& p) const
+         {
+            double x = p.x, y = p.y, z = p.z;
+            double result = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                          + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                          + c2 * z * z + 2 * cd * z
+                          + d2;
+            return result > 0.0 ? result : 0.0;
+         }
+      };
+
+      struct Collapse
+      {
+         GLuint from, to;
+         double error;
+      };
+
+      // Vertices of the edges used by one triangle only (or by more than two, where the surface is not a manifold)
+      static std::vector<bool> findBorderVertices(const std::vector<GLuint>& indices, size_t vertexCount)
+      {
+         std::unordered_map<uint64_t, GLuint> edgeUses;
+         edgeUses.reserve(indices.size());
+         for (size_t t = 0; t + 2 < indices.size(); t += 3)
+         {
+            for (size_t k = 0; k < 3; k++) { edgeUses[edgeKey(indices[t + k], indices[t + (k + 1) % 3])]++; }
+         }
+
+         std::vector<bool> border(vertexCount, false);
+         for (const auto& edge : edgeUses)
+         {
+            if(edge.second != 2)
+            {
+               border[(GLuint)(edge.first >> 32)] = true;
+               border[(GLuint)(edge.first & 0xFFFFFFFFu)] = true;
+            }
+         }
+         return border;
+      }
+
+      static uint64_t edgeKey(GLuint a, GLuint b)
+      {
+         return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+      }
+
+      // Triangles using each vertex, as one array with an offset per vertex
+      static void buildAdjacency(const std::vector<GLuint>& indices, size_t vertexCount, std::vector<GLuint>& offset, std::vector<GLuint>& adjacency)
+      {
+         offset.assign(vertexCount + 1, 0);
+         for (GLuint index : indices) { offset[index + 1]++; }
+         for (size_t v = 0; v < vertexCount; v++) { offset[v + 1] += offset[v]; }
+
+         adjacency.resize(indices.size());
+         std::vector<GLuint> fill(offset.begin(), offset.end() - 1);
+         for (size_t i = 0; i < indices.size(); i++) { adjacency[fill[indices[i]]++] = (GLuint)(i / 3); }
+      }
+
+      static bool contains(const std::vector<GLuint>& indices, size_t triangle, GLuint v)
+      {
+         return indices[triangle * 3] == v || indices[triangle * 3 + 1] == v || indices[triangle * 3 + 2] == v;
+      }
+
+      // True if moving from onto to turns any of the remaining triangles of from upside down (or almost)
+      static bool flipsTriangles(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+                                 const std::vector<GLuint>& offset, const std::vector<GLuint>& adjacency, GLuint from, GLuint to)
+      {
+         for (GLuint i = offset[from]; i < offset[from + 1]; i++)
+         {
+            size_t t = adjacency[i];
+            if(contains(indices, t, to)) continue;
+
+            glm::vec3 p[3], moved[3];
+            for (size_t k = 0; k < 3; k++)
+            {
+               GLuint v = indices[t * 3 + k];
+               p[k] = vertices[v].position;
+               moved[k] = vertices[v == from ? to : v].position;
+            }
+
+            // turning by more than ~75 degrees counts as a flip too, to avoid slivers folded across the surface
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after  = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+            float lengths = glm::length(before) * glm::length(after);
+            if(lengths <= 0.0f || glm::dot(before, after) < 0.25f * lengths) return true;
+         }
+         return false;
+      }
+
+      // Link condition: the only vertices adjacent to both from and to must be the ones of their shared triangles,
+      // otherwise the collapse would leave pairs of triangles folded onto each other
+      static bool keepsManifold(const std::vector<GLuint>& indices, const std::vector<GLuint>& offset,
+                                const std::vector<GLuint>& adjacency, GLuint from, GLuint to)
+      {
+         std::vector<GLuint> fromNeighbours, toNeighbours;
+         collectNeighbours(indices, offset, adjacency, from, fromNeighbours);
+         collectNeighbours(indices, offset, adjacency, to, toNeighbours);
+
+         size_t common = 0;
+         for (GLuint v : toNeighbours)
+         {
+            if(v != from && std::find(fromNeighbours.begin(), fromNeighbours.end(), v) != fromNeighbours.end()) common++;
+         }
+         return common == sharedTriangles(indices, offset, adjacency, from, to);
+      }
+
+      static void collectNeighbours(const std::vector<GLuint>& indices, const std::vector<GLuint>& offset,
+                                    const std::vector<GLuint>& adjacency, GLuint v, std::vector<GLuint>& neighbours)
+      {
+         for (GLuint i = offset[v]; i < offset[v + 1]; i++)
+         {
+            for (size_t k = 0; k < 3; k++)
+            {
+               GLuint n = indices[adjacency[i] * 3 + k];
+               if(n != v && std::find(neighbours.begin(), neighbours.end(), n) == neighbours.end()) neighbours.push_back(n);
+            }
+         }
+      }
+
+      static size_t sharedTriangles(const std::vector<GLuint>& indices, const std::vector<GLuint>& offset,
+                                    const std::vector<GLuint>& adjacency, GLuint a, GLuint b)
+      {
+         size_t count = 0;
+         for (GLuint i = offset[a]; i < offset[a + 1]; i++) { count += contains(indices, adjacency[i], b) ? 1 : 0; }
+         return count;
+      }
+};
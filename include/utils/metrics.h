@@ -0,0 +1,272 @@
+#pragma once
+/*
+   MetricsRegistry class
+   - always-on counters of the rendering work (draw calls, triangles, uniform uploads, program and VAO binds, buffer bytes)
+   - each thread adds to its own block of counters: a plain add, no atomic read-modify-write and no lock;
+     endFrame() sums the blocks of all the threads and keeps the counts of each frame
+   - frame times go in a rolling histogram with log-linear buckets (as HdrHistogram: relative error under 1%
+     at any magnitude), which gives the percentiles over the last WINDOW frames
+   - the summary can be printed, or appended to a CSV file every few frames
+   - defining UTILS_NO_METRICS compiles METRIC_ADD to nothing
+*/
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+enum Metric
+{
+   METRIC_DRAW_CALLS,
+   METRIC_TRIANGLES,
+   METRIC_OBJECTS,         // objects and draw packets submitted
+   METRIC_UNIFORM_UPLOADS, // glUniform* calls
+   METRIC_PROGRAM_BINDS,   // glUseProgram calls issued
+   METRIC_VAO_BINDS,       // glBindVertexArray calls issued
+   METRIC_BUFFER_BYTES,    // bytes uploaded with glBufferData/glBufferSubData
+   METRIC_COUNT
+};
+
+inline const char* metricName(Metric metric)
+{
+   static const char* names[METRIC_COUNT] =
+   {
+      "draw_calls", "triangles", "objects", "uniform_uploads", "program_binds", "vao_binds", "buffer_bytes"
+   };
+   return names[metric];
+}
+
+// Log-linear histogram of integer values: exact below SUB_BUCKETS, then SUB_BUCKETS/2 buckets per power of two
+class LogHistogram
+{
+   public:
+      static const int SUB_BITS = 7;
+      static const uint64_t SUB_BUCKETS = 1ull << SUB_BITS;
+      static const int MAX_SHIFT = 32;
+
+      LogHistogram() : counts(bucketCount(), 0), total(0) {}
+
+      void add(uint64_t value)    { counts[bucketIndex(value)]++; total++; }
+      void remove(uint64_t value) { counts[bucketIndex(value)]--; total--; }
+      void clear() { std::fill(counts.begin(), counts.end(), 0); total = 0; }
+
+      uint64_t count() const noexcept { return total; }
+
+      // Value under which a fraction of the values fall (the middle of its bucket), 0 if empty
+      uint64_t percentile(double fraction) const
+      {
+         if(total == 0) return 0;
+
+         uint64_t rank = std::max<uint64_t>(1, (uint64_t)(fraction * total + 0.5));
+         uint64_t seen = 0;
+         for (size_t i = 0; i < counts.size(); i++)
+         {
+            seen += counts[i];
+            if(seen >= rank) return bucketMiddle(i);
+         }
+         return bucketMiddle(counts.size() - 1);
+      }
+
+   private:
+      std::vector<uint64_t> counts;
+      uint64_t total;
+
+      static size_t bucketCount() { return (size_t)(MAX_SHIFT + 2) * (SUB_BUCKETS / 2); }
+
+      static size_t bucketIndex(uint64_t value)
+      {
+         if(value < SUB_BUCKETS) return (size_t)value;
+
+         int msb = 0;
+         for (uint64_t v = value; v > 1; v >>= 1) { msb++; }
+         // value >> shift falls in [SUB_BUCKETS / 2, SUB_BUCKETS)
+         int shift = msb - SUB_BITS + 1;
+         if(shift > MAX_SHIFT) shift = MAX_SHIFT;
+         uint64_t sub = std::min<uint64_t>(value >> shift, SUB_BUCKETS - 1);
+         return (size_t)shift * (SUB_BUCKETS / 2) + (size_t)sub;
+      }
+
+      static uint64_t bucketMiddle(size_t index)
+      {
+         if(index < SUB_BUCKETS) return index;
+
+         size_t shift = index / (SUB_BUCKETS / 2) - 1;
+         uint64_t sub = index - shift * (SUB_BUCKETS / 2);
+         return (sub << shift) + ((1ull << shift) >> 1);
+      }
+};
+
+// Counts of one frame
+struct FrameCounters
+{
+   uint64_t values[METRIC_COUNT] = {};
+};
+
+class MetricsRegistry
+{
+   public:
+      // Frames kept by the histogram and the averages
+      static const size_t WINDOW = 600;
+
+      MetricsRegistry() : frameIndex(0), lastFrameEnd(std::chrono::steady_clock::now()), csvEvery(0), csvHeader(false)
+      {
+         frameMicros.reserve(WINDOW);
+         frames.reserve(WINDOW);
+      }
+
+      MetricsRegistry(const MetricsRegistry& copy) = delete;
+      MetricsRegistry& operator=(const MetricsRegistry& copy) = delete;
+
+      // Can be called by any thread
+      void add(Metric metric, uint64_t amount = 1)
+      {
+         std::atomic<uint64_t>& counter = threadBlock().values[metric];
+         // only this thread writes the counter, endFrame() just reads it
+         counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+      }
+
+      // To be called once per frame by the main thread: the frame time is the time since the previous call
+      void endFrame()
+      {
+         auto now = std::chrono::steady_clock::now();
+         uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - lastFrameEnd).count();
+         lastFrameEnd = now;
+
+         FrameCounters totals;
+         {
+            std::lock_guard<std::mutex> lock(blocksMutex);
+            for (const std::unique_ptr<CounterBlock>& block : blocks)
+            {
+               for (size_t m = 0; m < METRIC_COUNT; m++) { totals.values[m] += block->values[m].load(std::memory_order_relaxed); }
+            }
+         }
+
+         FrameCounters frame;
+         for (size_t m = 0; m < METRIC_COUNT; m++)
+         {
+            frame.values[m] = totals.values[m] - previousTotals.values[m];
+         }
+         previousTotals = totals;
+         last = frame;
+
+         // the oldest frame of the window leaves the histogram and the sums
+         size_t slot = frameIndex % WINDOW;
+         if(frameMicros.size() == WINDOW)
+         {
+            histogram.remove(frameMicros[slot]);
+            for (size_t m = 0; m < METRIC_COUNT; m++) { windowSums.values[m] -= frames[slot].values[m]; }
+            frameMicros[slot] = micros;
+            frames[slot] = frame;
+         }
+         else
+         {
+            frameMicros.push_back(micros);
+            frames.push_back(frame);
+         }
+         histogram.add(micros);
+         for (size_t m = 0; m < METRIC_COUNT; m++) { windowSums.values[m] += frame.values[m]; }
+
+         frameIndex++;
+         if(csvEvery && frameIndex % csvEvery == 0) appendCSV();
+      }
+
+      // Counts of the last frame
+      const FrameCounters& lastFrame() const noexcept { return last; }
+      size_t frameCount() const noexcept { return frameIndex; }
+
+      // Over the last WINDOW frames
+      double frameMsPercentile(double fraction) const { return histogram.percentile(fraction) / 1000.0; }
+      double meanPerFrame(Metric metric) const
+      {
+         return frames.empty() ? 0.0 : (double)windowSums.values[metric] / frames.size();
+      }
+
+      // Appends a summary line to path every `every` frames (0 stops it)
+      void dumpCSV(const std::string& path, size_t every)
+      {
+         csvPath = path;
+         csvEvery = every;
+         csvHeader = false;
+      }
+
+      void print(std::ostream& out = std::cout) const
+      {
+         out << "Frame ms p50 " << frameMsPercentile(0.50) << ", p90 " << frameMsPercentile(0.90) << ", p99 "
+             << frameMsPercentile(0.99) << ", max " << frameMsPercentile(1.0) << " - per frame:";
+         for (size_t m = 0; m < METRIC_COUNT; m++) { out << " " << metricName((Metric)m) << " " << meanPerFrame((Metric)m); }
+         out << std::endl;
+      }
+
+   private:
+      // counters of one thread
+      struct CounterBlock
+      {
+         std::atomic<uint64_t> values[METRIC_COUNT];
+
+         CounterBlock() { for (size_t m = 0; m < METRIC_COUNT; m++) { values[m].store(0); } }
+      };
+
+      std::mutex blocksMutex;
+      std::vector<std::unique_ptr<CounterBlock>> blocks; // kept after their thread ends, their counts still matter
+
+      // used only by the thread calling endFrame()
+      size_t frameIndex;
+      std::chrono::steady_clock::time_point lastFrameEnd;
+      FrameCounters previousTotals, last, windowSums;
+      std::vector<uint64_t> frameMicros;
+      std::vector<FrameCounters> frames;
+      LogHistogram histogram;
+
+      std::string csvPath;
+      size_t csvEvery;
+      bool csvHeader;
+
+      // There must be only one registry, metrics(): the block of each thread is found through a thread_local
+      CounterBlock& threadBlock()
+      {
+         thread_local CounterBlock* block = nullptr;
+         if(!block)
+         {
+            std::lock_guard<std::mutex> lock(blocksMutex);
+            blocks.emplace_back(new CounterBlock());
+            block = blocks.back().get();
+         }
+         return *block;
+      }
+
+      void appendCSV()
+      {
+         std::ofstream csv(csvPath, csvHeader ? std::ios::app : std::ios::trunc);
+         if(!csvHeader)
+         {
+            csv << "frame,frame_ms_p50,frame_ms_p90,frame_ms_p99,frame_ms_max";
+            for (size_t m = 0; m < METRIC_COUNT; m++) { csv << "," << metricName((Metric)m); }
+            csv << "\n";
+            csvHeader = true;
+         }
+
+         csv << frameIndex << "," << frameMsPercentile(0.50) << "," << frameMsPercentile(0.90) << ","
+             << frameMsPercentile(0.99) << "," << frameMsPercentile(1.0);
+         for (size_t m = 0; m < METRIC_COUNT; m++) { csv << "," << meanPerFrame((Metric)m); }
+         csv << "\n";
+      }
+};
+
+// The metrics of the application
+inline MetricsRegistry& metrics()
+{
+   static MetricsRegistry registry;
+   return registry;
+}
+
+#ifndef UTILS_NO_METRICS
+   #define METRIC_ADD(metric, amount) metrics().add(metric, amount)
+#else
+   #define METRIC_ADD(metric, amount)
+#endif
@@ -9,17 +9,40 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <thread>
 
 #include <utils/mesh.h>
+#include <utils/mesh_cache.h>
+#include <utils/mesh_optimizer.h>
+#include <utils/mesh_simplifier.h>
+#include <utils/parallel.h>
+#include <utils/profiler.h>
 
 // Model class purpose:
 // 1. Open file from disk
 // 2. Load data with assimp
 // 3. Pass all nodes to data structure
 // 4. Create a mesh from data structure (which will setup VBO)
+// On warm starts, steps 1-3 are skipped by reading the binary cache written after the first import (see MeshCache)
+
+// Options of the import pipeline
+struct ImportOptions
+{
+   bool optimize     = true;  // reorders triangles and vertices for the GPU caches (see MeshOptimizer)
+   bool generateLods = true;  // builds simplified index buffers for the distant objects (see MeshSimplifier)
+   bool reportStats  = false; // prints the ACMR/ATVR of every mesh before and after the optimization, and its LODs
+
+   // the options changing the imported data are part of the identity of the mesh cache
+   uint32_t cacheFlags() const noexcept { return (optimize ? 1u : 0u) | (generateLods ? 2u : 0u); }
+};
+
+class AssetLoader;
 
 class Model
 {
+   friend class AssetLoader;
+
    public:
       std::vector<Mesh> meshes;
 
@@ -33,16 +56,157 @@ class Model
       Model(Model&& move) = default;
       Model& operator=(Model&& move) noexcept = default;
 
-      Model(const std::string& path) { loadModel(path); }
+      // format selects how the vertices are stored on the GPU (VERTEX_COMPACT takes less than half the memory)
+      Model(const std::string& path, VertexFormat format = VERTEX_FULL, const ImportOptions& options = ImportOptions()) : ready(true)
+      {
+         loadModel(path, format, options);
+      }
+
+      // Empty model, its meshes are uploaded later by the AssetLoader
+      Model() noexcept : ready(false) {}
+
+      // False while an AssetLoader is still streaming the meshes of this model
+      bool isReady() const noexcept { return ready; }
+
+      // Loads the geometry of a model file without touching the GPU, so it can run on any thread
+      static std::vector<MeshData> importMeshData(const std::string& path, const ImportOptions& options = ImportOptions())
+      {
+         PROFILE_SCOPE("Model::importMeshData");
+
+         std::vector<MeshData> data;
+         if(MeshCache::load(path, options.cacheFlags(), data)) return data;
+
+         return importWithAssimp(path, options);
+      }
+
+      // Converts one imported mesh to our vertex and index arrays (the import benchmark times it on its own)
+      static MeshData processMesh(const aiMesh* mesh)
+      {
+         MeshData data;
+         const size_t vertexCount = mesh->mNumVertices;
+
+         // every array is sized once, then filled in place
+         data.vertices.resize(vertexCount);
+
+         const bool hasNormals = mesh->mNormals != nullptr;
+         const bool hasUVs     = mesh->mTextureCoords[0] != nullptr;
+         // Since there are UVs, then assimp calculated the tan + bitan
+         const bool hasTangents = hasUVs && mesh->mTangents && mesh->mBitangents;
+
+         if(!hasUVs)
+         {
+            // The model has no UV textures
+            std::cout << "Warning: UV not present (" << vertexCount << " vertices)\n";
+         }
+
+         // each attribute is copied by its own tight loop over a range of vertices,
+         // so big meshes can be split in ranges converted by different threads
+         Vertex* vertices = data.vertices.data();
+         parallelFor(vertexCount, [&](size_t begin, size_t end)
+         {
+            for (size_t i = begin; i < end; i++) { copyVec3(vertices[i].position, mesh->mVertices[i]); }
+
+            if(hasNormals)
+               for (size_t i = begin; i < end; i++) { copyVec3(vertices[i].normal, mesh->mNormals[i]); }
+            else
+               for (size_t i = begin; i < end; i++) { vertices[i].normal = glm::vec3(0.f, 0.f, 0.f); }
+
+            if(hasUVs)
+            {
+               const aiVector3D* uvs = mesh->mTextureCoords[0];
+               for (size_t i = begin; i < end; i++) { vertices[i].texCoords = glm::vec2(uvs[i].x, uvs[i].y); }
+            }
+            else
+               for (size_t i = begin; i < end; i++) { vertices[i].texCoords = glm::vec2(0.f, 0.f); }
+
+            if(hasTangents)
+            {
+               for (size_t i = begin; i < end; i++) { copyVec3(vertices[i].tangent, mesh->mTangents[i]); }
+               for (size_t i = begin; i < end; i++) { copyVec3(vertices[i].bitangent, mesh->mBitangents[i]); }
+            }
+            else
+               for (size_t i = begin; i < end; i++) { vertices[i].tangent = vertices[i].bitangent = glm::vec3(0.f, 0.f, 0.f); }
+         });
+
+         // faces are triangulated by assimp, but we count the indices anyway to size the array exactly
+         size_t indexCount = 0;
+         for (size_t i = 0; i < mesh->mNumFaces; i++) { indexCount += mesh->mFaces[i].mNumIndices; }
+
+         data.indices.resize(indexCount);
+         GLuint* indices = data.indices.data();
+         for (size_t i = 0; i < mesh->mNumFaces; i++)
+         {
+            const aiFace& face = mesh->mFaces[i];
+            std::copy(face.mIndices, face.mIndices + face.mNumIndices, indices);
+            indices += face.mNumIndices;
+         }
+
+         return data;
+      }
+
+      void draw(size_t lod = 0) const
+      {
+         for (size_t i = 0; i < meshes.size(); i++) { meshes[i].draw(lod); }
+      }
 
-      void draw() const
+      // Number of levels of detail of the most detailed mesh
+      size_t lodCount() const noexcept
       {
-         for (size_t i = 0; i < meshes.size(); i++) { meshes[i].draw(); }
+         size_t count = 1;
+         for (size_t i = 0; i < meshes.size(); i++) { count = std::max(count, meshes[i].lodCount()); }
+         return count;
+      }
+
+      // In model space
+      BoundingSphere boundingSphere() const noexcept
+      {
+         if(meshes.empty()) return BoundingSphere{glm::vec3(0.0f), 0.0f};
+
+         BoundingSphere sphere = meshes[0].bounds;
+         for (size_t i = 1; i < meshes.size(); i++) { sphere = mergeSpheres(sphere, meshes[i].bounds); }
+         return sphere;
+      }
+
+      // In model space
+      BoundingBox boundingBox() const noexcept
+      {
+         if(meshes.empty()) return BoundingBox{glm::vec3(0.0f), glm::vec3(0.0f)};
+
+         BoundingBox box = meshes[0].box;
+         for (size_t i = 1; i < meshes.size(); i++) { box = mergeBoxes(box, meshes[i].box); }
+         return box;
+      }
+
+      void drawInstanced(GLsizei instanceCount) const
+      {
+         for (size_t i = 0; i < meshes.size(); i++) { meshes[i].drawInstanced(instanceCount); }
+      }
+
+      void bindInstanceBuffer(GLuint instanceVBO) const
+      {
+         for (size_t i = 0; i < meshes.size(); i++) { meshes[i].bindInstanceBuffer(instanceVBO); }
       }
 
    private:
-      void loadModel(const std::string& path)
+      bool ready;
+
+      void loadModel(const std::string& path, VertexFormat format, const ImportOptions& options)
+      {
+         PROFILE_SCOPE("Model::loadModel");
+
+         // the cache is checked against the current content of the source file, so a stale cache is never used;
+         // on the GL thread the meshes are uploaded straight from the mapped cache file
+         if(MeshCache::load(path, options.cacheFlags(), meshes, format)) return;
+
+         std::vector<MeshData> data = importWithAssimp(path, options);
+         meshes.reserve(data.size());
+         for (size_t i = 0; i < data.size(); i++) { meshes.emplace_back(std::move(data[i]), format); }
+      }
+
+      static std::vector<MeshData> importWithAssimp(const std::string& path, const ImportOptions& options)
       {
+         std::vector<MeshData> data;
+
          Assimp::Importer importer;
          
          // Applying various mesh processing functions to the import by assimp
@@ -54,14 +218,27 @@ class Model
          {
             // If scene failed to complete or there are some error flags from assimp, then stop application
             std::cout << "ASSIMP ERROR! " << importer.GetErrorString() << std::endl;
-            return;
+            return data;
          }
          
          // process the scene tree starting from root node down to its descendants
-         processNode(scene->mRootNode, scene);
-      }   
+         processNode(scene->mRootNode, scene, data);
 
-      void processNode(const aiNode* node, const aiScene* scene)
+         if(options.optimize)
+         {
+            for (size_t i = 0; i < data.size(); i++) { optimizeMesh(data[i], i, options.reportStats); }
+         }
+         if(options.generateLods)
+         {
+            for (size_t i = 0; i < data.size(); i++) { generateLods(data[i], i, options.reportStats); }
+         }
+
+         // the cache is written after the first import, the following loads will read it instead
+         MeshCache::save(path, options.cacheFlags(), data);
+         return data;
+      }
+
+      static void processNode(const aiNode* node, const aiScene* scene, std::vector<MeshData>& data)
       {
          // Process each node
          for (size_t i = 0; i < node->mNumMeshes; i++)
@@ -69,76 +246,42 @@ class Model
             // each node has an index reference to its mesh, which is contained in scene's mMeshes array
             const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]]; 
 
-            meshes.emplace_back(processMesh(mesh));
+            data.emplace_back(processMesh(mesh));
          }
 
          // recurse through the nodes children 
          for (size_t i = 0; i < node->mNumChildren; i++)
          {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, data);
          }
          
       }
 
-      Mesh processMesh(const aiMesh* mesh)
+      static void optimizeMesh(MeshData& data, size_t meshIndex, bool reportStats)
       {
-         std::vector<Vertex> vertices;
-         std::vector<GLuint>  indices;
+         MeshStats before = MeshOptimizer::analyze(data.indices, data.vertices.size());
+         MeshOptimizer::optimize(data);
 
-         for (size_t i = 0; i < mesh->mNumVertices; i++)
+         if(reportStats)
          {
-            Vertex vertex;
-            glm::vec3 vec3;
-            vec3.x = mesh->mVertices[i].x;
-            vec3.y = mesh->mVertices[i].y;
-            vec3.z = mesh->mVertices[i].z;
-            vertex.position = vec3;
-
-            vec3.x = mesh->mNormals[i].x;
-            vec3.y = mesh->mNormals[i].y;
-            vec3.z = mesh->mNormals[i].z;
-            vertex.normal = vec3;
-
-            if(mesh->mTextureCoords[0])
-            {
-               // The model has UV textures so we assign them
-               glm::vec2 vec2;
-               vec2.x = mesh->mTextureCoords[0][i].x;
-               vec2.y = mesh->mTextureCoords[0][i].y;
-               vertex.texCoords = vec2;
-
-               // Since there are UVs, then assimp calculated the tan + bitan
-               vec3.x = mesh->mTangents[i].x;
-               vec3.y = mesh->mTangents[i].y;
-               vec3.z = mesh->mTangents[i].z;
-               vertex.tangent = vec3;
-
-               vec3.x = mesh->mBitangents[i].x;
-               vec3.y = mesh->mBitangents[i].y;
-               vec3.z = mesh->mBitangents[i].z;
-               vertex.bitangent = vec3;
-            }
-            else
-            {
-               // The model has no UV textures
-               vertex.texCoords = glm::vec2(0.f, 0.f);
-               std::cout << "Warning: UV not present" << std::endl;
-            }
-
-            vertices.emplace_back(vertex);
+            MeshStats after = MeshOptimizer::analyze(data.indices, data.vertices.size());
+            std::cout << "Mesh " << meshIndex << " (" << data.indices.size() / 3 << " triangles): "
+                      << "ACMR " << before.acmr << " -> " << after.acmr << ", "
+                      << "ATVR " << before.atvr << " -> " << after.atvr << std::endl;
          }
+      }
 
-         for (size_t i = 0; i < mesh->mNumFaces; i++)
-         {
-            aiFace face = mesh->mFaces[i];
+      static void generateLods(MeshData& data, size_t meshIndex, bool reportStats)
+      {
+         MeshSimplifier::buildLodChain(data);
 
-            for (size_t j = 0; j < face.mNumIndices; j++)
-            {
-               indices.emplace_back(face.mIndices[j]);
-            }
+         if(reportStats)
+         {
+            std::cout << "Mesh " << meshIndex << " LODs (triangles): " << data.indices.size() / 3;
+            for (size_t l = 0; l < data.lodIndices.size(); l++) { std::cout << " " << data.lodIndices[l].size() / 3; }
+            std::cout << std::endl;
          }
-
-         return Mesh{vertices, indices};
       }
 
+      static void copyVec3(glm::vec3& dst, const aiVector3D& src) { dst.x = src.x; dst.y = src.y; dst.z = src.z; }
 };
\ No newline at end of file
@@ -2,6 +2,9 @@
 
 #include <utils/model.h>
 #include <utils/shader.h>
+#include <utils/frustum.h>
+#include <utils/scene.h>
+#include <utils/render_queue.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -9,37 +12,289 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 
-// Object in scene
+// Level of detail of a bounding sphere (in world space) on screen: LOD 0 while the sphere covers at least
+// lodScreenSize of the viewport height, then one level more every time that size halves
+inline size_t lodFromScreenSize(const BoundingSphere& sphere, const glm::mat4& view, const glm::mat4& projection,
+                                size_t lodCount, float lodScreenSize = 0.5f)
+{
+   float distance = glm::length(glm::vec3(view * glm::vec4(sphere.center, 1.0f)));
+   if(distance <= sphere.radius) return 0;
+
+   // projection[1][1] is cot(fovy / 2), so this is the diameter of the sphere over the viewport height
+   float screenSize = sphere.radius * projection[1][1] / distance;
+   size_t lod = screenSize >= lodScreenSize ? 0 : (size_t)std::log2(lodScreenSize / screenSize);
+   return std::min(lod, lodCount - 1);
+}
+
+// Object in scene: its transformation is either built before every draw with translate/rotate/scale
+// (and reset after the draw), or retained by a node of a SceneGraph
 class Object
 {
    const Model* model;
    glm::mat4 transform;
    glm::mat3 normal;
+   size_t lod;
+   const SceneGraph* scene;
+   SceneNode node;
 
    public:
       //Object(const std::string& modelPath, glm::mat4 transform = glm::mat4(1)) : model(new Model(modelPath)), transform(transform) {}
-      Object(const Model& otherModel, glm::mat4 transform = glm::mat4(1)) : model(&otherModel), transform(transform), normal(glm::mat3(1)) {}
+      Object(const Model& otherModel, glm::mat4 transform = glm::mat4(1)) :
+         model(&otherModel), transform(transform), normal(glm::mat3(1)), lod(0), scene(nullptr), node(NO_NODE) {}
+
+      // The matrices come from the node (after scene.update()), and are never reset: the object is moved
+      // through the node, and translate/rotate/scale have no effect
+      Object(const Model& otherModel, const SceneGraph& scene, SceneNode node) :
+         model(&otherModel), transform(glm::mat4(1)), normal(glm::mat3(1)), lod(0), scene(&scene), node(node) {}
 
       void scale     (glm::vec3 scaling)                       {   transform = glm::scale(transform, scaling);                   }
       void translate (glm::vec3 translation)                   {   transform = glm::translate(transform, translation);           }
       void rotate    (float angle_rad, glm::vec3 rotationAxis) {   transform = glm::rotate(transform, angle_rad, rotationAxis);  }
       void rotate_deg(float angle_deg, glm::vec3 rotationAxis) {   rotate(glm::radians(angle_deg), rotationAxis);                }
 
-      void draw(Shader shader, glm::mat4 viewProjection)
+      void draw(const Shader& shader, glm::mat4 viewProjection)
       {
+         PROFILE_SCOPE("Object::draw");
+         METRIC_ADD(METRIC_OBJECTS, 1);
          shader.use();
+
+         if(cachedSerial != shader.serial())
+         {
+            cachedSerial   = shader.serial();
+            modelUniform   = shader.uniform("modelMatrix");
+            normalUniform  = shader.uniform("normalMatrix");
+         }
+
+         if(scene)
+         {
+            // the scene caches the world space normal matrix, the rotation of the view brings it in view space
+            shader.setMat4(modelUniform, scene->world(node));
+            shader.setMat3(normalUniform, glm::mat3(viewProjection) * scene->normalMatrix(node));
+            model->draw(lod);
+            return;
+         }
+
          recomputeNormal(viewProjection);
+         shader.setMat4(modelUniform, transform);
+         shader.setMat3(normalUniform, normal);
+
+         model->draw(lod);
+
+         resetTransform();
+      }
+
+      // Adds the object to the queue instead of drawing it right away, the transformation is reset as after a draw
+      void submit(RenderQueue& queue, const Shader& shader, const Material* material = nullptr, GLuint subroutine = GL_INVALID_INDEX)
+      {
+         if(scene)
+         {
+            queue.submit(*model, shader, material, subroutine, scene->world(node), scene->normalMatrix(node), lod);
+            return;
+         }
+
+         queue.submit(*model, shader, material, subroutine, transform, glm::inverseTranspose(glm::mat3(transform)), lod);
+         resetTransform();
+      }
+
+      // Draws the object only if its bounding box intersects the frustum, returns whether it was drawn.
+      // The transformation is reset in both cases
+      bool drawIfVisible(const Shader& shader, glm::mat4 viewProjection, const Frustum& frustum)
+      {
+         if(frustum.intersects(worldBox()))
+         {
+            draw(shader, viewProjection);
+            return true;
+         }
+
+         resetTransform();
+         return false;
+      }
+
+      // Current model matrix: the one built so far, or the world matrix of the node
+      const glm::mat4& modelMatrix() const { return scene ? scene->world(node) : transform; }
+
+      // Bounds of the model with the current transformation
+      BoundingBox    worldBox()    const { return transformBox(model->boundingBox(), modelMatrix()); }
+      BoundingSphere worldSphere() const { return transformSphere(model->boundingSphere(), modelMatrix()); }
+      // Picks the level of detail from the size of the model on screen, so it goes after the transformations
+      // (or after scene.update())
+      void selectLod(const glm::mat4& view, const glm::mat4& projection, float lodScreenSize = 0.5f)
+      {
+         lod = lodFromScreenSize(worldSphere(), view, projection, model->lodCount(), lodScreenSize);
+      }
 
-         shader.setMat4("modelMatrix", transform);
-         shader.setMat3("normalMatrix", normal);
+      size_t currentLod() const noexcept { return lod; }
 
-         model->draw();
+   private:
+      // uniform handles of the last program this object was drawn with
+      uint32_t cachedSerial = 0;
+      UniformHandle modelUniform, normalUniform;
+
+      void recomputeNormal(glm::mat4 viewProjection) { normal = glm::inverseTranspose(glm::mat3(viewProjection * transform)); }
+
+      // the transformation built with translate/rotate/scale lasts for one draw only
+      void resetTransform()
+      {
+         if(scene) return;
 
-         // reset to identity
          transform = glm::mat4(1);
          normal = glm::mat3(1);
       }
+};
+
+// Many copies of the same Model, each one with its own transform, rendered with one instanced draw per mesh.
+// The shader must read the per-instance matrices (see procedural_instanced.vert)
+class InstancedObjectBatch
+{
+   const Model* model;
+   std::vector<InstanceData> instances;
+
+   public:
+      InstancedObjectBatch(const Model& otherModel) : model(&otherModel), instanceVBO(0), capacity(0), dirty(false), spheresDirty(false)
+      {
+         glGenBuffers(1, &instanceVBO);
+      }
+
+      InstancedObjectBatch(const InstancedObjectBatch& copy) = delete;
+      InstancedObjectBatch& operator=(const InstancedObjectBatch& copy) = delete;
+
+      InstancedObjectBatch(InstancedObjectBatch&& move) noexcept :
+         model(move.model), instances(std::move(move.instances)),
+         instanceVBO(move.instanceVBO), capacity(move.capacity), dirty(move.dirty), spheresDirty(true)
+      {
+         move.instanceVBO = 0;
+      }
+
+      InstancedObjectBatch& operator=(InstancedObjectBatch&& move) noexcept
+      {
+         freeGPU();
+
+         model = move.model; instances = std::move(move.instances);
+         instanceVBO = move.instanceVBO; capacity = move.capacity; dirty = move.dirty;
+         spheresDirty = true;
+         move.instanceVBO = 0;
+
+         return *this;
+      }
+
+      ~InstancedObjectBatch() noexcept
+      {
+         freeGPU();
+      }
+
+      // Adds an instance and returns its index
+      size_t add(const glm::mat4& transform)
+      {
+         instances.push_back(InstanceData{transform, computeNormal(transform)});
+         dirty = spheresDirty = true;
+         return instances.size() - 1;
+      }
+
+      void set(size_t index, const glm::mat4& transform)
+      {
+         instances[index] = InstanceData{transform, computeNormal(transform)};
+         dirty = spheresDirty = true;
+      }
+
+      void clear()                 { instances.clear(); dirty = spheresDirty = true; }
+      size_t size() const noexcept { return instances.size(); }
+
+      void draw(const Shader& shader)
+      {
+         if(instances.empty()) return;
+
+         shader.use();
+         upload();
+
+         // the mesh VAOs may be shared with other batches of the same model, so we always point them to our buffer
+         model->bindInstanceBuffer(instanceVBO);
+         model->drawInstanced((GLsizei)instances.size());
+         METRIC_ADD(METRIC_OBJECTS, instances.size());
+      }
+
+      // Draws only the instances whose bounding sphere intersects the frustum
+      void draw(const Shader& shader, const Frustum& frustum)
+      {
+         PROFILE_SCOPE("InstancedObjectBatch::draw");
+         // the bounds of a model still loading are not known yet, but it has nothing to draw either
+         if(instances.empty() || !model->isReady()) return;
+         updateSpheres();
+
+         cullStats = culler.cull(frustum, visibleIndices);
+         if(visibleIndices.empty()) return;
+
+         visibleInstances.resize(visibleIndices.size());
+         for (size_t i = 0; i < visibleIndices.size(); i++) { visibleInstances[i] = instances[visibleIndices[i]]; }
+
+         shader.use();
+         uploadInstances(visibleInstances);
+         // the buffer holds only the visible instances now, a draw without frustum has to upload them all again
+         dirty = true;
+
+         model->bindInstanceBuffer(instanceVBO);
+         model->drawInstanced((GLsizei)visibleInstances.size());
+         METRIC_ADD(METRIC_OBJECTS, visibleInstances.size());
+      }
+
+      // Instances tested and drawn by the last culled draw
+      const CullStats& lastCull() const noexcept { return cullStats; }
+
    private:
-      void recomputeNormal(glm::mat4 viewProjection) { normal = glm::inverseTranspose(glm::mat3(viewProjection * transform)); }
+      GLuint instanceVBO;
+      size_t capacity;
+      bool dirty;
+
+      // world space bounding spheres of the instances, rebuilt after any change
+      SphereCuller culler;
+      bool spheresDirty;
+      std::vector<uint32_t> visibleIndices;
+      std::vector<InstanceData> visibleInstances;
+      CullStats cullStats;
+
+      // normals are transformed in world space, the shader brings them in view space with the rotation of the view matrix
+      static glm::mat3 computeNormal(const glm::mat4& transform) { return glm::inverseTranspose(glm::mat3(transform)); }
+
+      void upload()
+      {
+         if(!dirty) return;
+
+         uploadInstances(instances);
+         dirty = false;
+      }
+
+      void uploadInstances(const std::vector<InstanceData>& data)
+      {
+         glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+         if(data.size() > capacity)
+         {
+            // we grow geometrically to avoid reallocating at every added instance
+            capacity = std::max(data.size(), capacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+         }
+         glBufferSubData(GL_ARRAY_BUFFER, 0, data.size() * sizeof(InstanceData), data.data());
+         METRIC_ADD(METRIC_BUFFER_BYTES, data.size() * sizeof(InstanceData));
+      }
+
+      void updateSpheres()
+      {
+         if(!spheresDirty) return;
+
+         BoundingSphere modelSphere = model->boundingSphere();
+         culler.clear();
+         for (size_t i = 0; i < instances.size(); i++) { culler.add(transformSphere(modelSphere, instances[i].modelMatrix)); }
+
+         spheresDirty = false;
+      }
+
+      void freeGPU()
+      {
+         if(instanceVBO)
+         {
+            glState().deleteBuffer(instanceVBO);
+         }
+      }
 };
@@ -0,0 +1,140 @@
+#pragma once
+/*
+   WorkerPool class
+   - a fixed set of threads, started once, runs the chunks of the parallelFor calls
+   - the calling thread takes chunks too, and waits only for the chunks already started by the workers:
+     a call returns even when all the workers are busy, so parallelFor can be called from any thread
+     (AssetLoader workers, or a chunk of another parallelFor) without deadlocks or new threads
+*/
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+class WorkerPool
+{
+   public:
+      // the calling thread is the last one
+      WorkerPool(size_t workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1) : stopping(false)
+      {
+         for (size_t i = 0; i < workerCount; i++)
+         {
+            workers.emplace_back(&WorkerPool::workerLoop, this);
+         }
+      }
+
+      WorkerPool(const WorkerPool& copy) = delete;
+      WorkerPool& operator=(const WorkerPool& copy) = delete;
+
+      ~WorkerPool()
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+         }
+         jobsAvailable.notify_all();
+         for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+      }
+
+      // Workers plus the calling thread
+      size_t threadCount() const noexcept { return workers.size() + 1; }
+
+      // Calls task(chunk) for every chunk in [0, chunkCount), returns when all of them are done
+      template <typename F>
+      void run(size_t chunkCount, F& task)
+      {
+         Job job{&invoke<F>, &task, chunkCount, 0, 0};
+
+         std::unique_lock<std::mutex> lock(mutex);
+         jobs.push_back(&job);
+         lock.unlock();
+         jobsAvailable.notify_all();
+
+         lock.lock();
+         while(job.nextChunk < chunkCount)
+         {
+            size_t chunk = claimChunk(job);
+            lock.unlock();
+            task(chunk);
+            lock.lock();
+            job.doneChunks++;
+         }
+         // the job is out of the queue, the workers still running its chunks are waited for
+         jobDone.wait(lock, [&]() { return job.doneChunks == chunkCount; });
+      }
+
+   private:
+      // Lives on the stack of the calling thread, and is accessed only with the mutex locked
+      struct Job
+      {
+         void (*invoke)(void* task, size_t chunk);
+         void* task;
+         size_t chunkCount;
+         size_t nextChunk;
+         size_t doneChunks;
+      };
+
+      std::vector<std::thread> workers;
+
+      std::deque<Job*> jobs;
+      std::mutex mutex;
+      std::condition_variable jobsAvailable;
+      std::condition_variable jobDone;
+      bool stopping;
+
+      template <typename F>
+      static void invoke(void* task, size_t chunk) { (*static_cast<F*>(task))(chunk); }
+
+      // With the mutex locked: a job leaves the queue with its last chunk
+      size_t claimChunk(Job& job)
+      {
+         size_t chunk = job.nextChunk++;
+         if(job.nextChunk == job.chunkCount) jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+         return chunk;
+      }
+
+      void workerLoop()
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         while(true)
+         {
+            jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if(stopping) return;
+
+            Job& job = *jobs.front();
+            size_t chunk = claimChunk(job);
+            lock.unlock();
+            job.invoke(job.task, chunk);
+            lock.lock();
+
+            // after this the calling thread may return, and the job be gone
+            if(++job.doneChunks == job.chunkCount) jobDone.notify_all();
+         }
+      }
+};
+
+inline WorkerPool& workerPool()
+{
+   static WorkerPool instance;
+   return instance;
+}
+
+// Calls func(begin, end) over contiguous ranges of [0, count), on the threads of the worker pool
+// only when each of them gets at least minPerThread elements
+template <typename F>
+void parallelFor(size_t count, F func, size_t minPerThread = 1 << 16)
+{
+   size_t threadCount = std::min<size_t>(workerPool().threadCount(), count / minPerThread);
+   if(threadCount <= 1)
+   {
+      func(0, count);
+      return;
+   }
+
+   size_t chunk = (count + threadCount - 1) / threadCount;
+   auto task = [&](size_t index) { func(std::min(count, index * chunk), std::min(count, (index + 1) * chunk)); };
+   workerPool().run(threadCount, task);
+}
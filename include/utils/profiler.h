@@ -0,0 +1,332 @@
+#pragma once
+/*
+   Profiler class
+   - PROFILE_SCOPE("name") times the enclosing scope on the CPU: each thread records in its own ring buffer,
+     with no lock and no allocation (the oldest events are overwritten when the ring is full)
+   - PROFILE_GPU_SCOPE("name") times the GL commands of the scope with GL_TIME_ELAPSED queries, taken from a pool
+     per frame and read back GPU_FRAME_LATENCY frames later, when the results are surely there (no stall)
+   - writeChromeTrace() exports everything recorded in the trace_event JSON format (chrome://tracing, Perfetto)
+   - defining UTILS_NO_PROFILER compiles the macros to nothing
+*/
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+// One timed scope. name must outlive the profiler (a string literal)
+struct ProfileEvent
+{
+   const char* name;
+   uint64_t    startNs;    // since the creation of the profiler
+   uint64_t    durationNs;
+};
+
+// Single producer ring of events: only the owning thread pushes, any thread can take a snapshot at any time
+class ProfileRing
+{
+   public:
+      static const size_t CAPACITY = 1 << 15; // power of two
+
+      ProfileRing(uint32_t thread, const std::string& name) : thread(thread), name(name), events(new Slot[CAPACITY]), claimed(0), written(0) {}
+
+      // The slot is claimed before it is overwritten, and the event is published by written once complete
+      void push(const ProfileEvent& event)
+      {
+         uint64_t index = written.load(std::memory_order_relaxed);
+         claimed.store(index + 1, std::memory_order_relaxed);
+         std::atomic_thread_fence(std::memory_order_release);
+
+         Slot& slot = events[index & (CAPACITY - 1)];
+         slot.name.store(event.name, std::memory_order_relaxed);
+         slot.startNs.store(event.startNs, std::memory_order_relaxed);
+         slot.durationNs.store(event.durationNs, std::memory_order_relaxed);
+         written.store(index + 1, std::memory_order_release);
+      }
+
+      // Appends the events published when it is called. The owner can overwrite the oldest ones while they are copied:
+      // a copy that read any part of a newer event also sees its claim (the fences pair up), so the events whose
+      // slots were claimed again are dropped after the copy
+      void snapshot(std::vector<ProfileEvent>& out) const
+      {
+         uint64_t end = written.load(std::memory_order_acquire);
+         uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+
+         size_t first = out.size();
+         for (uint64_t i = begin; i < end; i++)
+         {
+            const Slot& slot = events[i & (CAPACITY - 1)];
+            out.push_back(ProfileEvent{slot.name.load(std::memory_order_relaxed), slot.startNs.load(std::memory_order_relaxed),
+                                       slot.durationNs.load(std::memory_order_relaxed)});
+         }
+
+         std::atomic_thread_fence(std::memory_order_acquire);
+         uint64_t claimedAfter = claimed.load(std::memory_order_relaxed);
+         uint64_t overwritten = claimedAfter > CAPACITY ? claimedAfter - CAPACITY : 0;
+         if(overwritten > begin)
+         {
+            size_t lost = (size_t)std::min(overwritten - begin, end - begin);
+            out.erase(out.begin() + first, out.begin() + first + lost);
+         }
+      }
+
+      uint64_t recorded() const noexcept { return written.load(std::memory_order_relaxed); }
+
+      const uint32_t thread;
+      std::string name;
+
+   private:
+      // an event whose fields the owner can write while a snapshot reads them
+      struct Slot
+      {
+         std::atomic<const char*> name;
+         std::atomic<uint64_t>    startNs;
+         std::atomic<uint64_t>    durationNs;
+      };
+
+      std::unique_ptr<Slot[]> events;
+      std::atomic<uint64_t> claimed; // events the owner started writing
+      std::atomic<uint64_t> written; // events complete
+};
+
+class Profiler
+{
+   public:
+      // Frames between a GPU query and its read back
+      static const size_t GPU_FRAME_LATENCY = 4;
+      // Query pools: the one of the frame being recorded, and the ones of the GPU_FRAME_LATENCY frames waiting to be read
+      static const size_t GPU_FRAME_POOLS = GPU_FRAME_LATENCY + 1;
+      // Track of the GPU events in the trace
+      static const uint32_t GPU_THREAD = 0xFFFF;
+
+      // There must be only one, profiler(): the ring of each thread is found through a thread_local
+      Profiler() : epoch(std::chrono::steady_clock::now()), enabled(true), frameIndex(0), activeGpuQuery(0),
+                   droppedGpuEvents(0), nestedGpuScopes(0), gpuRing(GPU_THREAD, "GPU") {}
+
+      Profiler(const Profiler& copy) = delete;
+      Profiler& operator=(const Profiler& copy) = delete;
+
+      void setEnabled(bool enable) noexcept { enabled.store(enable, std::memory_order_relaxed); }
+      bool isEnabled() const noexcept { return enabled.load(std::memory_order_relaxed); }
+
+      uint64_t nowNs() const
+      {
+         return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+      }
+
+      // Lock free after the first event of the thread (which registers its ring)
+      void record(const ProfileEvent& event) { threadRing().push(event); }
+
+      // Name of the calling thread in the trace
+      void setThreadName(const std::string& name)
+      {
+         ProfileRing& ring = threadRing();
+         std::lock_guard<std::mutex> lock(ringsMutex);
+         ring.name = name;
+      }
+
+      #pragma region gpu
+         // GL_TIME_ELAPSED queries cannot be nested: a GPU scope inside another one is not measured (and counted)
+         void beginGpu(const char* name)
+         {
+            if(!isEnabled()) return;
+            if(activeGpuQuery)
+            {
+               nestedGpuScopes++;
+               return;
+            }
+
+            GpuFrame& frame = gpuFrames[frameIndex % GPU_FRAME_POOLS];
+            if(frame.used == frame.queries.size())
+            {
+               GLuint query;
+               glGenQueries(1, &query);
+               frame.queries.push_back(query);
+               frame.events.push_back(ProfileEvent());
+            }
+
+            activeGpuQuery = frame.queries[frame.used];
+            frame.events[frame.used] = ProfileEvent{name, nowNs(), 0};
+            frame.used++;
+            glBeginQuery(GL_TIME_ELAPSED, activeGpuQuery);
+         }
+
+         void endGpu()
+         {
+            if(!activeGpuQuery) return;
+            glEndQuery(GL_TIME_ELAPSED);
+            activeGpuQuery = 0;
+         }
+
+         // To be called once per frame by the GL thread: reads the queries of the frame GPU_FRAME_LATENCY frames
+         // before the one ending, whose pool is reused by the next frame
+         void endFrame()
+         {
+            frameIndex++;
+            GpuFrame& frame = gpuFrames[frameIndex % GPU_FRAME_POOLS];
+
+            for (size_t i = 0; i < frame.used; i++)
+            {
+               // a result still missing after so many frames is dropped, waiting for it would stall
+               GLint available = GL_FALSE;
+               glGetQueryObjectiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+               if(!available)
+               {
+                  droppedGpuEvents++;
+                  continue;
+               }
+
+               GLuint64 elapsed = 0;
+               glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &elapsed);
+
+               // the GPU work starts after the CPU submits it: the start is the CPU one, the duration the GPU one
+               ProfileEvent event = frame.events[i];
+               event.durationNs = elapsed;
+               gpuRing.push(event);
+            }
+            frame.used = 0;
+         }
+      #pragma endregion
+
+      // Writes all the events recorded so far as a Chrome trace, returns false if the file cannot be written
+      bool writeChromeTrace(const std::string& path)
+      {
+         std::ofstream trace(path);
+         trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+         bool first = true;
+         std::vector<ProfileEvent> events;
+         {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (const std::unique_ptr<ProfileRing>& ring : rings)
+            {
+               events.clear();
+               ring->snapshot(events);
+               writeThreadName(trace, first, ring->thread, ring->name);
+               for (const ProfileEvent& event : events) { writeEvent(trace, first, ring->thread, event); }
+            }
+         }
+
+         events.clear();
+         gpuRing.snapshot(events);
+         if(!events.empty()) writeThreadName(trace, first, GPU_THREAD, gpuRing.name);
+         for (const ProfileEvent& event : events) { writeEvent(trace, first, GPU_THREAD, event); }
+
+         trace << "\n]}\n";
+         if(!trace)
+         {
+            std::cout << "Could not write the trace " << path << std::endl;
+            return false;
+         }
+         return true;
+      }
+
+      // GPU scopes lost because nested, or because their result came too late
+      size_t skippedGpuScopes() const noexcept { return nestedGpuScopes + droppedGpuEvents; }
+
+   private:
+      struct GpuFrame
+      {
+         std::vector<GLuint> queries;
+         std::vector<ProfileEvent> events;
+         size_t used = 0;
+      };
+
+      const std::chrono::steady_clock::time_point epoch;
+      std::atomic<bool> enabled;
+
+      std::mutex ringsMutex;
+      std::vector<std::unique_ptr<ProfileRing>> rings; // kept after their thread ends, for the export
+
+      // used only by the GL thread (the queries are never deleted: at exit the GL context is usually gone already)
+      GpuFrame gpuFrames[GPU_FRAME_POOLS];
+      size_t frameIndex;
+      GLuint activeGpuQuery;
+      size_t droppedGpuEvents, nestedGpuScopes;
+      // GPU events read back, the GL thread is its producer
+      ProfileRing gpuRing;
+
+      ProfileRing& threadRing()
+      {
+         thread_local ProfileRing* ring = nullptr;
+         if(!ring)
+         {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            rings.emplace_back(new ProfileRing((uint32_t)rings.size() + 1, "Thread " + std::to_string(rings.size() + 1)));
+            ring = rings.back().get();
+         }
+         return *ring;
+      }
+
+      // Chrome traces are in microseconds
+      static void writeEvent(std::ofstream& trace, bool& first, uint32_t thread, const ProfileEvent& event)
+      {
+         trace << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+               << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+         first = false;
+      }
+
+      static void writeThreadName(std::ofstream& trace, bool& first, uint32_t thread, const std::string& name)
+      {
+         trace << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+               << ",\"args\":{\"name\":\"" << name << "\"}}";
+         first = false;
+      }
+};
+
+// The profiler of the application
+inline Profiler& profiler()
+{
+   static Profiler instance;
+   return instance;
+}
+
+// Records the time from its construction to its destruction
+class ProfileScope
+{
+   public:
+      explicit ProfileScope(const char* name) : name(name), startNs(profiler().isEnabled() ? profiler().nowNs() : NOT_STARTED) {}
+
+      ProfileScope(const ProfileScope& copy) = delete;
+      ProfileScope& operator=(const ProfileScope& copy) = delete;
+
+      ~ProfileScope()
+      {
+         if(startNs == NOT_STARTED) return;
+         profiler().record(ProfileEvent{name, startNs, profiler().nowNs() - startNs});
+      }
+
+   private:
+      static const uint64_t NOT_STARTED = ~0ull;
+      const char* name;
+      uint64_t startNs;
+};
+
+class GpuProfileScope
+{
+   public:
+      explicit GpuProfileScope(const char* name) { profiler().beginGpu(name); }
+      ~GpuProfileScope() { profiler().endGpu(); }
+
+      GpuProfileScope(const GpuProfileScope& copy) = delete;
+      GpuProfileScope& operator=(const GpuProfileScope& copy) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifndef UTILS_NO_PROFILER
+   #define PROFILE_SCOPE(name)     ProfileScope    PROFILE_CONCAT(profileScope, __COUNTER__)(name)
+   #define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __COUNTER__)(name)
+#else
+   #define PROFILE_SCOPE(name)
+   #define PROFILE_GPU_SCOPE(name)
+#endif
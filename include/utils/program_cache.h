@@ -0,0 +1,140 @@
+#pragma once
+/*
+   ProgramCache class
+   - binary cache of the linked shader programs (glGetProgramBinary), written next to the vertex shader after the first link
+   - a binary is used only if it was built from the same merged sources by the same driver, and the driver can still
+     reject it (e.g. after an update), in which case the program is compiled again
+*/
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <cstdio>
+
+#include <utils/hash.h>
+
+class ProgramCache
+{
+   public:
+      // Bumped every time the file layout changes
+      static const uint32_t VERSION = 1;
+
+      static std::string cachePath(const std::string& vertPath, const std::string& fragPath, const std::vector<std::string>& utilPaths)
+      {
+         // programs sharing the vertex shader are told apart by a hash of the fragment shader and of the utils, in order
+         // (the same shaders with other utils are another program), the name of the fragment shader is only for reading
+         uint64_t hash = fnv1a(fragPath.data(), fragPath.size());
+         for (const std::string& utilPath : utilPaths)
+         {
+            // the terminator keeps "a" + "bc" apart from "ab" + "c"
+            hash = fnv1a(utilPath.c_str(), utilPath.size() + 1, hash);
+         }
+
+         char hex[17];
+         std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+         size_t slash = fragPath.find_last_of("/\\");
+         return vertPath + "+" + fragPath.substr(slash == std::string::npos ? 0 : slash + 1) + "." + hex + ".programcache";
+      }
+
+      // Hash of the GL version and of the driver, the binaries of a driver are useless for any other one
+      static uint64_t driverHash()
+      {
+         uint64_t hash = fnv1a("", 0);
+         const GLenum strings[] = { GL_VERSION, GL_RENDERER, GL_VENDOR };
+         for (GLenum name : strings)
+         {
+            const char* value = reinterpret_cast<const char*>(glGetString(name));
+            if(value) hash = fnv1a(value, std::strlen(value), hash);
+         }
+         return hash;
+      }
+
+      // Loads the binary in program, returns false if the cache is missing, stale or rejected by the driver
+      // (program must then be deleted, as a rejected binary leaves it unusable)
+      static bool load(const std::string& path, uint64_t sourceHash, GLuint program)
+      {
+         std::ifstream cache(path, std::ios::binary);
+         if(!cache) return false;
+
+         Header header;
+         if(!cache.read(reinterpret_cast<char*>(&header), sizeof(Header))) return false;
+
+         Header expected;
+         stamp(sourceHash, expected);
+         if(std::memcmp(&header, &expected, offsetof(Header, binaryFormat)) != 0) return false;
+
+         std::vector<char> binary(header.binaryLength);
+         if(!cache.read(binary.data(), binary.size())) return false;
+
+         glProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+
+         GLint success = GL_FALSE;
+         glGetProgramiv(program, GL_LINK_STATUS, &success);
+         return success == GL_TRUE;
+      }
+
+      // program must be linked, with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before linking
+      static bool save(const std::string& path, uint64_t sourceHash, GLuint program)
+      {
+         // a driver may support no binary format at all
+         GLint formatCount = 0;
+         glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+         if(formatCount == 0) return false;
+
+         GLint length = 0;
+         glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+         if(length <= 0) return false;
+
+         Header header;
+         stamp(sourceHash, header);
+
+         std::vector<char> binary(length);
+         GLsizei written = 0;
+         GLenum format = 0;
+         glGetProgramBinary(program, length, &written, &format, binary.data());
+         header.binaryFormat = (uint32_t)format;
+         header.binaryLength = (uint32_t)written;
+
+         std::ofstream cache(path, std::ios::binary | std::ios::trunc);
+         cache.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+         cache.write(binary.data(), written);
+
+         if(!cache)
+         {
+            std::cout << "Warning: could not write program cache " << path << std::endl;
+            return false;
+         }
+         return true;
+      }
+
+   private:
+      struct Header
+      {
+         char     magic[8];
+         uint32_t version;
+         uint32_t pad0;
+         // identity of the sources and of the driver the binary was built from
+         uint64_t sourceHash;
+         uint64_t driverHash;
+         uint32_t binaryFormat;
+         uint32_t binaryLength;
+      };
+
+      // Fills everything but the binary format and length with the values the cache must have
+      static void stamp(uint64_t sourceHash, Header& header)
+      {
+         static const uint64_t currentDriver = driverHash();
+
+         std::memset(&header, 0, sizeof(Header));
+         std::memcpy(header.magic, "PGPROG", 6);
+         header.version    = VERSION;
+         header.sourceHash = sourceHash;
+         header.driverHash = currentDriver;
+      }
+};
@@ -0,0 +1,241 @@
+#pragma once
+/*
+   RenderQueue class
+   - collects one draw packet per mesh, each with a 64 bit sort key built from its render state
+   - radix sorts the keys every frame, so the packets sharing program, subroutine, material and VAO end up together
+   - executes the packets issuing only the state changes between consecutive packets
+*/
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+
+#include <utils/model.h>
+#include <utils/shader.h>
+#include <utils/material.h>
+
+enum RenderPass : uint32_t
+{
+   PASS_OPAQUE      = 0, // front to back, grouped by state first
+   PASS_TRANSPARENT = 1, // back to front, grouped by state only at equal depth
+};
+
+struct DrawPacket
+{
+   uint64_t        key;
+   const Shader*   shader;
+   GLuint          subroutine; // of the fragment stage, GL_INVALID_INDEX to keep the selected one
+   const Material* material;   // nullptr to keep the values already set on the shader
+   const Mesh*     mesh;
+   uint32_t        lod;
+   glm::mat4       world;
+   glm::mat3       normal;     // world space normal matrix
+};
+
+// State changes issued by the last execute()
+struct RenderStats
+{
+   size_t packets           = 0;
+   size_t programChanges    = 0;
+   size_t subroutineChanges = 0;
+   size_t materialChanges   = 0;
+   size_t vaoChanges        = 0;
+};
+
+class RenderQueue
+{
+   public:
+      // Key fields, from the most significant bits: pass, program, subroutine, material, VAO, depth
+      // (the transparent pass moves the depth right after the pass)
+      static const int PASS_BITS       = 2;
+      static const int PROGRAM_BITS    = 10;
+      static const int SUBROUTINE_BITS = 6;
+      static const int MATERIAL_BITS   = 10;
+      static const int VAO_BITS        = 16;
+      static const int DEPTH_BITS      = 20;
+
+      // Starts a frame: view is used for the depth of the packets and for the normal matrices,
+      // the depth is quantized over [0, depthRange] (the far plane)
+      void begin(const glm::mat4& view, float depthRange)
+      {
+         packets.clear();
+         this->view = view;
+         this->depthRange = depthRange;
+      }
+
+      // One packet for each mesh of the model
+      void submit(const Model& model, const Shader& shader, const Material* material, GLuint subroutine,
+                  const glm::mat4& world, const glm::mat3& normal, size_t lod = 0, RenderPass pass = PASS_OPAQUE)
+      {
+         // the distance of the model origin along the view direction
+         float viewDepth = -(view * world[3]).z;
+         uint64_t depth = (uint64_t)(glm::clamp(viewDepth / depthRange, 0.0f, 1.0f) * (float)fieldMask(DEPTH_BITS));
+
+         uint64_t programId    = compactId(programIds, shader.program, PROGRAM_BITS);
+         uint64_t subroutineId = subroutine == GL_INVALID_INDEX ? 0 : (subroutine + 1) & fieldMask(SUBROUTINE_BITS);
+         uint64_t materialId   = compactId(materialIds, material, MATERIAL_BITS);
+
+         for (const Mesh& mesh : model.meshes)
+         {
+            uint64_t vaoId = compactId(vaoIds, mesh.VAO, VAO_BITS);
+
+            uint64_t key = (uint64_t)pass << (64 - PASS_BITS);
+            if(pass == PASS_TRANSPARENT)
+            {
+               // farther first: the depth is inverted, and it comes before the state
+               key |= (fieldMask(DEPTH_BITS) - depth) << (64 - PASS_BITS - DEPTH_BITS);
+               key |= ((programId << (SUBROUTINE_BITS + MATERIAL_BITS + VAO_BITS)) | (subroutineId << (MATERIAL_BITS + VAO_BITS)) |
+                       (materialId << VAO_BITS) | vaoId);
+            }
+            else
+            {
+               key |= programId    << (SUBROUTINE_BITS + MATERIAL_BITS + VAO_BITS + DEPTH_BITS);
+               key |= subroutineId << (MATERIAL_BITS + VAO_BITS + DEPTH_BITS);
+               key |= materialId   << (VAO_BITS + DEPTH_BITS);
+               key |= vaoId        << DEPTH_BITS;
+               key |= depth;
+            }
+
+            packets.push_back(DrawPacket{key, &shader, subroutine, material, &mesh, (uint32_t)lod, world, normal});
+         }
+      }
+
+      // LSD radix sort of the keys, one byte per pass (the passes on a byte all the keys share are skipped)
+      void sort()
+      {
+         PROFILE_SCOPE("RenderQueue::sort");
+         size_t count = packets.size();
+         order.resize(count);
+         scratch.resize(count);
+         for (size_t i = 0; i < count; i++) { order[i] = SortEntry{packets[i].key, (uint32_t)i}; }
+         if(count < 2) return;
+
+         for (int shift = 0; shift < 64; shift += 8)
+         {
+            size_t histogram[256] = {};
+            for (const SortEntry& entry : order) { histogram[(entry.key >> shift) & 0xFF]++; }
+            if(histogram[(order[0].key >> shift) & 0xFF] == count) continue;
+
+            size_t offset = 0;
+            for (size_t digit = 0; digit < 256; digit++)
+            {
+               size_t digitCount = histogram[digit];
+               histogram[digit] = offset;
+               offset += digitCount;
+            }
+            for (const SortEntry& entry : order) { scratch[histogram[(entry.key >> shift) & 0xFF]++] = entry; }
+            order.swap(scratch);
+         }
+      }
+
+      // Draws the packets in the sorted order. The state is compared with the one set by the previous packet
+      // (not with the key bits, as the compact ids wrap around when there are too many), and set only if it differs
+      void execute()
+      {
+         PROFILE_SCOPE("RenderQueue::execute");
+         stats = RenderStats();
+         stats.packets = order.size();
+
+         const Shader* currentShader = nullptr;
+         GLuint currentSubroutine = GL_INVALID_INDEX;
+         const Material* currentMaterial = nullptr;
+         GLuint currentVAO = glState().vertexArray();
+         ProgramUniforms uniforms;
+
+         for (const SortEntry& entry : order)
+         {
+            const DrawPacket& packet = packets[entry.packet];
+
+            if(packet.shader != currentShader)
+            {
+               // use() selects again the subroutines the shader had, so the subroutine is not known to change
+               currentShader = packet.shader;
+               currentShader->use();
+               currentSubroutine = GL_INVALID_INDEX;
+               currentMaterial = nullptr;
+               uniforms = programUniforms(*currentShader);
+               stats.programChanges++;
+            }
+            if(packet.subroutine != GL_INVALID_INDEX && packet.subroutine != currentSubroutine)
+            {
+               currentSubroutine = packet.subroutine;
+               currentShader->setSubroutine(GL_FRAGMENT_SHADER, currentSubroutine);
+               stats.subroutineChanges++;
+            }
+            if(packet.material && packet.material != currentMaterial)
+            {
+               currentMaterial = packet.material;
+               currentMaterial->apply(*currentShader);
+               stats.materialChanges++;
+            }
+            if(packet.mesh->VAO != currentVAO)
+            {
+               currentVAO = packet.mesh->VAO;
+               glState().bindVertexArray(currentVAO);
+               stats.vaoChanges++;
+            }
+
+            // the rotation of the view brings the world space normals in view space
+            currentShader->setMat4(uniforms.model, packet.world);
+            currentShader->setMat3(uniforms.normal, glm::mat3(view) * packet.normal);
+
+            const IndexRange& range = packet.mesh->lodRange(packet.lod);
+            glDrawElements(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, (GLvoid*)(range.firstIndex * sizeof(GLuint)));
+            METRIC_ADD(METRIC_DRAW_CALLS, 1);
+            METRIC_ADD(METRIC_TRIANGLES, range.indexCount / 3);
+         }
+         METRIC_ADD(METRIC_OBJECTS, packets.size());
+      }
+
+      size_t size() const noexcept { return packets.size(); }
+      const RenderStats& lastStats() const noexcept { return stats; }
+
+   private:
+      struct SortEntry
+      {
+         uint64_t key;
+         uint32_t packet;
+      };
+
+      struct ProgramUniforms
+      {
+         uint32_t serial;
+         UniformHandle model, normal;
+      };
+
+      std::vector<DrawPacket> packets;
+      std::vector<SortEntry> order, scratch;
+      glm::mat4 view = glm::mat4(1.0f);
+      float depthRange = 1.0f;
+      RenderStats stats;
+
+      // compact ids of the programs, materials and VAOs seen so far, so they fit in their key fields
+      std::unordered_map<GLuint, uint32_t> programIds, vaoIds;
+      std::unordered_map<const Material*, uint32_t> materialIds;
+      std::unordered_map<GLuint, ProgramUniforms> uniformsByProgram;
+
+      static uint64_t fieldMask(int bits) { return (1ull << bits) - 1; }
+
+      template <typename K>
+      static uint64_t compactId(std::unordered_map<K, uint32_t>& ids, K value, int bits)
+      {
+         auto it = ids.find(value);
+         if(it == ids.end()) it = ids.emplace(value, (uint32_t)ids.size()).first;
+         return it->second & fieldMask(bits);
+      }
+
+      ProgramUniforms programUniforms(const Shader& shader)
+      {
+         // a program reloaded (or a name reused by GL) has a new serial
+         auto it = uniformsByProgram.find(shader.program);
+         if(it != uniformsByProgram.end() && it->second.serial == shader.serial()) return it->second;
+
+         ProgramUniforms uniforms{shader.serial(), shader.uniform("modelMatrix"), shader.uniform("normalMatrix")};
+         uniformsByProgram[shader.program] = uniforms;
+         return uniforms;
+      }
+};
@@ -0,0 +1,101 @@
+#pragma once
+/*
+   SceneGraph class
+   - hierarchy of nodes, each one with a local translation, rotation and scale
+   - world and normal matrices are cached, and recomputed only for the nodes changed since the last update
+     (or whose ancestors changed)
+   - nodes live in contiguous arrays with every parent before its children, so the update is a linear sweep
+*/
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+
+typedef uint32_t SceneNode;
+const SceneNode NO_NODE = 0xFFFFFFFFu;
+
+class SceneGraph
+{
+   public:
+      // Parents must be created before their children, which keeps the arrays sorted parent-before-child
+      SceneNode create(SceneNode parent = NO_NODE, glm::vec3 position = glm::vec3(0.0f),
+                       glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3 scale = glm::vec3(1.0f))
+      {
+         parents.push_back(parent);
+         positions.push_back(position);
+         rotations.push_back(rotation);
+         scales.push_back(scale);
+         worldMatrices.push_back(glm::mat4(1.0f));
+         normalMatrices.push_back(glm::mat3(1.0f));
+         dirty.push_back(1);
+         worldChanged.push_back(0);
+         return (SceneNode)(parents.size() - 1);
+      }
+
+      void setPosition(SceneNode node, const glm::vec3& position) { positions[node] = position; dirty[node] = 1; }
+      void setRotation(SceneNode node, const glm::quat& rotation) { rotations[node] = rotation; dirty[node] = 1; }
+      void setScale   (SceneNode node, const glm::vec3& scale)    { scales[node]    = scale;    dirty[node] = 1; }
+
+      const glm::vec3& position(SceneNode node) const { return positions[node]; }
+      const glm::quat& rotation(SceneNode node) const { return rotations[node]; }
+      const glm::vec3& scale   (SceneNode node) const { return scales[node]; }
+      SceneNode        parent  (SceneNode node) const { return parents[node]; }
+
+      // Valid after update()
+      const glm::mat4& world(SceneNode node) const { return worldMatrices[node]; }
+      // Inverse transpose of the world matrix (upper 3x3), brings normals in world space
+      const glm::mat3& normalMatrix(SceneNode node) const { return normalMatrices[node]; }
+      // True if the last update() changed the world matrix of the node
+      bool changed(SceneNode node) const { return worldChanged[node] != 0; }
+
+      size_t size() const noexcept { return parents.size(); }
+
+      // Recomputes the matrices of the dirty nodes and of their descendants
+      void update()
+      {
+         for (size_t i = 0; i < parents.size(); i++)
+         {
+            SceneNode parent = parents[i];
+            // the parent was already visited, so its flag already tells if it moved in this update
+            bool moved = dirty[i] || (parent != NO_NODE && worldChanged[parent]);
+            worldChanged[i] = moved ? 1 : 0;
+            if(!moved) continue;
+
+            // local = T * R * S, and its inverse transpose is R * S^-1, so no inverse is needed
+            glm::mat3 rotation = glm::mat3_cast(rotations[i]);
+            glm::mat4 local(1.0f);
+            glm::mat3 localNormal;
+            for (int axis = 0; axis < 3; axis++)
+            {
+               local[axis]       = glm::vec4(rotation[axis] * scales[i][axis], 0.0f);
+               localNormal[axis] = rotation[axis] / scales[i][axis];
+            }
+            local[3] = glm::vec4(positions[i], 1.0f);
+
+            if(parent == NO_NODE)
+            {
+               worldMatrices[i]  = local;
+               normalMatrices[i] = localNormal;
+            }
+            else
+            {
+               worldMatrices[i]  = worldMatrices[parent] * local;
+               normalMatrices[i] = normalMatrices[parent] * localNormal;
+            }
+            dirty[i] = 0;
+         }
+      }
+
+   private:
+      // one entry per node in every array
+      std::vector<SceneNode> parents;
+      std::vector<glm::vec3> positions;
+      std::vector<glm::quat> rotations;
+      std::vector<glm::vec3> scales;
+      std::vector<glm::mat4> worldMatrices;
+      std::vector<glm::mat3> normalMatrices;
+      std::vector<uint8_t> dirty;
+      std::vector<uint8_t> worldChanged;
+};
@@ -5,6 +5,8 @@
 */
 
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -13,78 +15,353 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <utils/uniform_buffer.h>
+#include <utils/gl_state.h>
+#include <utils/program_cache.h>
+#include <utils/profiler.h>
+#include <utils/metrics.h>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+   #define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// BUILD_DEFERRED only starts compiling and linking, Shader::finish() must be called before using the program
+enum ShaderBuild { BUILD_NOW, BUILD_DEFERRED };
+
+// Source code of the stages of a program, utils are prepended to both
+struct ShaderSources
+{
+   std::string vertex;
+   std::string fragment;
+   std::string utils;
+};
+
+// Uniform location resolved once through Shader::uniform(), so that
+// per-frame set* calls are a plain integer store with no string lookup
+struct UniformHandle
+{
+   GLint location = -1;
+
+   bool valid() const noexcept { return location != -1; }
+};
+
 class Shader
 {
    public:
       GLuint program;
 
-      Shader(const GLchar* vertPath, const GLchar* fragPath, std::initializer_list<GLchar*> utilPaths = {}, GLuint glMajor = 4, GLuint glMinor = 1) : glMajorVersion(glMajor), glMinorVersion(glMinor)
+      Shader(const GLchar* vertPath, const GLchar* fragPath, std::initializer_list<const GLchar*> utilPaths = {}, GLuint glMajor = 4, GLuint glMinor = 1,
+             ShaderBuild build = BUILD_NOW) :
+         glMajorVersion(glMajor), glMinorVersion(glMinor), vertexPath(vertPath), fragmentPath(fragPath),
+         vertexShader(0), fragmentShader(0), finished(false), linked(false), cached(false), buildSerial(0)
       {
-         const std::string vertSource = loadSource(vertPath);
-         const std::string fragSource = loadSource(fragPath);
+         PROFILE_SCOPE("Shader::Shader");
 
-         std::string utilsSource;
-         
          for( auto utilPath : utilPaths )
          {
-            utilsSource += loadSource(utilPath) + "\n";
+            utilityPaths.push_back(utilPath);
          }
 
-         GLuint vertexShader = compileShader(vertSource, GL_VERTEX_SHADER, utilsSource);
-         GLuint fragmentShader = compileShader(fragSource, GL_FRAGMENT_SHADER, utilsSource);
+         startBuild(readSources());
+         if(build == BUILD_NOW) finish();
+      }
 
-         // Link shaders
-         program = glCreateProgram();
-         /*
-         for( auto utilPath : utilPaths )
+      // True if finish() would not wait for the driver. Without KHR_parallel_shader_compile the driver cannot be asked,
+      // so a deferred shader is never reported complete before finish()
+      bool completed() const
+      {
+         if(finished) return true;
+         if(!parallelCompileSupported()) return false;
+
+         GLint done = GL_FALSE;
+         glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+         return done == GL_TRUE;
+      }
+
+      // Checks the compilation and the link (waiting for them if needed) and sets the program up
+      void finish()
+      {
+         if(finished) return;
+         finished = true;
+         PROFILE_SCOPE("Shader::finish");
+
+         // shaders are compiled only when the program did not come from the binary cache
+         linked = true;
+         if(vertexShader)
          {
-            const std::string utilSource = loadSource(utilPath);
-            GLuint utilShader = compileShader(utilSource, GL_VERTEX_SHADER);
-            glAttachShader(program, utilShader);
-         }*/
+            checkCompileErrors(vertexShader);
+            checkCompileErrors(fragmentShader);
+            linked = checkLinkingErrors();
+            if(linked) ProgramCache::save(cachePath, sourceHash, program);
 
-         glAttachShader(program, vertexShader);
-         glAttachShader(program, fragmentShader);
-         glLinkProgram(program);
-         checkLinkingErrors();
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            vertexShader = fragmentShader = 0;
+         }
+
+         bindUniformBlocks();
+         cacheUniformLocations();
+         cacheSubroutines();
+         buildSerial = nextSerial();
+      }
+
+      bool isFinished() const noexcept { return finished; }
+      // After finish(): false if the program failed to link
+      bool isLinked() const noexcept { return linked; }
+      // True if the program was loaded from the binary cache of a previous run, instead of being compiled
+      bool fromCache() const noexcept { return cached; }
+
+      // Unique for every program built, unlike the program name that GL can reuse after a deletion:
+      // the caches of per-program data (uniform handles...) compare it to know if they are stale
+      uint32_t serial() const noexcept { return buildSerial; }
+
+      // Every file the program is built from
+      std::vector<std::string> sourcePaths() const
+      {
+         std::vector<std::string> paths = utilityPaths;
+         paths.push_back(vertexPath);
+         paths.push_back(fragmentPath);
+         return paths;
+      }
+
+      // Reads the files of the program again, touches no GL state (so any thread can call it)
+      ShaderSources readSources() const
+      {
+         ShaderSources sources;
+         sources.vertex = loadSource(vertexPath.c_str());
+         sources.fragment = loadSource(fragmentPath.c_str());
+         for( const std::string& utilPath : utilityPaths )
+         {
+            sources.utils += loadSource(utilPath.c_str()) + "\n";
+         }
+         return sources;
+      }
 
-         glDeleteShader(vertexShader);
-         glDeleteShader(fragmentShader);
+      // Builds a new program from the sources, and replaces the current one only if the new one links.
+      // The subroutines selected keep their names, but their indices (and the uniform handles) can change
+      bool reload(const ShaderSources& sources)
+      {
+         PROFILE_SCOPE("Shader::reload");
+         Shader rebuilt(*this, sources);
+         if(!rebuilt.linked)
+         {
+            rebuilt.del();
+            return false;
+         }
+
+         rebuilt.selectSubroutinesAs(GL_VERTEX_SHADER, vertexSubroutines);
+         rebuilt.selectSubroutinesAs(GL_FRAGMENT_SHADER, fragmentSubroutines);
+
+         // the new program is created before the old one is deleted, so they never share the name.
+         // The paths are not assigned, as the watcher thread of ShaderReloader reads them
+         glState().deleteProgram(program);
+         program             = rebuilt.program;
+         cachePath           = std::move(rebuilt.cachePath);
+         sourceHash          = rebuilt.sourceHash;
+         cached              = rebuilt.cached;
+         buildSerial         = rebuilt.buildSerial;
+         uniformLocations    = std::move(rebuilt.uniformLocations);
+         vertexSubroutines   = std::move(rebuilt.vertexSubroutines);
+         fragmentSubroutines = std::move(rebuilt.fragmentSubroutines);
+         return true;
+      }
+
+      // KHR_parallel_shader_compile lets the application poll GL_COMPLETION_STATUS_KHR without blocking
+      static bool parallelCompileSupported()
+      {
+         static const bool supported = hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile");
+         return supported;
+      }
+
+      // GL forgets the selected subroutines at every glUseProgram, so they are selected again here
+      // (the state cache skips both calls when the program is already in use)
+      void use() const noexcept
+      {
+         glState().useProgram(program);
+         if(!vertexSubroutines.selected.empty())   glState().setSubroutines(GL_VERTEX_SHADER,   (GLsizei)vertexSubroutines.selected.size(),   vertexSubroutines.selected.data());
+         if(!fragmentSubroutines.selected.empty()) glState().setSubroutines(GL_FRAGMENT_SHADER, (GLsizei)fragmentSubroutines.selected.size(), fragmentSubroutines.selected.data());
+      }
+      void del()
+      {
+         // the shaders of a build never finished are still around
+         if(vertexShader)
+         {
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            vertexShader = fragmentShader = 0;
+         }
+         glState().deleteProgram(program);
       }
 
-      void use() const noexcept { glUseProgram(program); }
-      void del()                { glDeleteProgram(program); }
+      // Returns the cached location of an active uniform (invalid handle if the uniform does not exist or was optimized away)
+      UniformHandle uniform(const std::string &name) const
+      {
+         auto it = uniformLocations.find(name);
+         return it != uniformLocations.end() ? UniformHandle{it->second} : UniformHandle{};
+      }
+
+      // Returns the cached index of an active subroutine of the stage (GL_INVALID_INDEX if it does not exist)
+      GLuint subroutine(GLenum stage, const std::string& name) const
+      {
+         const StageSubroutines& subroutines = stageSubroutines(stage);
+         auto it = subroutines.indices.find(name);
+         return it != subroutines.indices.end() ? it->second : GL_INVALID_INDEX;
+      }
+
+      // Selects the subroutine of a subroutine uniform (location 0 for the programs with just one) while the program
+      // is in use, and keeps it for the next use()
+      void setSubroutine(GLenum stage, GLuint index, GLuint uniformLocation = 0) const
+      {
+         StageSubroutines& subroutines = stageSubroutines(stage);
+         if(index == GL_INVALID_INDEX || uniformLocation >= subroutines.selected.size()) return;
+
+         subroutines.selected[uniformLocation] = index;
+         glState().setSubroutines(stage, (GLsizei)subroutines.selected.size(), subroutines.selected.data());
+      }
 
       #pragma region utility_uniform_functions
-         void setBool (const std::string &name, bool value)                             const { glUniform1i (glGetUniformLocation(program, name.c_str()), (int)value); }
-         void setInt  (const std::string &name, int value)                               const { glUniform1i (glGetUniformLocation(program, name.c_str()), value); }
-         void setUint (const std::string &name, unsigned int value)                             const { glUniform1ui(glGetUniformLocation(program, name.c_str()), value); }
-         void setFloat(const std::string &name, float value)                           const { glUniform1f (glGetUniformLocation(program, name.c_str()), value); }
-
-         void setVec2(const std::string &name, const GLfloat value [])                 const { glUniform2fv(glGetUniformLocation(program, name.c_str()), 1, &value[0]); }
-         void setVec2(const std::string &name, const glm::vec2 &value)                 const { glUniform2fv(glGetUniformLocation(program, name.c_str()), 1, glm::value_ptr(value)); }
-         void setVec2(const std::string &name, float x, float y)                       const { glUniform2f (glGetUniformLocation(program, name.c_str()), x, y); }
+         void setBool (const std::string &name, bool value)                            const { setBool (uniform(name), value); }
+         void setInt  (const std::string &name, int value)                             const { setInt  (uniform(name), value); }
+         void setUint (const std::string &name, unsigned int value)                    const { setUint (uniform(name), value); }
+         void setFloat(const std::string &name, float value)                           const { setFloat(uniform(name), value); }
+
+         void setVec2(const std::string &name, const GLfloat value [])                 const { setVec2(uniform(name), value); }
+         void setVec2(const std::string &name, const glm::vec2 &value)                 const { setVec2(uniform(name), value); }
+         void setVec2(const std::string &name, float x, float y)                       const { setVec2(uniform(name), x, y); }
          
-         void setVec3(const std::string &name, const GLfloat value [])                 const { glUniform3fv(glGetUniformLocation(program, name.c_str()), 1, &value[0]); }
-         void setVec3(const std::string &name, const glm::vec3 &value)                 const { glUniform3fv(glGetUniformLocation(program, name.c_str()), 1, glm::value_ptr(value)); }
-         void setVec3(const std::string &name, float x, float y, float z)              const { glUniform3f (glGetUniformLocation(program, name.c_str()), x, y, z); }
+         void setVec3(const std::string &name, const GLfloat value [])                 const { setVec3(uniform(name), value); }
+         void setVec3(const std::string &name, const glm::vec3 &value)                 const { setVec3(uniform(name), value); }
+         void setVec3(const std::string &name, float x, float y, float z)              const { setVec3(uniform(name), x, y, z); }
          
-         void setVec4(const std::string &name, const GLfloat value [])                 const { glUniform4fv(glGetUniformLocation(program, name.c_str()), 1, &value[0]); }
-         void setVec4(const std::string &name, const glm::vec4 &value)                 const { glUniform4fv(glGetUniformLocation(program, name.c_str()), 1, glm::value_ptr(value)); }
-         void setVec4(const std::string &name, float x, float y, float z, float w)           { glUniform4f (glGetUniformLocation(program, name.c_str()), x, y, z, w); }
+         void setVec4(const std::string &name, const GLfloat value [])                 const { setVec4(uniform(name), value); }
+         void setVec4(const std::string &name, const glm::vec4 &value)                 const { setVec4(uniform(name), value); }
+         void setVec4(const std::string &name, float x, float y, float z, float w)     const { setVec4(uniform(name), x, y, z, w); }
          
-         void setMat2(const std::string &name, const glm::mat2 &mat)                   const { glUniformMatrix2fv(glGetUniformLocation(program, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat)); }
+         void setMat2(const std::string &name, const glm::mat2 &mat)                   const { setMat2(uniform(name), mat); }
          
-         void setMat3(const std::string &name, const glm::mat3 &mat)                   const { glUniformMatrix3fv(glGetUniformLocation(program, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat)); }
+         void setMat3(const std::string &name, const glm::mat3 &mat)                   const { setMat3(uniform(name), mat); }
          
-         void setMat4(const std::string &name, const glm::mat4 &mat)                   const { glUniformMatrix4fv(glGetUniformLocation(program, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat)); }
+         void setMat4(const std::string &name, const glm::mat4 &mat)                   const { setMat4(uniform(name), mat); }
+      #pragma endregion 
+
+      #pragma region utility_uniform_handle_functions
+         void setBool (UniformHandle u, bool value)                                    const { glUniform1i (u.location, (int)value); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setInt  (UniformHandle u, int value)                                     const { glUniform1i (u.location, value); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setUint (UniformHandle u, unsigned int value)                            const { glUniform1ui(u.location, value); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setFloat(UniformHandle u, float value)                                   const { glUniform1f (u.location, value); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+
+         void setVec2(UniformHandle u, const GLfloat value [])                         const { glUniform2fv(u.location, 1, &value[0]); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setVec2(UniformHandle u, const glm::vec2 &value)                         const { glUniform2fv(u.location, 1, glm::value_ptr(value)); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setVec2(UniformHandle u, float x, float y)                               const { glUniform2f (u.location, x, y); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         
+         void setVec3(UniformHandle u, const GLfloat value [])                         const { glUniform3fv(u.location, 1, &value[0]); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setVec3(UniformHandle u, const glm::vec3 &value)                         const { glUniform3fv(u.location, 1, glm::value_ptr(value)); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setVec3(UniformHandle u, float x, float y, float z)                      const { glUniform3f (u.location, x, y, z); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         
+         void setVec4(UniformHandle u, const GLfloat value [])                         const { glUniform4fv(u.location, 1, &value[0]); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setVec4(UniformHandle u, const glm::vec4 &value)                         const { glUniform4fv(u.location, 1, glm::value_ptr(value)); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         void setVec4(UniformHandle u, float x, float y, float z, float w)             const { glUniform4f (u.location, x, y, z, w); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         
+         void setMat2(UniformHandle u, const glm::mat2 &mat)                           const { glUniformMatrix2fv(u.location, 1, GL_FALSE, glm::value_ptr(mat)); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         
+         void setMat3(UniformHandle u, const glm::mat3 &mat)                           const { glUniformMatrix3fv(u.location, 1, GL_FALSE, glm::value_ptr(mat)); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
+         
+         void setMat4(UniformHandle u, const glm::mat4 &mat)                           const { glUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(mat)); METRIC_ADD(METRIC_UNIFORM_UPLOADS, 1); }
       #pragma endregion 
 
    private:
       GLuint glMajorVersion;
       GLuint glMinorVersion;
+      std::string vertexPath, fragmentPath;
+      std::vector<std::string> utilityPaths;
+
+      // state of a build not finished yet
+      GLuint vertexShader, fragmentShader;
+      std::string cachePath;
+      uint64_t sourceHash;
+      bool finished;
+      bool linked;
+      bool cached;
+      uint32_t buildSerial;
+
+      // Same files and GL version of original, built from sources (used by reload())
+      Shader(const Shader& original, const ShaderSources& sources) :
+         glMajorVersion(original.glMajorVersion), glMinorVersion(original.glMinorVersion),
+         vertexPath(original.vertexPath), fragmentPath(original.fragmentPath), utilityPaths(original.utilityPaths),
+         vertexShader(0), fragmentShader(0), finished(false), linked(false), cached(false), buildSerial(0)
+      {
+         startBuild(sources);
+         finish();
+      }
+
+      // Starts compiling and linking, or loads the binary of a previous run if it comes from the very same
+      // sources (and driver)
+      void startBuild(const ShaderSources& sources)
+      {
+         const std::string mergedVertSource = mergeSource(sources.vertex, sources.utils);
+         const std::string mergedFragSource = mergeSource(sources.fragment, sources.utils);
+
+         cachePath = ProgramCache::cachePath(vertexPath, fragmentPath, utilityPaths);
+         sourceHash = fnv1a(mergedVertSource.data(), mergedVertSource.size());
+         sourceHash = fnv1a(mergedFragSource.data(), mergedFragSource.size(), sourceHash);
+
+         program = glCreateProgram();
+         cached = ProgramCache::load(cachePath, sourceHash, program);
+         if(cached) return;
+
+         // a rejected binary leaves the program unusable, we start again from a new one
+         glDeleteProgram(program);
+
+         // the status of the compilation and of the link is checked only in finish(), as asking it
+         // makes the driver wait for them
+         vertexShader = compileShader(mergedVertSource, GL_VERTEX_SHADER);
+         fragmentShader = compileShader(mergedFragSource, GL_FRAGMENT_SHADER);
 
-      const std::string loadSource(const GLchar* sourcePath) const noexcept
+         // Link shaders
+         program = glCreateProgram();
+         glAttachShader(program, vertexShader);
+         glAttachShader(program, fragmentShader);
+         glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+         glLinkProgram(program);
+      }
+
+      static uint32_t nextSerial()
+      {
+         static uint32_t serial = 0;
+         return ++serial;
+      }
+
+      // name -> location of every active uniform, filled once after linking
+      std::unordered_map<std::string, GLint> uniformLocations;
+
+      // name -> index of every active subroutine, and the subroutine selected for each subroutine uniform location
+      struct StageSubroutines
+      {
+         std::unordered_map<std::string, GLuint> indices;
+         std::vector<GLuint> selected;
+      };
+      mutable StageSubroutines vertexSubroutines, fragmentSubroutines;
+
+      StageSubroutines& stageSubroutines(GLenum stage) const { return stage == GL_VERTEX_SHADER ? vertexSubroutines : fragmentSubroutines; }
+
+      // Selects, for each subroutine uniform location, the subroutine with the name of the one selected in previous
+      void selectSubroutinesAs(GLenum stage, const StageSubroutines& previous)
+      {
+         StageSubroutines& subroutines = stageSubroutines(stage);
+         for (size_t location = 0; location < previous.selected.size() && location < subroutines.selected.size(); location++)
+         {
+            for (const auto& named : previous.indices)
+            {
+               if(named.second != previous.selected[location]) continue;
+
+               auto it = subroutines.indices.find(named.first);
+               if(it != subroutines.indices.end()) subroutines.selected[location] = it->second;
+               break;
+            }
+         }
+      }
+
+      static std::string loadSource(const GLchar* sourcePath) noexcept
       {
          std::string         sourceCode;
          std::ifstream       sourceFile;
@@ -107,7 +384,19 @@ class Shader
          return sourceCode;
       }
       
-      GLuint compileShader(const std::string& shaderSource, GLenum shaderType, const std::string& utilsSource = "") const noexcept
+      static bool hasExtension(const char* name)
+      {
+         GLint count = 0;
+         glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+         for (GLint i = 0; i < count; i++)
+         {
+            const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if(extension && std::string(extension) == name) return true;
+         }
+         return false;
+      }
+
+      std::string mergeSource(const std::string& shaderSource, const std::string& utilsSource = "") const
       {
          std::string mergedSource = "";
          // Prepending version
@@ -116,16 +405,17 @@ class Shader
          // Prepending utils
          mergedSource += utilsSource + shaderSource;
 
-         const std::string finalSource = mergedSource;
-
-         //std::cout << finalSource << std::endl;
+         //std::cout << mergedSource << std::endl;
+         return mergedSource;
+      }
 
+      GLuint compileShader(const std::string& finalSource, GLenum shaderType) const noexcept
+      {
          // Shader creation
          GLuint shader = glCreateShader(shaderType);
          const GLchar* c = finalSource.c_str();
          glShaderSource(shader, 1, &c, NULL);
          glCompileShader(shader);
-         checkCompileErrors(shader);
          return shader;
       }
 
@@ -141,7 +431,7 @@ class Shader
          }
       }
 
-      void checkLinkingErrors() const noexcept
+      bool checkLinkingErrors() const noexcept
       {
          GLint success; GLchar infoLog[512];
          glGetProgramiv(program, GL_LINK_STATUS, &success);
@@ -149,5 +439,101 @@ class Shader
             glGetProgramInfoLog(program, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
          }
+         return success;
+      }
+
+      void bindUniformBlocks() const
+      {
+         GLint count = 0;
+         glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+
+         GLchar name[256]; GLsizei length;
+         for (GLint i = 0; i < count; i++)
+         {
+            glGetActiveUniformBlockName(program, i, sizeof(name), &length, name);
+
+            // well-known blocks always read from the same binding point, whatever program is in use
+            GLint binding = uniformBlockBinding(name);
+            if(binding != -1) glUniformBlockBinding(program, i, binding);
+         }
+      }
+
+      void cacheUniformLocations()
+      {
+         uniformLocations.clear();
+
+         GLint count = 0, maxLength = 0;
+         glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+         glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+         std::vector<GLchar> nameBuffer(maxLength + 1);
+         for (GLint i = 0; i < count; i++)
+         {
+            GLsizei length; GLint size; GLenum type;
+            glGetActiveUniform(program, i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+
+            // uniform block members have no location, they are set through buffers
+            GLint location = glGetUniformLocation(program, nameBuffer.data());
+            if(location == -1) continue;
+
+            std::string name(nameBuffer.data(), length);
+            uniformLocations[name] = location;
+
+            // arrays of basic types are reported once as "name[0]": we register the bare name and every element too
+            const std::string arraySuffix = "[0]";
+            if(name.size() > arraySuffix.size() && name.compare(name.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0)
+            {
+               std::string baseName = name.substr(0, name.size() - arraySuffix.size());
+               uniformLocations[baseName] = location;
+
+               for (GLint j = 1; j < size; j++)
+               {
+                  std::string elementName = baseName + "[" + std::to_string(j) + "]";
+                  uniformLocations[elementName] = glGetUniformLocation(program, elementName.c_str());
+               }
+            }
+         }
+      }
+
+      void cacheSubroutines()
+      {
+         cacheStageSubroutines(GL_VERTEX_SHADER, vertexSubroutines);
+         cacheStageSubroutines(GL_FRAGMENT_SHADER, fragmentSubroutines);
+      }
+
+      void cacheStageSubroutines(GLenum stage, StageSubroutines& subroutines)
+      {
+         subroutines.indices.clear();
+         subroutines.selected.clear();
+
+         GLint count = 0, locationCount = 0;
+         glGetProgramStageiv(program, stage, GL_ACTIVE_SUBROUTINES, &count);
+         glGetProgramStageiv(program, stage, GL_ACTIVE_SUBROUTINE_UNIFORM_LOCATIONS, &locationCount);
+
+         GLchar name[256]; GLsizei length;
+         for (GLint i = 0; i < count; i++)
+         {
+            glGetActiveSubroutineName(program, stage, i, sizeof(name), &length, name);
+            subroutines.indices[std::string(name, length)] = (GLuint)i;
+         }
+
+         // every location must always be given a compatible subroutine, so each one starts with the first of its uniform
+         subroutines.selected.assign(locationCount, 0);
+         GLint uniformCount = 0;
+         glGetProgramStageiv(program, stage, GL_ACTIVE_SUBROUTINE_UNIFORMS, &uniformCount);
+         for (GLint i = 0; i < uniformCount; i++)
+         {
+            GLint compatibleCount = 0, arraySize = 1;
+            glGetActiveSubroutineUniformiv(program, stage, i, GL_NUM_COMPATIBLE_SUBROUTINES, &compatibleCount);
+            glGetActiveSubroutineUniformiv(program, stage, i, GL_UNIFORM_SIZE, &arraySize);
+            if(compatibleCount == 0) continue;
+
+            std::vector<GLint> compatible(compatibleCount);
+            glGetActiveSubroutineUniformiv(program, stage, i, GL_COMPATIBLE_SUBROUTINES, compatible.data());
+
+            glGetActiveSubroutineUniformName(program, stage, i, sizeof(name), &length, name);
+            GLint location = glGetSubroutineUniformLocation(program, stage, name);
+            for (GLint j = 0; location >= 0 && j < arraySize && location + j < locationCount; j++) { subroutines.selected[location + j] = (GLuint)compatible[0]; }
+         }
       }
 };
\ No newline at end of file
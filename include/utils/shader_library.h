@@ -0,0 +1,147 @@
+#pragma once
+/*
+   ShaderLibrary class
+   - starts the compilation and the link of all its shaders up front, and checks each one only when it is first needed,
+     so the driver can build them in background (on its own threads with KHR_parallel_shader_compile) while the
+     application does something else, e.g. loading the models
+   - poll() finishes the programs the driver reports as complete, without ever waiting for it
+*/
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <unordered_map>
+#include <initializer_list>
+
+#include <utils/shader.h>
+
+// Startup times of the library: submitMs is spent starting the builds, blockedMs waiting for the ones needed before
+// they were complete. overlappedMs is the time from the submission of each program to its first use, the part
+// of the build the driver could hide behind the work of the application
+struct ShaderLibraryStats
+{
+   size_t programs     = 0;
+   size_t polled       = 0; // finished by poll(), without waiting
+   double submitMs     = 0.0;
+   double blockedMs    = 0.0;
+   double overlappedMs = 0.0;
+};
+
+class ShaderLibrary
+{
+   public:
+      ShaderLibrary()
+      {
+#ifdef GL_KHR_parallel_shader_compile
+         // as many compiler threads as the driver likes
+         if(GLAD_GL_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+#endif
+      }
+
+      ShaderLibrary(const ShaderLibrary&) = delete;
+      ShaderLibrary& operator=(const ShaderLibrary&) = delete;
+
+      // Starts the build, the shader is ready only after get(). A name already in the library is rejected (returns false):
+      // replacing its shader would leave dangling the references given by get() (and the ones ShaderReloader watches)
+      bool add(const std::string& name, const GLchar* vertPath, const GLchar* fragPath,
+               std::initializer_list<const GLchar*> utilPaths = {}, GLuint glMajor = 4, GLuint glMinor = 1)
+      {
+         if(contains(name))
+         {
+            std::cout << "ERROR::SHADER_LIBRARY: a program named " << name << " was already added" << std::endl;
+            return false;
+         }
+
+         auto start = std::chrono::steady_clock::now();
+
+         Entry entry;
+         entry.shader.reset(new Shader(vertPath, fragPath, utilPaths, glMajor, glMinor, BUILD_DEFERRED));
+         entry.submitted = start;
+         shaders[name] = std::move(entry);
+
+         stats.programs = shaders.size();
+         stats.submitMs += elapsedMs(start);
+         return true;
+      }
+
+      // The shader, finished (waiting for the driver if needed) the first time it is asked for.
+      // The reference is valid as long as the library
+      Shader& get(const std::string& name)
+      {
+         Entry& entry = shaders.at(name);
+         if(!entry.shader->isFinished())
+         {
+            stats.overlappedMs += elapsedMs(entry.submitted);
+
+            auto start = std::chrono::steady_clock::now();
+            entry.shader->finish();
+            stats.blockedMs += elapsedMs(start);
+         }
+         return *entry.shader;
+      }
+
+      bool contains(const std::string& name) const { return shaders.count(name) != 0; }
+
+      // Finishes the programs the driver has completed, returns how many are still building
+      // (all of them without KHR_parallel_shader_compile, as the driver cannot be asked)
+      size_t poll()
+      {
+         size_t pending = 0;
+         for (auto& named : shaders)
+         {
+            Entry& entry = named.second;
+            if(entry.shader->isFinished()) continue;
+
+            if(entry.shader->completed())
+            {
+               stats.overlappedMs += elapsedMs(entry.submitted);
+               entry.shader->finish();
+               stats.polled++;
+            }
+            else pending++;
+         }
+         return pending;
+      }
+
+      // Finishes everything, waiting for the driver
+      void finishAll()
+      {
+         for (auto& named : shaders) { get(named.first); }
+      }
+
+      // Deletes all the programs
+      void clear()
+      {
+         for (auto& named : shaders) { named.second.shader->del(); }
+         shaders.clear();
+      }
+
+      const ShaderLibraryStats& buildStats() const noexcept { return stats; }
+
+      void printStats() const
+      {
+         std::cout << "Shaders: " << stats.programs << " programs (" << stats.polled << " finished in background"
+                   << (Shader::parallelCompileSupported() ? "" : ", no KHR_parallel_shader_compile") << ")"
+                   << " - submit " << stats.submitMs << " ms, blocked " << stats.blockedMs << " ms, overlapped "
+                   << stats.overlappedMs << " ms" << std::endl;
+      }
+
+   private:
+      struct Entry
+      {
+         std::unique_ptr<Shader> shader;
+         std::chrono::steady_clock::time_point submitted;
+      };
+
+      std::unordered_map<std::string, Entry> shaders;
+      ShaderLibraryStats stats;
+
+      static double elapsedMs(std::chrono::steady_clock::time_point start)
+      {
+         return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+};
@@ -0,0 +1,124 @@
+#pragma once
+/*
+   ShaderReloader class
+   - watches the files of the programs (shaders and utils), and knows which programs include each file
+   - when a file changes, the sources of the programs depending on it are read again by the watcher thread
+   - update(), on the render thread, rebuilds those programs and swaps each one in only if it links,
+     so a typo in a shader keeps the last working program on screen
+*/
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <iostream>
+#include <algorithm>
+
+#include <utils/shader.h>
+#include <utils/file_watcher.h>
+
+struct ShaderReloadStats
+{
+   size_t reloaded = 0;
+   size_t failed   = 0;
+};
+
+class ShaderReloader
+{
+   public:
+      ShaderReloader(unsigned pollMs = 250) :
+         watcher([this](const std::vector<std::string>& changed) { readChanged(changed); }, pollMs) {}
+
+      ShaderReloader(const ShaderReloader& copy) = delete;
+      ShaderReloader& operator=(const ShaderReloader& copy) = delete;
+
+      // The shader must outlive the reloader (or be forgotten before being destroyed)
+      void watch(Shader& shader)
+      {
+         std::vector<std::string> paths = shader.sourcePaths();
+         {
+            std::lock_guard<std::mutex> lock(dependentsMutex);
+            for (const std::string& path : paths) { dependents[path].push_back(&shader); }
+         }
+         for (const std::string& path : paths) { watcher.add(path); }
+      }
+
+      void forget(Shader& shader)
+      {
+         std::lock_guard<std::mutex> lock(dependentsMutex);
+         for (auto& file : dependents)
+         {
+            std::vector<Shader*>& shaders = file.second;
+            shaders.erase(std::remove(shaders.begin(), shaders.end(), &shader), shaders.end());
+         }
+         auto it = pending.find(&shader);
+         if(it != pending.end()) pending.erase(it);
+      }
+
+      // To be called by the thread owning the GL context: rebuilds the programs whose files changed,
+      // returns how many were swapped in (their subroutine indices and uniform handles must be resolved again)
+      size_t update()
+      {
+         std::map<Shader*, ShaderSources> changed;
+         {
+            // the watcher thread may be reading files with the lock held, we try again next frame
+            std::unique_lock<std::mutex> lock(dependentsMutex, std::try_to_lock);
+            if(!lock.owns_lock() || pending.empty()) return 0;
+            changed.swap(pending);
+         }
+
+         size_t swapped = 0;
+         for (auto& program : changed)
+         {
+            Shader& shader = *program.first;
+            const std::vector<std::string> paths = shader.sourcePaths();
+            if(shader.reload(program.second))
+            {
+               std::cout << "Reloaded program " << paths[paths.size() - 2] << " + " << paths.back() << std::endl;
+               stats.reloaded++;
+               swapped++;
+            }
+            else
+            {
+               std::cout << "Reload of " << paths[paths.size() - 2] << " + " << paths.back() << " failed, keeping the previous program" << std::endl;
+               stats.failed++;
+            }
+         }
+         return swapped;
+      }
+
+      const ShaderReloadStats& reloadStats() const noexcept { return stats; }
+
+   private:
+      std::mutex dependentsMutex;
+      // watched path -> programs built from it
+      std::map<std::string, std::vector<Shader*>> dependents;
+      // programs to rebuild, with their new sources (the last read wins)
+      std::map<Shader*, ShaderSources> pending;
+      ShaderReloadStats stats;
+
+      // last, so that its thread is stopped before the rest is destroyed
+      FileWatcher watcher;
+
+      // Called by the watcher thread: reading the files is the only slow part of a reload not needing GL.
+      // The lock is held while reading, so that forget() cannot return while a shader is being read
+      void readChanged(const std::vector<std::string>& changed)
+      {
+         std::lock_guard<std::mutex> lock(dependentsMutex);
+
+         std::vector<Shader*> shaders;
+         for (const std::string& path : changed)
+         {
+            auto it = dependents.find(path);
+            if(it == dependents.end()) continue;
+            for (Shader* shader : it->second)
+            {
+               if(std::find(shaders.begin(), shaders.end(), shader) == shaders.end()) shaders.push_back(shader);
+            }
+         }
+
+         // the paths of a shader never change (reload() keeps them), so reading them here is safe while the
+         // render thread uses the shader
+         for (Shader* shader : shaders) { pending[shader] = shader->readSources(); }
+      }
+};
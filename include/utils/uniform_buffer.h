@@ -0,0 +1,100 @@
+#pragma once
+/*
+   UniformBuffer class
+   - GPU buffer backing a std140 uniform block, bound to a fixed binding point
+*/
+
+#include <glad/glad.h>
+
+#include <string>
+
+#include <utils/gl_state.h>
+#include <utils/metrics.h>
+
+// Binding points shared by every Shader program:
+// the Shader class binds the blocks by name right after linking
+enum UniformBlockBinding : GLuint
+{
+   LIGHT_BLOCK_BINDING      = 0,
+   FRAME_UNIFORMS_BINDING   = 1,
+   CLUSTER_BLOCK_BINDING    = 2,
+};
+
+// Returns the binding point of a well-known uniform block, -1 if the block is not known
+inline GLint uniformBlockBinding(const std::string& blockName)
+{
+   if(blockName == "LightBlock")    return LIGHT_BLOCK_BINDING;
+   if(blockName == "FrameUniforms") return FRAME_UNIFORMS_BINDING;
+   if(blockName == "ClusterBlock")  return CLUSTER_BLOCK_BINDING;
+   return -1;
+}
+
+class UniformBuffer
+{
+   public:
+      GLuint UBO;
+
+      UniformBuffer(GLsizeiptr size, GLuint binding) noexcept : size(size), binding(binding)
+      {
+         glGenBuffers(1, &UBO);
+         glState().bindBuffer(GL_UNIFORM_BUFFER, UBO);
+         glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+         glState().bindBuffer(GL_UNIFORM_BUFFER, 0);
+
+         // the binding point is context state: every program whose block is bound to it will read this buffer
+         glState().bindBufferBase(GL_UNIFORM_BUFFER, binding, UBO);
+      }
+
+      UniformBuffer(const UniformBuffer& copy) = delete;
+      UniformBuffer& operator=(const UniformBuffer& copy) = delete;
+
+      UniformBuffer(UniformBuffer&& move) noexcept : UBO(move.UBO), size(move.size), binding(move.binding)
+      {
+         move.UBO = 0;
+      }
+
+      UniformBuffer& operator=(UniformBuffer&& move) noexcept
+      {
+         freeGPU();
+
+         UBO = move.UBO; size = move.size; binding = move.binding;
+         move.UBO = 0;
+
+         return *this;
+      }
+
+      ~UniformBuffer() noexcept
+      {
+         freeGPU();
+      }
+
+      // Copies a byte range of the block from CPU memory
+      void update(GLintptr offset, GLsizeiptr rangeSize, const void* data) const noexcept
+      {
+         glState().bindBuffer(GL_UNIFORM_BUFFER, UBO);
+         glBufferSubData(GL_UNIFORM_BUFFER, offset, rangeSize, data);
+         METRIC_ADD(METRIC_BUFFER_BYTES, rangeSize);
+      }
+
+      // Replaces the whole block: the old storage is orphaned, so the driver can hand out
+      // fresh memory instead of waiting for the draws of the previous frame still reading it
+      void orphanAndUpdate(const void* data) const noexcept
+      {
+         glState().bindBuffer(GL_UNIFORM_BUFFER, UBO);
+         glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+         glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+         METRIC_ADD(METRIC_BUFFER_BYTES, size);
+      }
+
+   private:
+      GLsizeiptr size;
+      GLuint binding;
+
+      void freeGPU()
+      {
+         if(UBO)
+         {
+            glState().deleteBuffer(UBO);
+         }
+      }
+};
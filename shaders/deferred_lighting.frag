@@ -0,0 +1,91 @@
+/*
+
+deferred_lighting.frag: lighting pass of the deferred renderer (include/utils/deferred_renderer.h), with fullscreen.vert.
+Every pixel covered by the geometry pass is lit once by all the lights, with the illumination model stored in the
+G-buffer (the same models of lighting.frag, in illumination.utils). The lights with a radius are still looped over
+out of their range, where rangeAttenuation() makes them add nothing
+
+*/
+
+// #version 410 core
+
+// output shader variable
+out vec4 colorFrag;
+
+in vec2 interp_UV;
+
+// the G-buffer written by gbuffer.frag
+uniform sampler2D gNormalModel; // view space normal, illumination model
+uniform sampler2D gMaterial;    // shininess, alpha, F0
+uniform sampler2D gDepth;
+
+// to rebuild the view space position of the pixel from its depth
+uniform mat4 inverseProjectionMatrix;
+
+vec3 calcPointLights(uint model, vec3 viewPosition)
+{
+    vec3 color = vec3(0);
+
+    for(uint i = 0u; i < nPointLights; i++)
+    {
+        currLA = pointLights[i].lightAttrs;
+
+        vec4 lightPos = viewMatrix * vec4(pointLights[i].position, 1); // convert lightposition from world to view coordinates
+        currLI.lightDir = lightPos.xyz + viewPosition; // vector from the pixel to light position in view coords
+
+        // the lights out of reach cost nothing more
+        float attenuation = rangeAttenuation(currLI.lightDir, pointLights[i].radius);
+        if(attenuation > 0.0)
+            color += attenuation * illuminate(model);
+    }
+
+    return color;
+}
+
+vec3 calcSpotLights(uint model, vec3 viewPosition)
+{
+    vec3 color = vec3(0);
+
+    for(uint i = 0u; i < nSpotLights; i++)
+    {
+        currLA = spotLights[i].lightAttrs;
+
+        vec4 lightPos = viewMatrix * vec4(spotLights[i].position, 1);
+        currLI.lightDir = lightPos.xyz + viewPosition;
+        vec3 direction = mat3(viewMatrix) * spotLights[i].direction;
+
+        float factor = rangeAttenuation(currLI.lightDir, spotLights[i].radius) * spotCone(currLI.lightDir, direction, cos(spotLights[i].cutoffAngle));
+        if(factor > 0.0)
+            color += factor * illuminate(model);
+    }
+
+    return color;
+}
+
+void main(void)
+{
+    float depth = texture(gDepth, interp_UV).r;
+    // nothing was drawn here: the pixel keeps the clear color
+    if(depth == 1.0)
+        discard;
+
+    // the following passes test against the depth of the geometry pass
+    gl_FragDepth = depth;
+
+    vec4 ndcPosition = vec4(interp_UV * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 position = inverseProjectionMatrix * ndcPosition;
+    // as in the vertex shaders, the vector pointing to the camera
+    vec3 viewPosition = -position.xyz / position.w;
+
+    vec4 normalModel = texture(gNormalModel, interp_UV);
+    vec4 material = texture(gMaterial, interp_UV);
+
+    currLI.vNormal = normalModel.xyz;
+    currLI.vViewPosition = viewPosition;
+    currMaterial = MaterialParameters(material.x, material.y, material.z);
+
+    uint model = uint(normalModel.w + 0.5);
+    vec3 color = calcPointLights(model, viewPosition) + calcSpotLights(model, viewPosition);
+
+    colorFrag = vec4(color, 1.0);
+}
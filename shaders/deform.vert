@@ -7,7 +7,8 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 UV;
 
-uniform mat4 u_model, u_view, u_proj;
+uniform mat4 u_model;
+// view and projection matrices come from the FrameUniforms block (uniform_blocks.utils)
 uniform mat3 u_norm; 
 // for normals we care only about the mat3 rotational submatrix of the model
 // such that we ignore the translation component (vertical vector to the right)
@@ -34,7 +35,7 @@ void main()
     
     vec3 final_pos = position;
 
-    gl_Position = u_proj * u_view * u_model * vec4(final_pos, 1.0f);
+    gl_Position = viewProjectionMatrix * u_model * vec4(final_pos, 1.0f);
     interp_N = normalize(u_norm * normal);
     interp_UV = UV;
 }
@@ -0,0 +1,17 @@
+/*
+
+fullscreen.vert: a triangle covering the whole viewport, built from gl_VertexID (draw 3 vertices, no vertex buffer)
+
+*/
+
+// #version 410 core
+
+// UV coordinates of the pixel on the screen
+out vec2 interp_UV;
+
+void main()
+{
+	// (0,0), (2,0), (0,2): the part of the triangle outside of the screen is clipped
+	interp_UV = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(interp_UV * 2.0 - 1.0, 0.0, 1.0);
+}
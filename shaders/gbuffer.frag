@@ -0,0 +1,49 @@
+/*
+
+gbuffer.frag: geometry pass of the deferred renderer (include/utils/deferred_renderer.h).
+Nothing is lit here: the surface of the nearest fragment is stored in the G-buffer, and deferred_lighting.frag
+lights each pixel once, whatever the overdraw. It goes with procedural_base.vert or procedural_instanced.vert
+
+*/
+
+// #version 410 core
+
+// the G-buffer targets
+layout (location = 0) out vec4 gNormalModel; // view space normal, illumination model
+layout (location = 1) out vec4 gMaterial;    // shininess, alpha, F0
+
+in vec3 vNormal;       // interpolated view space normal
+in vec3 vViewPosition; // interpolated vector pointing to the camera (rebuilt from the depth in the lighting pass)
+
+// the same uniforms of lighting.frag, set by the Material class
+uniform float shininess;
+uniform float alpha;
+uniform float F0;
+
+////////////////////////////////////////////////////////////////////
+
+// the subroutines have the names of the illumination models of lighting.frag, so the application selects them
+// in the same way: here they just return the index of the model, which is read by the lighting pass
+subroutine uint illum_model_index();
+
+subroutine uniform illum_model_index Illumination_Model;
+
+subroutine(illum_model_index)
+uint Lambert() { return LAMBERT_MODEL; }
+
+subroutine(illum_model_index)
+uint Phong() { return PHONG_MODEL; }
+
+subroutine(illum_model_index)
+uint BlinnPhong() { return BLINN_PHONG_MODEL; }
+
+subroutine(illum_model_index)
+uint GGX() { return GGX_MODEL; }
+
+////////////////////////////////////////////////////////////////////
+
+void main(void)
+{
+    gNormalModel = vec4(normalize(vNormal), float(Illumination_Model()));
+    gMaterial = vec4(shininess, alpha, F0, 1.0);
+}
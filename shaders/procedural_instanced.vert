@@ -0,0 +1,48 @@
+/*
+
+procedural_instanced.vert: instanced variant of procedural_base.vert, to be used with the InstancedObjectBatch class.
+Model and normal matrices are per-instance vertex attributes instead of uniforms
+
+*/
+
+// #version 410 core
+
+// vertex position in world coordinates
+layout (location = 0) in vec3 position;
+// vertex normal
+layout (location = 1) in vec3 normal;
+// UV texture coordinates
+layout (location = 2) in vec2 UV;
+// per-instance model matrix (it takes locations 5 to 8)
+layout (location = 5) in mat4 instanceModelMatrix;
+// per-instance normal matrix in world space (it takes locations 9 to 11)
+layout (location = 9) in mat3 instanceNormalMatrix;
+// the numbers used for the location in the layout qualifier are the positions of the vertex attribute
+// as defined in the Mesh class
+
+// view and projection matrices come from the FrameUniforms block (uniform_blocks.utils)
+
+// Model-view position
+vec4 mvPosition;
+
+// Lights are read per-fragment from the LightBlock (uniform_blocks.utils): we only pass
+// the view space normal and the vector pointing to the camera, whatever the number of lights
+out vec3 vNormal;       // we pass the vertex normal vector
+out vec3 vViewPosition; // we pass the vector pointing to the camera, useful for specular component
+
+// the output variable for UV coordinates
+out vec2 interp_UV;
+
+void main()
+{
+	mvPosition = viewMatrix * instanceModelMatrix * vec4(position, 1);
+	// I assign the values to a variable with "out" qualifier so to use the per-fragment interpolated values in the Fragment shader
+	interp_UV = UV;
+
+	vViewPosition = -mvPosition.xyz; // it would be camera pos - vertex pos in view coords, but camera in view coords is the origin thus is zero
+	// the view matrix is a rigid transformation, so its rotational part brings the world space normal in view space
+	vNormal = normalize(mat3(viewMatrix) * instanceNormalMatrix * normal);
+
+	// transformations are applied to each vertex
+	gl_Position = projectionMatrix * mvPosition;
+}